@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
+#include "asyncwriter.h"
+
+// the states of a block in the ring
+#define BLOCK_EMPTY	0
+#define BLOCK_FULL	1
+
+asyncWriter::asyncWriter(string fileName, size_t blockBytes, unsigned numBlock){
+	fout.open(fileName.c_str(), ios_base::binary | ios_base::trunc);
+	if(!fout){
+		printf("open %s failed!\n", fileName.c_str());
+		exit(-1);
+	}
+
+	// one block is filled while at least one is written
+	blockSize = blockBytes;
+	nBlockNum = (numBlock < 2) ? 2 : numBlock;
+	block = new char*[nBlockNum];
+	blockFill = new size_t[nBlockNum];
+	blockState = new int[nBlockNum];
+	for(unsigned i = 0; i < nBlockNum; i++){
+		block[i] = new char[blockSize];
+		blockFill[i] = 0;
+		blockState[i] = BLOCK_EMPTY;
+	}
+	fillSlot = 0;
+	writeSlot = 0;
+	writerStop = 0;
+
+	if(pthread_create(&writerThread, NULL, writerEntry, (void*)this) != 0){
+		printf("create writer thread failed!\n");
+		exit(-1);
+	}
+	opened = true;
+}
+
+asyncWriter::~asyncWriter(){
+	close();
+	for(unsigned i = 0; i < nBlockNum; i++){
+		delete[] block[i];
+	}
+	delete[] block;
+	delete[] blockFill;
+	delete[] blockState;
+}
+
+void asyncWriter::submit(){
+	__atomic_store_n(&blockState[fillSlot], BLOCK_FULL, __ATOMIC_RELEASE);
+	fillSlot = (fillSlot + 1) % nBlockNum;
+
+	// wait for the writer thread to write the next block
+	unsigned spin = 0;
+	while(__atomic_load_n(&blockState[fillSlot], __ATOMIC_ACQUIRE) != BLOCK_EMPTY){
+		if(++spin < 1000){
+			sched_yield();
+		}
+		else{
+			usleep(100);
+		}
+	}
+	blockFill[fillSlot] = 0;
+	return;
+}
+
+/*
+ * The blocks are written in order, the thread exits when it is stopped and all the
+ * blocks handed to it are written.
+*/
+void asyncWriter::writerLoop(){
+	while(true){
+		// the stop flag is read first, so the blocks handed over before the stop are seen
+		int stop = __atomic_load_n(&writerStop, __ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&blockState[writeSlot], __ATOMIC_ACQUIRE) != BLOCK_FULL){
+			if(stop){
+				break;
+			}
+			usleep(100);
+			continue;
+		}
+
+		fout.write(block[writeSlot], blockFill[writeSlot]);
+		__atomic_store_n(&blockState[writeSlot], BLOCK_EMPTY, __ATOMIC_RELEASE);
+		writeSlot = (writeSlot + 1) % nBlockNum;
+	}
+	return;
+}
+
+void* asyncWriter::writerEntry(void* writer){
+	((asyncWriter*)writer)->writerLoop();
+	return NULL;
+}
+
+void asyncWriter::write(const void* data, size_t size){
+	const char* p = (const char*)data;
+	while(size > 0){
+		size_t n = available();
+		n = (n > size) ? size : n;
+		memcpy(block[fillSlot] + blockFill[fillSlot], p, n);
+		blockFill[fillSlot] += n;
+		p += n;
+		size -= n;
+		if(available() == 0){
+			submit();
+		}
+	}
+	return;
+}
+
+void* asyncWriter::reserve(size_t size){
+	if(size > blockSize){
+		printf("%lu bytes do not fit in a block of %lu bytes!\n", (unsigned long)size, (unsigned long)blockSize);
+		exit(-1);
+	}
+	if(size > available()){
+		submit();
+	}
+	void* p = block[fillSlot] + blockFill[fillSlot];
+	blockFill[fillSlot] += size;
+	return p;
+}
+
+size_t asyncWriter::available(){
+	return blockSize - blockFill[fillSlot];
+}
+
+void asyncWriter::close(){
+	if(!opened){
+		return;
+	}
+
+	// the last block is handed over even if it is not full
+	if(blockFill[fillSlot] > 0){
+		__atomic_store_n(&blockState[fillSlot], BLOCK_FULL, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&writerStop, 1, __ATOMIC_RELEASE);
+	pthread_join(writerThread, NULL);
+	fout.close();
+	opened = false;
+	return;
+}
@@ -0,0 +1,54 @@
+#ifndef _ASYNCWRITER_H_
+#define _ASYNCWRITER_H_
+
+#include <string>
+#include <fstream>
+#include <pthread.h>
+
+using namespace std;
+
+/*
+ * A file written by a background thread in large blocks.
+ * The producer fills a block in memory while the blocks filled before are written,
+ * so the file is written with a few large writes and the producer rarely waits.
+*/
+class asyncWriter
+{
+private:
+	ofstream	fout;
+	size_t		blockSize;			// the bytes of a block
+	unsigned	nBlockNum;			// the number of blocks in the ring
+	char**		block;				// the ring of blocks
+	size_t*		blockFill;			// the bytes filled in each block
+	volatile int*	blockState;		// BLOCK_EMPTY or BLOCK_FULL for each block
+	unsigned	fillSlot;			// the block filled by the producer
+	unsigned	writeSlot;			// the block to be written next by the writer thread
+	volatile int	writerStop;		// set to 1 to terminate the writer thread
+	bool		opened;
+	pthread_t	writerThread;
+
+	// hand the current block to the writer thread and wait for the next block to be empty
+	void submit();
+	// the main loop of the writer thread
+	void writerLoop();
+	static void* writerEntry(void* writer);
+
+public:
+	asyncWriter(string fileName, size_t blockBytes = 8 << 20, unsigned numBlock = 3);
+	~asyncWriter();
+
+	// append size bytes to the file
+	void write(const void* data, size_t size);
+	/*
+	 * The space for the next size bytes of the file in the current block, which the caller
+	 * fills before the next call. A size larger than a block is an error. The block is handed to the
+	 * writer thread when there is no room left, see available().
+	*/
+	void* reserve(size_t size);
+	// the bytes left in the current block
+	size_t available();
+	// write the remaining data and close the file
+	void close();
+};
+
+#endif
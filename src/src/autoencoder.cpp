@@ -21,6 +21,9 @@ autoencoder::autoencoder(){
 	eps_w = 0.000001; // learning rate for weights
 	eps_b = 0.000001; // learning rate for biases
 
+	sigMode = SIGMOID_POLY;
+	errorSum = 0.0;
+
 	weight0 = new floatType[nLayerSize0 * nLayerSize1];
 	weight1 = new floatType[nLayerSize1 * nLayerSize2];
 	weight2 = new floatType[nLayerSize2 * nLayerSize3];
@@ -150,24 +153,16 @@ autoencoder::autoencoder(){
 
 void autoencoder::fprop(){
 	// 1st layer to 2nd layer
-	addBias(layer1act, bias0, nLayerSize1, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize1, nVectorPerBatch, nLayerSize0, 1.0, weight0, nLayerSize1, layer0act, nLayerSize0, 1.0, layer1act, nLayerSize1);
-	sigmoid(layer1act, nLayerSize1 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize1, nVectorPerBatch, nLayerSize0, weight0, nLayerSize1, layer0act, bias0, true, sigMode, layer1act, NULL, NULL);
 
 	// 2nd layer to 3rd layer
-	addBias(layer2act, bias1, nLayerSize2, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize2, nVectorPerBatch, nLayerSize1, 1.0, weight1, nLayerSize2, layer1act, nLayerSize1, 1.0, layer2act, nLayerSize2);
-	sigmoid(layer2act, nLayerSize2 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize2, nVectorPerBatch, nLayerSize1, weight1, nLayerSize2, layer1act, bias1, true, sigMode, layer2act, NULL, NULL);
 
 	// 3rd layer to 4th layer
-	addBias(layer3act, bias2, nLayerSize3, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize3, nVectorPerBatch, nLayerSize2, 1.0, weight2, nLayerSize3, layer2act, nLayerSize2, 1.0, layer3act, nLayerSize3);
-	sigmoid(layer3act, nLayerSize3 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize3, nVectorPerBatch, nLayerSize2, weight2, nLayerSize3, layer2act, bias2, true, sigMode, layer3act, NULL, NULL);
 
 	// 4th layer to 5th layer
-	addBias(layer4act, bias3, nLayerSize4, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize4, nVectorPerBatch, nLayerSize3, 1.0, weight3, nLayerSize4, layer3act, nLayerSize3, 1.0, layer4act, nLayerSize4);
-	sigmoid(layer4act, nLayerSize4 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize4, nVectorPerBatch, nLayerSize3, weight3, nLayerSize4, layer3act, bias3, true, sigMode, layer4act, NULL, NULL);
 
 	// rounding for Layer 4
 	for(int i = 0; i < nLayerSize4 * nVectorPerBatch; i++){
@@ -175,31 +170,17 @@ void autoencoder::fprop(){
 	}
 
 	// 5th layer to 6th layer
-	addBias(layer5act, bias4, nLayerSize5, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize5, nVectorPerBatch, nLayerSize4, 1.0, weight4, nLayerSize5, layer4state, nLayerSize4, 1.0, layer5act, nLayerSize5);
-	sigmoid(layer5act, nLayerSize5 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize5, nVectorPerBatch, nLayerSize4, weight4, nLayerSize5, layer4state, bias4, true, sigMode, layer5act, NULL, NULL);
 
 	// 6th layer to 7th layer
-	addBias(layer6act, bias5, nLayerSize6, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize6, nVectorPerBatch, nLayerSize5, 1.0, weight5, nLayerSize6, layer5act, nLayerSize5, 1.0, layer6act, nLayerSize6);
-	sigmoid(layer6act, nLayerSize6 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize6, nVectorPerBatch, nLayerSize5, weight5, nLayerSize6, layer5act, bias5, true, sigMode, layer6act, NULL, NULL);
 
 	// 7th layer to 8th layer
-	addBias(layer7act, bias6, nLayerSize7, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize7, nVectorPerBatch, nLayerSize6, 1.0, weight6, nLayerSize7, layer6act, nLayerSize6, 1.0, layer7act, nLayerSize7);
-	sigmoid(layer7act, nLayerSize7 * nVectorPerBatch);
+	gemmLayer('n', nLayerSize7, nVectorPerBatch, nLayerSize6, weight6, nLayerSize7, layer6act, bias6, true, sigMode, layer7act, NULL, NULL);
 
 	// 8th layer to 9th layer
-	addBias(layer8act, bias7, nLayerSize8, nVectorPerBatch);
-	sgemm('n', 'n', nLayerSize8, nVectorPerBatch, nLayerSize7, 1.0, weight7, nLayerSize8, layer7act, nLayerSize7, 1.0, layer8act, nLayerSize8);
-	sigmoid(layer8act, nLayerSize8 * nVectorPerBatch);
-	
-	floatType cost = EuDist(layer8act, layer0act, nLayerSize0 * nVectorPerBatch);
-
-	for(int i = 0; i < nLayerSize8 * nVectorPerBatch; i++){
-		error[i] += (layer8act[i] - layer0act[i]) * (layer8act[i] - layer0act[i]);
-	}
-	
+	// the reconstruction error is summed while the output is in cache
+	errorSum += gemmLayer('n', nLayerSize8, nVectorPerBatch, nLayerSize7, weight7, nLayerSize8, layer7act, bias7, true, sigMode, layer8act, NULL, layer0act);
 }
 
 void autoencoder::bprop(){
@@ -209,7 +190,7 @@ void autoencoder::bprop(){
 		layer8err[i] = layer8act[i] - layer0act[i];
 	}
 	// back propagation
-	sgemm('t', 'n', nLayerSize7, nVectorPerBatch, nLayerSize8, 1.0, weight7, nLayerSize8, layer8err, nLayerSize8, 0.0, layer7err, nLayerSize7);
+	gemm('t', 'n', nLayerSize7, nVectorPerBatch, nLayerSize8, 1.0, weight7, nLayerSize8, layer8err, nLayerSize8, 0.0, layer7err, nLayerSize7);
 
 	// calculate derivatives
 	for(int i = 0; i < nLayerSize7 * nVectorPerBatch; i++){
@@ -218,63 +199,63 @@ void autoencoder::bprop(){
 
 	// compute gradients for biases and weights
 	sumBatch(layer7err, delta_bias7, nLayerSize7, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize8, nLayerSize7, nVectorPerBatch, 1.0, layer8err, nLayerSize8, layer7act, nLayerSize7, 0.0, delta_weight7, nLayerSize8);
+	gemm('n', 't', nLayerSize8, nLayerSize7, nVectorPerBatch, 1.0, layer8err, nLayerSize8, layer7act, nLayerSize7, 0.0, delta_weight7, nLayerSize8);
 
 	// 8th layer to 7th layer
-	sgemm('t', 'n', nLayerSize6, nVectorPerBatch, nLayerSize7, 1.0, weight6, nLayerSize7, layer7err, nLayerSize7, 0.0, layer6err, nLayerSize6);
+	gemm('t', 'n', nLayerSize6, nVectorPerBatch, nLayerSize7, 1.0, weight6, nLayerSize7, layer7err, nLayerSize7, 0.0, layer6err, nLayerSize6);
 	for(int i = 0; i < nLayerSize6 * nVectorPerBatch; i++){
 		layer6err[i] *= (1 - layer6act[i]) * layer6act[i];
 	}
 	sumBatch(layer6err, delta_bias6, nLayerSize6, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize7, nLayerSize6, nVectorPerBatch, 1.0, layer7err, nLayerSize7, layer6act, nLayerSize6, 0.0, delta_weight6, nLayerSize7);
+	gemm('n', 't', nLayerSize7, nLayerSize6, nVectorPerBatch, 1.0, layer7err, nLayerSize7, layer6act, nLayerSize6, 0.0, delta_weight6, nLayerSize7);
 	
 	// 7th layer to 6th layer
-	sgemm('t', 'n', nLayerSize5, nVectorPerBatch, nLayerSize6, 1.0, weight5, nLayerSize6, layer6err, nLayerSize6, 0.0, layer5err, nLayerSize5);
+	gemm('t', 'n', nLayerSize5, nVectorPerBatch, nLayerSize6, 1.0, weight5, nLayerSize6, layer6err, nLayerSize6, 0.0, layer5err, nLayerSize5);
 	for(int i = 0; i < nLayerSize5 * nVectorPerBatch; i++){
 		layer5err[i] *= (1 - layer5act[i]) * layer5act[i];
 	}
 	sumBatch(layer5err, delta_bias5, nLayerSize5, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize6, nLayerSize5, nVectorPerBatch, 1.0, layer6err, nLayerSize6, layer5act, nLayerSize5, 0.0, delta_weight5, nLayerSize6);
+	gemm('n', 't', nLayerSize6, nLayerSize5, nVectorPerBatch, 1.0, layer6err, nLayerSize6, layer5act, nLayerSize5, 0.0, delta_weight5, nLayerSize6);
 
 	// 6th layer to 5th layer
-	sgemm('t', 'n', nLayerSize4, nVectorPerBatch, nLayerSize5, 1.0, weight4, nLayerSize5, layer5err, nLayerSize5, 0.0, layer4err, nLayerSize4);
+	gemm('t', 'n', nLayerSize4, nVectorPerBatch, nLayerSize5, 1.0, weight4, nLayerSize5, layer5err, nLayerSize5, 0.0, layer4err, nLayerSize4);
 	for(int i = 0; i < nLayerSize4 * nVectorPerBatch; i++){
 		layer4err[i] *= (1 - layer4act[i]) * layer4act[i];
 	}
 	sumBatch(layer4err, delta_bias4, nLayerSize4, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize5, nLayerSize4, nVectorPerBatch, 1.0, layer5err, nLayerSize5, layer4act, nLayerSize4, 0.0, delta_weight4, nLayerSize5);
+	gemm('n', 't', nLayerSize5, nLayerSize4, nVectorPerBatch, 1.0, layer5err, nLayerSize5, layer4act, nLayerSize4, 0.0, delta_weight4, nLayerSize5);
 
 	// 5th layer to 4th layer
-	sgemm('t', 'n', nLayerSize3, nVectorPerBatch, nLayerSize4, 1.0, weight3, nLayerSize4, layer4err, nLayerSize4, 0.0, layer3err, nLayerSize3);
+	gemm('t', 'n', nLayerSize3, nVectorPerBatch, nLayerSize4, 1.0, weight3, nLayerSize4, layer4err, nLayerSize4, 0.0, layer3err, nLayerSize3);
 	for(int i = 0; i < nLayerSize3 * nVectorPerBatch; i++){
 		layer3err[i] *= (1 - layer3act[i]) * layer3act[i];
 	}
 	sumBatch(layer3err, delta_bias3, nLayerSize3, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize4, nLayerSize3, nVectorPerBatch, 1.0, layer4err, nLayerSize4, layer3act, nLayerSize3, 0.0, delta_weight3, nLayerSize4);
+	gemm('n', 't', nLayerSize4, nLayerSize3, nVectorPerBatch, 1.0, layer4err, nLayerSize4, layer3act, nLayerSize3, 0.0, delta_weight3, nLayerSize4);
 
 	// 4th layer to 3rd layer
-	sgemm('t', 'n', nLayerSize2, nVectorPerBatch, nLayerSize3, 1.0, weight2, nLayerSize3, layer3err, nLayerSize3, 0.0, layer2err, nLayerSize2);
+	gemm('t', 'n', nLayerSize2, nVectorPerBatch, nLayerSize3, 1.0, weight2, nLayerSize3, layer3err, nLayerSize3, 0.0, layer2err, nLayerSize2);
 	for(int i = 0; i < nLayerSize2 * nVectorPerBatch; i++){
 		layer2err[i] *= (1 - layer2act[i]) * layer2act[i];
 	}
 	sumBatch(layer2err, delta_bias2, nLayerSize2, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize3, nLayerSize2, nVectorPerBatch, 1.0, layer3err, nLayerSize3, layer2act, nLayerSize2, 0.0, delta_weight2, nLayerSize3);
+	gemm('n', 't', nLayerSize3, nLayerSize2, nVectorPerBatch, 1.0, layer3err, nLayerSize3, layer2act, nLayerSize2, 0.0, delta_weight2, nLayerSize3);
 
 	// 3rd layer to 2nd layer
-	sgemm('t', 'n', nLayerSize1, nVectorPerBatch, nLayerSize2, 1.0, weight1, nLayerSize2, layer2err, nLayerSize2, 0.0, layer1err, nLayerSize1);
+	gemm('t', 'n', nLayerSize1, nVectorPerBatch, nLayerSize2, 1.0, weight1, nLayerSize2, layer2err, nLayerSize2, 0.0, layer1err, nLayerSize1);
 	for(int i = 0; i < nLayerSize1 * nVectorPerBatch; i++){
 		layer1err[i] *= (1 - layer1act[i]) * layer1act[i];
 	}
 	sumBatch(layer1err, delta_bias1, nLayerSize1, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize2, nLayerSize1, nVectorPerBatch, 1.0, layer2err, nLayerSize2, layer1act, nLayerSize1, 0.0, delta_weight1, nLayerSize2);
+	gemm('n', 't', nLayerSize2, nLayerSize1, nVectorPerBatch, 1.0, layer2err, nLayerSize2, layer1act, nLayerSize1, 0.0, delta_weight1, nLayerSize2);
 
 	// 2nd layer to 1st layer
-	sgemm('t', 'n', nLayerSize0, nVectorPerBatch, nLayerSize1, 1.0, weight0, nLayerSize1, layer1err, nLayerSize1, 0.0, layer0err, nLayerSize0);
+	gemm('t', 'n', nLayerSize0, nVectorPerBatch, nLayerSize1, 1.0, weight0, nLayerSize1, layer1err, nLayerSize1, 0.0, layer0err, nLayerSize0);
 	for(int i = 0; i < nLayerSize0 * nVectorPerBatch; i++){
 		layer0err[i] *= (1 - layer0act[i]) * layer0act[i];
 	}
 	sumBatch(layer0err, delta_bias0, nLayerSize0, nVectorPerBatch);
-	sgemm('n', 't', nLayerSize1, nLayerSize0, nVectorPerBatch, 1.0, layer1err, nLayerSize1, layer0act, nLayerSize0, 0.0, delta_weight0, nLayerSize1);
+	gemm('n', 't', nLayerSize1, nLayerSize0, nVectorPerBatch, 1.0, layer1err, nLayerSize1, layer0act, nLayerSize0, 0.0, delta_weight0, nLayerSize1);
 
 }
 
@@ -339,27 +320,24 @@ void autoencoder::update(){
 void autoencoder::train(){
 	for(int epoch = 0; epoch < nEpochNum; epoch++){
 		dataprovider->reset();
-		double errsum = 0.0;
+		errorSum = 0.0;
 		printf("Epoch %d\n", epoch + 1);
 
 		for(int batch = 0; batch < nBatchNum; batch++){
+			// the batch belongs to the data provider and stays valid until the next call
 			layer0act = dataprovider->getNextBatch();
 			fprop();
 			bprop();
 			update();
-			delete[] layer0act;
 		}
 
-		for(int i = 0; i < nLayerSize8 * nVectorPerBatch; i++){
-			errsum += error[i];
-		}
-		printf("Epoch %d Error %f\n", epoch + 1, errsum);
+		printf("Epoch %d Error %f\n", epoch + 1, errorSum);
 
 		ofstream fout;
 		fout.open("../log/errorLog.txt", ios_base::app);
 		struct timeval now;
 		gettimeofday(&now, NULL);
-		fout << now.tv_sec << ',' << errsum << endl;
+		fout << now.tv_sec << ',' << errorSum << endl;
 		fout.close();
 	}
 
@@ -25,6 +25,8 @@ protected:
 	floatType eps_w; // learning rate for weights
 	floatType eps_b; // learning rate for biases
 
+	sigmoidMode sigMode; // the accuracy of the sigmoid of the CPU implementation
+
 	// network parameters
 	floatType* weight0;
 	floatType* weight1;
@@ -86,6 +88,7 @@ protected:
 
 	// error vector
 	floatType* error;
+	double errorSum; // the squared reconstruction errors of the batches of this epoch
 
 public:
 	// data object
@@ -103,8 +106,12 @@ public:
 
 	// the training function
 	virtual void train();
+
+	inline void setSigmoidMode(sigmoidMode mode){sigMode = mode;};
 };
 
+#ifdef _AMD_GPU_
+
 class autoencoder_GPU : public autoencoder{
 protected:
 	// network parameters
@@ -209,3 +216,5 @@ public:
 };
 
 #endif
+
+#endif
@@ -0,0 +1,626 @@
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<cmath>
+#include<fstream>
+#include<sys/time.h>
+#include "simd.h"
+#include "retina.h"
+#include "gemm.h"
+#include "utils.h"
+
+using namespace std;
+
+/*
+ * Micro-benchmarks of the CPU kernels.
+ * Build with compile.sh and run ../bin/benchmark, all the data is generated in memory or in /tmp.
+*/
+
+// the size of a patch vector in the GB-RBM layer
+const unsigned nPixelPerData = 336;
+
+double wallTime(){
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+/*
+ * Fill the normalization factors with values in the range of the CIFAR-10 statistics
+*/
+void makeStat(floatType* mean, floatType* variance, floatType* scale, floatType* offset){
+	for(unsigned i = 0; i < nPixelPerData; i++){
+		mean[i] = 0.4 + 0.1 * rand() / RAND_MAX;
+		variance[i] = 0.2 + 0.1 * rand() / RAND_MAX;
+		scale[i] = 1.0 / (255.0 * variance[i]);
+		offset[i] = - mean[i] / variance[i];
+	}
+}
+
+/*
+ * The byte-to-float conversion of dataProvider::loadByteFileToBuffer() in memory.
+ * The throughput is reported in MB/s of input bytes.
+*/
+void benchNormalizeBytes(){
+	const unsigned nVec = 100000;
+	const unsigned nRepeat = 10;
+	const char* levelName[3] = {"scalar", "AVX2", "AVX-512"};
+
+	unsigned char* src = new unsigned char[nVec * nPixelPerData];
+	floatType* dst = new floatType[nVec * nPixelPerData];
+	floatType mean[nPixelPerData], variance[nPixelPerData], scale[nPixelPerData], offset[nPixelPerData];
+
+	for(unsigned i = 0; i < nVec * nPixelPerData; i++){
+		src[i] = rand() & 255;
+	}
+	makeStat(mean, variance, scale, offset);
+
+	printf("byte to float normalization, %u vectors x %u pixels\n", nVec, nPixelPerData);
+
+	// the original loop: divide by 255, subtract the mean and divide by the standard variance
+	double start = wallTime();
+	for(unsigned r = 0; r < nRepeat; r++){
+		for(unsigned v = 0; v < nVec; v++){
+			for(unsigned i = 0; i < nPixelPerData; i++){
+				dst[v * nPixelPerData + i] = ((((floatType)src[v * nPixelPerData + i]) / 255.0) - mean[i]) / variance[i];
+			}
+		}
+	}
+	double elapsed = wallTime() - start;
+	printf("  %-10s %10.1f MB/s\n", "divide", nRepeat * (double)nVec * nPixelPerData / elapsed / 1e6);
+
+	for(int level = SIMD_SCALAR; level <= simdDetect(); level++){
+		start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			normalizeBytes(dst, src, scale, offset, nVec, nPixelPerData, (simdLevel)level);
+		}
+		elapsed = wallTime() - start;
+		printf("  %-10s %10.1f MB/s\n", levelName[level], nRepeat * (double)nVec * nPixelPerData / elapsed / 1e6);
+	}
+
+	delete[] src;
+	delete[] dst;
+}
+
+/*
+ * Loading a patch file into a float buffer: one seekg and read per vector with the scalar
+ * conversion against 4 MB reads with the vectorized conversion. The file is read once before
+ * the measurement, so both loaders read from the page cache and the parsing cost is compared.
+*/
+void benchLoadByteFile(){
+	const unsigned nVec = 200000;
+	const char* fileName = "/tmp/benchmark_patch.dat";
+
+	unsigned char* bytes = new unsigned char[nVec * nPixelPerData];
+	floatType* buffer = new floatType[nVec * nPixelPerData];
+	floatType mean[nPixelPerData], variance[nPixelPerData], scale[nPixelPerData], offset[nPixelPerData];
+
+	for(unsigned i = 0; i < nVec * nPixelPerData; i++){
+		bytes[i] = rand() & 255;
+	}
+	makeStat(mean, variance, scale, offset);
+
+	ofstream fout;
+	fout.open(fileName, ios_base::binary | ios_base::trunc);
+	fout.write((char*)bytes, nVec * nPixelPerData);
+	fout.close();
+
+	printf("patch file loading, %u vectors x %u pixels\n", nVec, nPixelPerData);
+
+	ifstream fin;
+	fin.open(fileName, ios_base::binary);
+	fin.read((char*)bytes, nVec * nPixelPerData);
+	fin.close();
+
+	// the original loader
+	double start = wallTime();
+	fin.open(fileName, ios_base::binary);
+	unsigned char tempBuffer[nPixelPerData];
+	for(unsigned v = 0; v < nVec; v++){
+		fin.seekg((streamoff)v * nPixelPerData);
+		fin.read((char*)tempBuffer, nPixelPerData);
+		for(unsigned i = 0; i < nPixelPerData; i++){
+			buffer[v * nPixelPerData + i] = ((((floatType)tempBuffer[i]) / 255.0) - mean[i]) / variance[i];
+		}
+	}
+	fin.close();
+	double elapsed = wallTime() - start;
+	printf("  %-10s %10.1f MB/s\n", "per-vector", (double)nVec * nPixelPerData / elapsed / 1e6);
+
+	// the bulk loader
+	const unsigned nStagingVecNum = (4 << 20) / nPixelPerData;
+	start = wallTime();
+	fin.open(fileName, ios_base::binary);
+	for(unsigned v = 0; v < nVec; v += nStagingVecNum){
+		unsigned nSpanVecNum = (nVec - v > nStagingVecNum) ? nStagingVecNum : nVec - v;
+		fin.read((char*)bytes, nSpanVecNum * nPixelPerData);
+		normalizeBytes(buffer + v * nPixelPerData, bytes, scale, offset, nSpanVecNum, nPixelPerData);
+	}
+	fin.close();
+	elapsed = wallTime() - start;
+	printf("  %-10s %10.1f MB/s\n", "bulk", (double)nVec * nPixelPerData / elapsed / 1e6);
+
+	remove(fileName);
+	delete[] bytes;
+	delete[] buffer;
+}
+
+/*
+ * The patch stage of cifarPreProcessor::makePatchDataFiles(): 81 windows x 3 channels per
+ * 32x32 image. The pooling in each window against one pooled image per channel.
+ * The throughput is reported in images per second.
+*/
+void benchRetina(){
+	const unsigned nImage = 20000;
+	const unsigned nPixelPerImage = 3 * 32 * 32;
+	const unsigned nPatchBytePerImage = 3 * 81 * RETINA_VECTOR_SIZE;
+
+	unsigned char* raw = new unsigned char[nImage * nPixelPerImage];
+	unsigned char* patch = new unsigned char[nImage * nPatchBytePerImage];
+	unsigned char* check = new unsigned char[nImage * nPatchBytePerImage];
+
+	for(unsigned i = 0; i < nImage * nPixelPerImage; i++){
+		raw[i] = rand() & 255;
+	}
+
+	printf("retina patches, %u images\n", nImage);
+
+	// the pooling in each window
+	double start = wallTime();
+	for(unsigned image = 0; image < nImage; image++){
+		unsigned char* odata = check + image * nPatchBytePerImage;
+		for(unsigned row = 0; row <= 16; row += 2){
+			for(unsigned col = 0; col <= 16; col += 2){
+				for(unsigned channel = 0; channel < 3; channel++){
+					retinaPermutation(odata, raw + image * nPixelPerImage + channel * 1024 + row * 32 + col, 32, 32);
+					odata += RETINA_VECTOR_SIZE;
+				}
+			}
+		}
+	}
+	double elapsed = wallTime() - start;
+	printf("  %-10s %10.1f images/s\n", "per-window", nImage / elapsed);
+
+	// the pooled image
+	start = wallTime();
+	for(unsigned image = 0; image < nImage; image++){
+		unsigned char pooled[3 * 16 * 16];
+		retinaImage(patch + image * nPatchBytePerImage, raw + image * nPixelPerImage, pooled, 32, 32, 3);
+	}
+	elapsed = wallTime() - start;
+	printf("  %-10s %10.1f images/s\n", "pooled", nImage / elapsed);
+
+	if(memcmp(patch, check, nImage * nPatchBytePerImage) != 0){
+		printf("  the pooled retina vectors differ!\n");
+	}
+
+	delete[] raw;
+	delete[] patch;
+	delete[] check;
+}
+
+/*
+ * The 16-bit storage of the hidden probabilities: the conversion throughput in MB/s of float-point
+ * values and the largest error of a round trip of probabilities in [0, 1].
+ * The AVX-512 level runs the AVX2 code, so it is not listed.
+*/
+void benchHalfConversion(){
+	const unsigned nValue = 1024 * 4096;
+	const unsigned nRepeat = 20;
+	const char* levelName[3] = {"scalar", "AVX2", "AVX-512"};
+	const char* formatName[3] = {"float32", "fp16", "bf16"};
+
+	floatType* probs = new floatType[nValue];
+	floatType* back = new floatType[nValue];
+	unsigned short* half = new unsigned short[nValue];
+
+	for(unsigned i = 0; i < nValue; i++){
+		probs[i] = (floatType)rand() / RAND_MAX;
+	}
+
+	printf("16-bit storage, %u probabilities\n", nValue);
+
+	simdLevel widest = (simdDetect() > SIMD_AVX2) ? SIMD_AVX2 : simdDetect();
+	for(int format = STORAGE_FP16; format <= STORAGE_BF16; format++){
+		for(int level = SIMD_SCALAR; level <= widest; level++){
+			double start = wallTime();
+			for(unsigned r = 0; r < nRepeat; r++){
+				floatToHalf(half, probs, nValue, (storageFormat)format, (simdLevel)level);
+			}
+			double toHalf = wallTime() - start;
+
+			start = wallTime();
+			for(unsigned r = 0; r < nRepeat; r++){
+				halfToFloat(back, half, nValue, (storageFormat)format, (simdLevel)level);
+			}
+			double toFloat = wallTime() - start;
+
+			double maxError = 0;
+			for(unsigned i = 0; i < nValue; i++){
+				double error = (back[i] > probs[i]) ? back[i] - probs[i] : probs[i] - back[i];
+				maxError = (error > maxError) ? error : maxError;
+			}
+			printf("  %-5s %-10s write %8.1f MB/s  read %8.1f MB/s  max error %g\n", formatName[format], levelName[level],
+				nRepeat * (double)nValue * sizeof(floatType) / toHalf / 1e6, nRepeat * (double)nValue * sizeof(floatType) / toFloat / 1e6, maxError);
+		}
+	}
+
+	delete[] probs;
+	delete[] back;
+	delete[] half;
+}
+
+/*
+ * The bit-packed binary states: packing the sampled states and expanding them while loading,
+ * in MB/s of float-point values.
+*/
+void benchBits(){
+	const unsigned nValue = 1024 * 4096;
+	const unsigned nRepeat = 20;
+	const char* levelName[3] = {"scalar", "AVX2", "AVX-512"};
+
+	floatType* states = new floatType[nValue];
+	floatType* back = new floatType[nValue];
+	unsigned char* bits = new unsigned char[nValue / 8];
+
+	for(unsigned i = 0; i < nValue; i++){
+		states[i] = rand() & 1;
+	}
+
+	printf("bit-packed states, %u values\n", nValue);
+
+	simdLevel widest = (simdDetect() > SIMD_AVX2) ? SIMD_AVX2 : simdDetect();
+	for(int level = SIMD_SCALAR; level <= widest; level++){
+		double start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			packBits(bits, states, nValue, (simdLevel)level);
+		}
+		double pack = wallTime() - start;
+
+		start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			unpackBits(back, bits, nValue, (simdLevel)level);
+		}
+		double unpack = wallTime() - start;
+
+		printf("  %-10s pack %8.1f MB/s  unpack %8.1f MB/s\n", levelName[level],
+			nRepeat * (double)nValue * sizeof(floatType) / pack / 1e6, nRepeat * (double)nValue * sizeof(floatType) / unpack / 1e6);
+		if(memcmp(states, back, nValue * sizeof(floatType)) != 0){
+			printf("  the unpacked states differ!\n");
+		}
+	}
+
+	delete[] states;
+	delete[] back;
+	delete[] bits;
+}
+
+/*
+ * The sigmoid of the hidden probabilities in each accuracy mode, in millions of values per second,
+ * and the largest absolute error against the sigmoid in double precision on [-20, 20].
+*/
+void benchSigmoid(){
+	const unsigned nValue = 1024 * 4096;
+	const unsigned nRepeat = 20;
+	const char* levelName[3] = {"scalar", "AVX2", "AVX-512"};
+	const char* modeName[3] = {"exact", "poly", "table"};
+
+	floatType* input = new floatType[nValue];
+	floatType* output = new floatType[nValue];
+
+	for(unsigned i = 0; i < nValue; i++){
+		input[i] = -20.0 + 40.0 * i / nValue;
+	}
+
+	printf("sigmoid, %u values\n", nValue);
+
+	for(int mode = SIGMOID_EXACT; mode <= SIGMOID_TABLE; mode++){
+		// the exact mode is not vectorized
+		int widest = (mode == SIGMOID_EXACT) ? SIMD_SCALAR : simdDetect();
+		for(int level = SIMD_SCALAR; level <= widest; level++){
+			double elapsed = 0;
+			for(unsigned r = 0; r < nRepeat; r++){
+				memcpy(output, input, nValue * sizeof(floatType));
+				double start = wallTime();
+				sigmoid(output, nValue, (sigmoidMode)mode, (simdLevel)level);
+				elapsed += wallTime() - start;
+			}
+
+			double maxError = 0;
+			for(unsigned i = 0; i < nValue; i++){
+				double error = fabs(output[i] - 1 / (1 + exp(-(double)input[i])));
+				maxError = (error > maxError) ? error : maxError;
+			}
+			printf("  %-6s %-10s %8.1f M/s  max error %g\n", modeName[mode], levelName[level], nRepeat * (double)nValue / elapsed / 1e6, maxError);
+		}
+	}
+
+	delete[] input;
+	delete[] output;
+}
+
+/*
+ * The random numbers of generateStates() for a mini-batch of the first RBM layer, in millions of values per second:
+ * rand() as the former randomInit(), then the uniform and the normal numbers of the Threefry streams,
+ * with the mean and the standard deviation of the last draw.
+*/
+void benchRandom(){
+	const unsigned nValue = 1024 * 4096;
+	const unsigned nRepeat = 20;
+	const char* levelName[3] = {"scalar", "AVX2", "AVX-512"};
+
+	floatType* a = new floatType[nValue];
+
+	printf("random numbers, %u values\n", nValue);
+
+	double start = wallTime();
+	for(unsigned r = 0; r < nRepeat; r++){
+		for(unsigned i = 0; i < nValue; i++){
+			a[i] = rand() / (floatType)RAND_MAX;
+		}
+	}
+	printf("  %-8s %-8s %8.1f M/s\n", "rand()", "", nRepeat * (double)nValue / (wallTime() - start) / 1e6);
+
+	for(int normal = 0; normal <= 1; normal++){
+		for(int level = SIMD_SCALAR; level <= simdDetect(); level++){
+			rngStream stream = rngMake(1234);
+			start = wallTime();
+			for(unsigned r = 0; r < nRepeat; r++){
+				if(normal){
+					rngNormal(stream, a, nValue, 0.0, 1.0, (simdLevel)level);
+				}
+				else{
+					rngUniform(stream, a, nValue, 0.0, 1.0, (simdLevel)level);
+				}
+			}
+			double elapsed = wallTime() - start;
+
+			double mean = 0, variance = 0;
+			for(unsigned i = 0; i < nValue; i++){
+				mean += a[i];
+			}
+			mean /= nValue;
+			for(unsigned i = 0; i < nValue; i++){
+				variance += (a[i] - mean) * (a[i] - mean);
+			}
+			printf("  %-8s %-8s %8.1f M/s  mean %.4f  sd %.4f\n", normal ? "normal" : "uniform", levelName[level], nRepeat * (double)nValue / elapsed / 1e6, mean, sqrt(variance / nValue));
+		}
+	}
+
+	delete[] a;
+}
+
+/*
+ * generateStates() of a binary and a Gaussian layer, in millions of states per second: the random numbers
+ * written to posHidStates then compared or added in a second pass, against the fused rngBernoulli() and rngGaussian().
+ * The bits are the states of transform() with STORAGE_BITS, after packBits() or sampled straight into the bitmask.
+*/
+void benchSampling(){
+	const unsigned nValue = 1024 * 4096;
+	const unsigned nRepeat = 20;
+	const char* levelName[3] = {"scalar", "AVX2", "AVX-512"};
+
+	floatType* probs = new floatType[nValue];
+	floatType* states = new floatType[nValue];
+	unsigned char* bits = new unsigned char[nValue / 8];
+
+	for(unsigned i = 0; i < nValue; i++){
+		probs[i] = (floatType)rand() / RAND_MAX;
+	}
+
+	printf("sampling, %u states\n", nValue);
+
+	for(int level = SIMD_SCALAR; level <= simdDetect(); level++){
+		double elapsed[6] = {0, 0, 0, 0, 0, 0};
+		rngStream stream = rngMake(1234);
+		for(unsigned r = 0; r < nRepeat; r++){
+			double start = wallTime();
+			rngUniform(stream, states, nValue, 0.0, 1.0, (simdLevel)level);
+			for(unsigned i = 0; i < nValue; i++){
+				states[i] = (probs[i] > states[i]) ? 1.0 : 0.0;
+			}
+			elapsed[0] += wallTime() - start;
+
+			start = wallTime();
+			rngBernoulli(stream, probs, states, NULL, nValue, (simdLevel)level);
+			elapsed[1] += wallTime() - start;
+
+			start = wallTime();
+			rngBernoulli(stream, probs, states, NULL, nValue, (simdLevel)level);
+			packBits(bits, states, nValue, (simdLevel)level);
+			elapsed[2] += wallTime() - start;
+
+			start = wallTime();
+			rngBernoulli(stream, probs, NULL, bits, nValue, (simdLevel)level);
+			elapsed[3] += wallTime() - start;
+
+			start = wallTime();
+			rngNormal(stream, states, nValue, 0.0, 1.0, (simdLevel)level);
+			for(unsigned i = 0; i < nValue; i++){
+				states[i] += probs[i];
+			}
+			elapsed[4] += wallTime() - start;
+
+			start = wallTime();
+			rngGaussian(stream, probs, states, nValue, (simdLevel)level);
+			elapsed[5] += wallTime() - start;
+		}
+		double rate = nRepeat * (double)nValue / 1e6;
+		printf("  %-8s binary   two passes %7.1f M/s  fused %7.1f M/s\n", levelName[level], rate / elapsed[0], rate / elapsed[1]);
+		printf("  %-8s bits     packBits   %7.1f M/s  fused %7.1f M/s\n", levelName[level], rate / elapsed[2], rate / elapsed[3]);
+		printf("  %-8s gaussian two passes %7.1f M/s  fused %7.1f M/s\n", levelName[level], rate / elapsed[4], rate / elapsed[5]);
+	}
+
+	delete[] probs;
+	delete[] states;
+	delete[] bits;
+}
+
+/*
+ * The matrix products of the CPU implementation with each GEMM backend compiled in, in GFLOP/s:
+ * posProp, the weight gradient and negProp of the first two RBM layers, then the whole fprop
+ * and bprop of the autoencoder, with mini-batches of 128 vectors.
+*/
+struct gemmShape
+{
+	const char* name;
+	char transa, transb;
+	int m, n, k;
+};
+
+void benchGemm(){
+	const unsigned nRepeat = 20;
+	const int nVectorPerBatch = 128;
+	const int layerSize[9] = {336, 1024, 512, 256, 128, 256, 512, 1024, 336};
+	const gemmShape shapes[6] = {
+		{"RBM 336x1024 posProp", 'n', 'n', 1024, nVectorPerBatch, 336},
+		{"RBM 336x1024 posProds", 'n', 't', 1024, 336, nVectorPerBatch},
+		{"RBM 336x1024 negProp", 't', 'n', 336, nVectorPerBatch, 1024},
+		{"RBM 1024x512 posProp", 'n', 'n', 512, nVectorPerBatch, 1024},
+		{"RBM 1024x512 posProds", 'n', 't', 512, 1024, nVectorPerBatch},
+		{"RBM 1024x512 negProp", 't', 'n', 1024, nVectorPerBatch, 512}
+	};
+
+	floatType* a = new floatType[1024 * 1024];
+	floatType* b = new floatType[1024 * 1024];
+	floatType* c = new floatType[1024 * 1024];
+
+	for(unsigned i = 0; i < 1024 * 1024; i++){
+		a[i] = 0.01 * rand() / RAND_MAX;
+		b[i] = rand() & 1;
+		c[i] = 0;
+	}
+
+	printf("GEMM backends, %d vectors per batch\n", nVectorPerBatch);
+
+	for(int backend = GEMM_BACKEND_REFERENCE; backend < GEMM_BACKEND_NUM; backend++){
+		if(!gemmAvailable((gemmBackend)backend)){
+			continue;
+		}
+
+		for(int s = 0; s < 6; s++){
+			const gemmShape& shape = shapes[s];
+			int lda = (shape.transa == 'n') ? shape.m : shape.k;
+			int ldb = (shape.transb == 'n') ? shape.k : shape.n;
+
+			gemm(shape.transa, shape.transb, shape.m, shape.n, shape.k, 1.0, a, lda, b, ldb, 0.0, c, shape.m, (gemmBackend)backend);
+			double start = wallTime();
+			for(unsigned r = 0; r < nRepeat; r++){
+				gemm(shape.transa, shape.transb, shape.m, shape.n, shape.k, 1.0, a, lda, b, ldb, 0.0, c, shape.m, (gemmBackend)backend);
+			}
+			double elapsed = wallTime() - start;
+			printf("  %-10s %-24s %8.2f GFLOP/s\n", gemmName((gemmBackend)backend), shape.name, nRepeat * 2.0 * shape.m * shape.n * shape.k / elapsed / 1e9);
+		}
+
+		// the 8 layers of autoencoder::fprop() and the 16 products of autoencoder::bprop()
+		double flops = 0;
+		double start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			for(int l = 0; l < 8; l++){
+				gemm('n', 'n', layerSize[l + 1], nVectorPerBatch, layerSize[l], 1.0, a, layerSize[l + 1], b, layerSize[l], 1.0, c, layerSize[l + 1], (gemmBackend)backend);
+				flops += 2.0 * layerSize[l + 1] * nVectorPerBatch * layerSize[l];
+			}
+		}
+		double elapsed = wallTime() - start;
+		printf("  %-10s %-24s %8.2f GFLOP/s\n", gemmName((gemmBackend)backend), "autoencoder fprop", flops / elapsed / 1e9);
+
+		flops = 0;
+		start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			for(int l = 7; l >= 0; l--){
+				gemm('t', 'n', layerSize[l], nVectorPerBatch, layerSize[l + 1], 1.0, a, layerSize[l + 1], b, layerSize[l + 1], 0.0, c, layerSize[l], (gemmBackend)backend);
+				gemm('n', 't', layerSize[l + 1], layerSize[l], nVectorPerBatch, 1.0, b, layerSize[l + 1], a, layerSize[l], 0.0, c, layerSize[l + 1], (gemmBackend)backend);
+				flops += 4.0 * layerSize[l + 1] * nVectorPerBatch * layerSize[l];
+			}
+		}
+		elapsed = wallTime() - start;
+		printf("  %-10s %-24s %8.2f GFLOP/s\n", gemmName((gemmBackend)backend), "autoencoder bprop", flops / elapsed / 1e9);
+	}
+
+	delete[] a;
+	delete[] b;
+	delete[] c;
+}
+
+/*
+ * A layer of the RBM phases with the default GEMM backend, in microseconds per mini-batch:
+ * addBias(), gemm(), sigmoid(), sumBatch() and EuDist() one after another, then gemmLayer().
+ * The negative phase of the visible layer also sums the reconstruction error.
+*/
+void benchLayer(){
+	const unsigned nRepeat = 50;
+	const int nVectorPerBatch = 128;
+	const gemmShape shapes[4] = {
+		{"RBM 336x1024 posProp", 'n', 'n', 1024, nVectorPerBatch, 336},
+		{"RBM 336x1024 negProp", 't', 'n', 336, nVectorPerBatch, 1024},
+		{"RBM 1024x512 posProp", 'n', 'n', 512, nVectorPerBatch, 1024},
+		{"RBM 1024x512 negProp", 't', 'n', 1024, nVectorPerBatch, 512}
+	};
+
+	floatType* w = new floatType[1024 * 1024];
+	floatType* in = new floatType[1024 * nVectorPerBatch];
+	floatType* target = new floatType[1024 * nVectorPerBatch];
+	floatType* out = new floatType[1024 * nVectorPerBatch];
+	floatType* bias = new floatType[1024];
+	floatType* sum = new floatType[1024];
+
+	for(unsigned i = 0; i < 1024 * 1024; i++){
+		w[i] = 0.01 * rand() / RAND_MAX;
+	}
+	for(unsigned i = 0; i < 1024 * nVectorPerBatch; i++){
+		in[i] = rand() & 1;
+		target[i] = (floatType)rand() / RAND_MAX;
+	}
+	for(unsigned i = 0; i < 1024; i++){
+		bias[i] = 0.1 * rand() / RAND_MAX - 0.05;
+	}
+
+	printf("fused layer, %s GEMM, %d vectors per batch\n", gemmName(gemmSelected()), nVectorPerBatch);
+
+	for(int s = 0; s < 4; s++){
+		const gemmShape& shape = shapes[s];
+		int ldw = (shape.transa == 'n') ? shape.m : shape.k;
+		bool negative = (shape.transa == 't');
+
+		double start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			addBias(out, bias, shape.m, shape.n);
+			gemm(shape.transa, 'n', shape.m, shape.n, shape.k, 1.0, w, ldw, in, shape.k, 1.0, out, shape.m);
+			sigmoid(out, shape.m * shape.n, SIGMOID_POLY);
+			sumBatch(out, sum, shape.m, shape.n);
+			if(negative){
+				EuDist(out, target, shape.m * shape.n);
+			}
+		}
+		double separate = wallTime() - start;
+
+		start = wallTime();
+		for(unsigned r = 0; r < nRepeat; r++){
+			gemmLayer(shape.transa, shape.m, shape.n, shape.k, w, ldw, in, bias, true, SIGMOID_POLY, out, sum, negative ? target : NULL);
+		}
+		double fused = wallTime() - start;
+
+		printf("  %-24s separate %8.1f us  fused %8.1f us\n", shape.name, separate / nRepeat * 1e6, fused / nRepeat * 1e6);
+	}
+
+	delete[] w;
+	delete[] in;
+	delete[] target;
+	delete[] out;
+	delete[] bias;
+	delete[] sum;
+}
+
+int main(void){
+	benchNormalizeBytes();
+	benchLoadByteFile();
+	benchRetina();
+	benchHalfConversion();
+	benchBits();
+	benchSigmoid();
+	benchRandom();
+	benchSampling();
+	benchGemm();
+	benchLayer();
+	return 0;
+}
@@ -3,7 +3,24 @@
 #include<cstring>
 #include<utility>
 #include<algorithm>
+#include<sched.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<omp.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
 #include "cifar10.h"
+#include "simd.h"
+#include "retina.h"
+#include "mnist.h"
+#include "rng.h"
+
+// the memory of the buckets of the data shuffler
+#define SHUFFLE_BUCKET_BYTES	(256 << 20)
+
+// the states of a host buffer in the prefetching ring
+#define BUFFER_EMPTY	0
+#define BUFFER_FULL		1
 
 /*
  * Generate a file name: prefix + number
@@ -39,95 +56,6 @@ void generateFileName(string* prefix, unsigned index, unsigned nDigitNum){
 	prefix->push_back(postfix);
 }
 
-/*
- * The function generates a 112-dim retina image vector from a 16x16 pixels region
- * Notice: this function is for ONE CHANNEL ONLY!
-*/
-
-void retinaPermutation(unsigned char* odata, unsigned char* idata, unsigned int imageWidth, unsigned int imageHeight){
-	unsigned char* p, *q;
-	unsigned int iavg;
-
-	// the 1st and 2nd line of the input data array
-	q = idata;
-	for(int itr = 0; itr < 16; itr += 2){
-		p = q + itr;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-	}
-
-	// the 3rd and 4th line of the input data array
-	q = idata + 2 * imageWidth;
-	for(int itr = 0; itr < 16; itr += 2){
-		p = q + itr;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-	}
-
-	// Line 5 to Line 12 of the input data array
-	q = idata + 4 * imageWidth;
-	for(int itr = 0; itr < 4; itr++){
-		p = q;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-
-		p = q + 2;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-
-		p = q + 4;
-		memcpy(odata, p, 8);
-		odata += 8;
-
-		p += imageWidth;
-		memcpy(odata, p, 8);
-		odata += 8;
-
-		p = q + 12;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-
-		p = q + 14;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-
-		q += 2 * imageWidth;
-	}
-
-	// the 13th and 14th line of the input data array
-	q = idata + 12 * imageWidth;
-	for(int itr = 0; itr < 16; itr += 2){
-		p = q + itr;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-	}
-
-	// the 15th and 16th line of the input data array
-	q = idata + 14 * imageWidth;
-	for(int itr = 0; itr < 16; itr += 2){
-		p = q + itr;
-		iavg = *p + *(p + 1);
-		p += imageWidth;
-		iavg += *p + *(p + 1);
-		*(odata++) = (unsigned char)(iavg >> 2);
-	}
-	return;
-}
-
 cifarPreProcessor::cifarPreProcessor(string rawfile, string patchfile){
 	rawDataFileName = rawfile;
 	patchDataFileName = patchfile;
@@ -171,26 +99,7 @@ void cifarPreProcessor::makePatchData(){
 
 	// make patches in memory
 	for(int image = 0; image < nImageNum; image++){
-		unsigned int patchId = 0;
-		for(int row = 0; row <= nPixelPerColumn / 2; row += 2){
-			for(int col = 0; col <= nPixelPerRow / 2; col += 2){
-				// Red Channel
-				unsigned int patchOffset = (81 * 3 * image + patchId) * nPatchLength;
-				unsigned int rawOffset = row * nPixelPerRow + col;
-				retinaPermutation(patchData + patchOffset, rawData + rawOffset, nPixelPerRow, nPixelPerColumn);
-				patchId++;
-				// Green Channel
-				patchOffset = (81 * 3 * image + patchId) * nPatchLength;
-				rawOffset = nPixelPerRow * nPixelPerColumn + row * nPixelPerRow + col;
-				retinaPermutation(patchData + patchOffset, rawData + rawOffset, nPixelPerRow, nPixelPerColumn);
-				patchId++;
-				// Blue Channel
-				patchOffset = (81 * 3 * image + patchId) * nPatchLength;
-				rawOffset = 2 * nPixelPerRow * nPixelPerColumn + row * nPixelPerRow + col;
-				retinaPermutation(patchData + patchOffset, rawData + rawOffset, nPixelPerRow, nPixelPerColumn);
-				patchId++;
-			}
-		}
+		makeImagePatches(patchData + 81 * 3 * image * nPatchLength, rawData + image * nPixelPerImage);
 	}
 	
 	// write patch images to file
@@ -204,16 +113,55 @@ void cifarPreProcessor::makePatchData(){
 	return;
 }
 
+/*
+ * Make the retina-formatted vectors of one image, the windows move in the stride
+ * of 2 pixels and each window gives three vectors, one per channel.
+*/
+void cifarPreProcessor::makeImagePatches(unsigned char* patch, unsigned char* raw){
+	// the scratch buffer of the pooled channels
+	unsigned char pooled[3 * (32 / 2) * (32 / 2)];
+	retinaImage(patch, raw, pooled, nPixelPerRow, nPixelPerColumn, 3);
+	return;
+}
+
+/*
+ * The reading or the writing of one file, which runs in its own thread
+*/
+struct patchFileJob{
+	ifstream* fin;
+	string fileName;
+	unsigned char* buffer;
+	size_t size;
+};
+
+static void* readRawImages(void* arg){
+	patchFileJob* job = (patchFileJob*)arg;
+	job->fin->read((char*)job->buffer, job->size);
+	return NULL;
+}
+
+static void* writePatchFile(void* arg){
+	patchFileJob* job = (patchFileJob*)arg;
+	ofstream fout;
+	fout.open(job->fileName.c_str(), ios_base::binary | ios_base::trunc);
+	fout.write((char*)job->buffer, job->size);
+	fout.close();
+	return NULL;
+}
+
 /* 
  *This function return the retina-formatted vectors of training source
  * images. The file of raw images keeps these image in its row vectors.
  * The width of row vectors is equal to the bytes of these files, and
  * the number of vectors is the number of images.
+ *
+ * The work is pipelined over the patch files: the images of file k+1 are read
+ * and the patches of file k-1 are written by two threads while the patches of
+ * file k are made by numThreads OpenMP threads. Each image is independent, so
+ * the files do not depend on the number of threads.
 */
-
-void cifarPreProcessor::makePatchDataFiles(){
+void cifarPreProcessor::makePatchDataFiles(unsigned numThreads){
 	ifstream fin;
-	ofstream fout;
 
 	// open the src file which contains the training image set
 	fin.open(rawDataFileName.c_str(), ios_base::binary);
@@ -224,71 +172,79 @@ void cifarPreProcessor::makePatchDataFiles(){
 	// return the number of images whose retina-formatted derives kept within the same file
 	unsigned int nImagePerFile = nImageNum / nPatchFileNum;
 
-	rawData = new unsigned char[nPixelPerImage * nImagePerFile]; 		// product(#images, #pixels)
-	patchData = new unsigned char[nImagePerFile * 3 * 81 * nPatchLength];	// product(#images, #channels, #vectors, #vector-size)
+	// the number of bytes of the patches of one image
+	unsigned int nPatchBytePerImage = 3 * 81 * nPatchLength;
+
+	// two buffers each, one is processed while the other is read or written
+	unsigned char* rawRing[2];
+	unsigned char* patchRing[2];
+	for(int i = 0; i < 2; i++){
+		rawRing[i] = new unsigned char[nPixelPerImage * nImagePerFile]; 		// product(#images, #pixels)
+		patchRing[i] = new unsigned char[nImagePerFile * nPatchBytePerImage];	// product(#images, #channels, #vectors, #vector-size)
+	}
 	labels = NULL;
 
-	for(int fileId = 0; fileId < nPatchFileNum; fileId++){
-		// return the file name of the raw image file
-		string patchName = patchDataFileName;
-		generateFileName(&patchName, fileId, 3);
+	int nThread = (numThreads == 0) ? omp_get_max_threads() : numThreads;
 
-		// open this file by the given mode
-		fout.open(patchName.c_str(), ios_base::binary | ios_base::trunc);
+	pthread_t reader, writer;
+	patchFileJob readJob, writeJob;
+	bool writing = false;
 
-		// read data from raw data file
-		fin.read((char*)rawData, nPixelPerImage * nImagePerFile);
+	// read the first file before the pipeline starts
+	readJob.fin = &fin;
+	readJob.buffer = rawRing[0];
+	readJob.size = nPixelPerImage * nImagePerFile;
+	pthread_create(&reader, NULL, readRawImages, (void*)&readJob);
+
+	for(int fileId = 0; fileId < nPatchFileNum; fileId++){
+		rawData = rawRing[fileId % 2];
+		patchData = patchRing[fileId % 2];
+
+		// wait for the images of this file and start reading the next file
+		pthread_join(reader, NULL);
+		if(fileId + 1 < nPatchFileNum){
+			readJob.buffer = rawRing[(fileId + 1) % 2];
+			pthread_create(&reader, NULL, readRawImages, (void*)&readJob);
+		}
 
 		// construct the retina-formatted vecoter
-		for(int image = 0; image < nImagePerFile; image++){
-			// set the patch counter equal to zero
-			unsigned int patchId = 0;
-
-			// set the patch window's center in a row, and move the center in the next iteration into the next two rows
-			for(int row = 0; row <= nPixelPerColumn / 2; row += 2){
-				// move the patch window from left to right in the stride of 2 pixels
-				for(int col = 0; col <= nPixelPerRow / 2; col += 2){
-					// Red Channel
-					// return the head of this patch window in the raw data buffer
-					unsigned int patchOffset = (81 * 3 * image + patchId) * nPatchLength;
-					// return the head of this data block in the destination buffer
-					unsigned int rawOffset = row * nPixelPerRow + col;
-					// return the retina-formartted vector of this patch image
-					retinaPermutation(patchData + patchOffset, rawData + rawOffset, nPixelPerRow, nPixelPerColumn);
-					// update the patch counter
-					patchId++;
-
-					// Green Channel
-					patchOffset = (81 * 3 * image + patchId) * nPatchLength;
-					rawOffset = nPixelPerRow * nPixelPerColumn + row * nPixelPerRow + col;
-					retinaPermutation(patchData + patchOffset, rawData + rawOffset, nPixelPerRow, nPixelPerColumn);
-					patchId++;
-
-					// Blue Channel
-					patchOffset = (81 * 3 * image + patchId) * nPatchLength;
-					rawOffset = 2 * nPixelPerRow * nPixelPerColumn + row * nPixelPerRow + col;
-					retinaPermutation(patchData + patchOffset, rawData + rawOffset, nPixelPerRow, nPixelPerColumn);
-					patchId++;
-				}
-			}
+		#pragma omp parallel for num_threads(nThread) schedule(static)
+		for(int image = 0; image < (int)nImagePerFile; image++){
+			makeImagePatches(patchData + image * nPatchBytePerImage, rawData + image * nPixelPerImage);
+		}
+
+		// wait for the previous file to be written, whose buffer is the next patch buffer
+		if(writing){
+			pthread_join(writer, NULL);
 		}
 
 		// dump the contructed retina-formatted vectors into the specified file
-		fout.write((char*)patchData, 3 * nPatchLength * 81 * nImagePerFile);
-		// close the dst file
-		fout.close();
+		writeJob.fileName = patchDataFileName;
+		generateFileName(&writeJob.fileName, fileId, 3);
+		writeJob.buffer = patchData;
+		writeJob.size = nImagePerFile * nPatchBytePerImage;
+		pthread_create(&writer, NULL, writePatchFile, (void*)&writeJob);
+		writing = true;
+	}
+	if(writing){
+		pthread_join(writer, NULL);
 	}
+
 	// close the src file
 	fin.close();
-	delete[] rawData;
-	delete[] patchData;
+	for(int i = 0; i < 2; i++){
+		delete[] rawRing[i];
+		delete[] patchRing[i];
+	}
+	rawData = NULL;
+	patchData = NULL;
 	return;
 }
 
 /*
  * The constructor of the datashuffler class
 */
-datashuffler::datashuffler(const string& fileNamePrefix, unsigned numVec, unsigned numFile, unsigned vecLen){
+datashuffler::datashuffler(const string& fileNamePrefix, unsigned numVec, unsigned numFile, unsigned vecLen, unsigned long long key){
 
 	// the prefix of the input file, e.g. "../data/patch"
 	inputPrefix 	= fileNamePrefix;
@@ -298,70 +254,64 @@ datashuffler::datashuffler(const string& fileNamePrefix, unsigned numVec, unsign
 	totalVectorCount	= numVec;
 	fileCount			= numFile;
 	vectorLength		= vecLen;
+	medRecordLength		= vecLen + sizeof(unsigned);
 	
 	vectorCountPerFile	= totalVectorCount / fileCount;
 	
-	newGlobalIndex	= new unsigned[totalVectorCount];
-	vecIndexInFile	= new unsigned[totalVectorCount];
-	fileIndex		= new unsigned[totalVectorCount];
+	shuffleKey		= key;
+	// the vectors after the last full file are not shuffled, as before
+	newGlobalIndex	= new permutation(vectorCountPerFile * fileCount, key);
 	
-	inputBuffer		= new byte[vectorCountPerFile * vectorLength];
+	// the input buffer also holds a medium file
+	inputBuffer		= new byte[vectorCountPerFile * medRecordLength];
 	outputBuffer	= new byte[vectorCountPerFile * vectorLength];
+
+	// the buckets share SHUFFLE_BUCKET_BYTES, a bucket needs not be larger than a file
+	bucketVectorCount	= SHUFFLE_BUCKET_BYTES / (fileCount * medRecordLength);
+	bucketVectorCount	= (bucketVectorCount == 0) ? 1 : bucketVectorCount;
+	bucketVectorCount	= (bucketVectorCount > vectorCountPerFile) ? vectorCountPerFile : bucketVectorCount;
+
+	bucketFill		= new unsigned[fileCount];
+	bucketBuffer	= new byte[(size_t)fileCount * bucketVectorCount * medRecordLength];
 }
 
 /*
  * release the allocated resources 
 */
 datashuffler::~datashuffler(){
-	delete[] 	newGlobalIndex;
-	delete[] 	vecIndexInFile;
-	delete[]	fileIndex;
+	delete		newGlobalIndex;
 	delete[]	inputBuffer;
 	delete[]	outputBuffer;
+	delete[]	bucketFill;
+	delete[]	bucketBuffer;
 }
 
 /*
- * permute the vector id array in a random order using the knuth algorithm 
+ * key the permutation of the vector ids, the permutation is computed on demand
 */
 void datashuffler::genNewPerm(void){
-	// default ascending order
-	for(unsigned i = 0; i < totalVectorCount; i++){
-		newGlobalIndex[i] = i;
-	} 
-
-	time_t t;
-	srand((unsigned)time(&t));
-
-	// the main loop of Knuth shuffling algorithm
-	for(unsigned i = 1; i < totalVectorCount; i++){
-		//  return a pseudo-random integral number
-		unsigned j = rand() % i;
-		
-		// swap the contents of the elements p[i] and p[j]
-		newGlobalIndex[i] = newGlobalIndex[j];
-		newGlobalIndex[j] = i;
-	}
+	unsigned long long key = shuffleKey;
 
-	// compute the vecIndexInFile and fileIndex according to newGlobalIndex
-	for(unsigned i = 0; i < totalVectorCount; i++){
-		//vecIndexInFile[i] 	= newGlobalIndex[i] % vectorCountPerFile;	
-		fileIndex[i]		= newGlobalIndex[i] / vectorCountPerFile;
+	// a new permutation for each run without a given key or seed
+	if(key == 0){
+		key = rngKey("datashuffler");
 	}
-	
+	newGlobalIndex->setKey(key);
+
 	return;
 }
 
 /*
  * load all the data in a src file into the memory to which inputBuffer points 
 */
-void datashuffler::loadInputFile(const string& fname){
+void datashuffler::loadInputFile(const string& fname, unsigned recordLength){
 	// load the file fname into the memory inputBuffer
 	ifstream fin;
 	// open the file in binary mode
 	fin.open(fname.c_str(), ios_base::binary);
 
 	// load the data from file to memory
-	fin.read((char*)inputBuffer, vectorCountPerFile * vectorLength * sizeof(byte));
+	fin.read((char*)inputBuffer, vectorCountPerFile * recordLength * sizeof(byte));
 
 	// close the file
 	fin.close();
@@ -380,52 +330,71 @@ void datashuffler::loadInputFile(const string& fname){
 */
 void datashuffler::generateMedFile(void){
 
+	// create empty medium files, the buckets are appended to them
 	for(unsigned medId = 0; medId < fileCount; medId++){
-		// open a medium file
 		string medfile = generateFileName(medPrefix, medId, 3);
-			
-		// the pointer to the medium file buffer
-		byte* medPtr = outputBuffer;
-
-		// the number of vectors saved in the medium file
-		unsigned vectorCountInMed = 0;
-
-		for(unsigned srcId = 0; srcId < fileCount; srcId++){
-			// open an input file
-			string srcfile = generateFileName(inputPrefix, srcId, 3);
-			
-			// load an input file to memory inputBuffer
-			loadInputFile(srcfile);	
-
-			// the offset is the index of the first vector of the srcfile
-			unsigned offset = vectorCountPerFile * srcId;
-
-			byte* srcPtr = inputBuffer;
-			
-			for(unsigned vecId = 0; vecId < vectorCountPerFile; vecId++){
-				// save the lines that belong to the medium file in the outputBuffer
-				if(fileIndex[vecId + offset] == medId){
-					// copy a vector from srcfile buffer to medfile buffer
-					memcpy((char*)medPtr, (char*)srcPtr, vectorLength * sizeof(byte));
-
-					medPtr = medPtr + vectorLength;
-
-					// record the intra index of the vector in the medium file
-					vecIndexInFile[medId * vectorCountPerFile + vectorCountInMed] = newGlobalIndex[vecId + offset] % vectorCountPerFile;
-					vectorCountInMed++;
-					
-				}
-				srcPtr = srcPtr + vectorLength;
-			}	
-		}
-
-		// write the medium file to disk
 		ofstream fout;
-		fout.open(medfile.c_str(), ios_base::trunc);
-		fout.write((char*)outputBuffer, vectorCountPerFile * vectorLength * sizeof(byte));
+		fout.open(medfile.c_str(), ios_base::binary | ios_base::trunc);
 		fout.close();
+
+		bucketFill[medId] = 0;
+	}
+
+	for(unsigned srcId = 0; srcId < fileCount; srcId++){
+		// open an input file
+		string srcfile = generateFileName(inputPrefix, srcId, 3);
+		
+		// load an input file to memory inputBuffer
+		loadInputFile(srcfile, vectorLength);	
+
+		// the offset is the index of the first vector of the srcfile
+		unsigned offset = vectorCountPerFile * srcId;
+
+		byte* srcPtr = inputBuffer;
+		
+		for(unsigned vecId = 0; vecId < vectorCountPerFile; vecId++){
+			// the new position of the vector, which is in the medium file medId
+			unsigned newIndex = newGlobalIndex->forward(vecId + offset);
+			unsigned medId = newIndex / vectorCountPerFile;
+
+			// copy a vector from srcfile buffer to the bucket of the medium file
+			byte* bucketPtr = bucketBuffer + ((size_t)medId * bucketVectorCount + bucketFill[medId]) * medRecordLength;
+			memcpy((char*)bucketPtr, (char*)srcPtr, vectorLength * sizeof(byte));
+
+			// record the intra index of the vector in the output file after the vector
+			unsigned vecIndexInFile = newIndex % vectorCountPerFile;
+			memcpy((char*)(bucketPtr + vectorLength), (char*)&vecIndexInFile, sizeof(unsigned));
+			bucketFill[medId]++;
+
+			// write the full bucket to disk
+			if(bucketFill[medId] == bucketVectorCount){
+				flushBucket(medId);
+			}
+			srcPtr = srcPtr + vectorLength;
+		}	
+	}
+
+	// write the remaining vectors
+	for(unsigned medId = 0; medId < fileCount; medId++){
+		flushBucket(medId);
+	}
+
+	return;
+}
+
+void datashuffler::flushBucket(unsigned medId){
+	if(bucketFill[medId] == 0){
+		return;
 	}
 
+	// append the bucket to the medium file with one write
+	string medfile = generateFileName(medPrefix, medId, 3);
+	ofstream fout;
+	fout.open(medfile.c_str(), ios_base::binary | ios_base::app);
+	fout.write((char*)(bucketBuffer + (size_t)medId * bucketVectorCount * medRecordLength), bucketFill[medId] * medRecordLength * sizeof(byte));
+	fout.close();
+
+	bucketFill[medId] = 0;
 	return;
 }
 
@@ -433,7 +402,7 @@ void datashuffler::generateMedFile(void){
 /*
  * This function carries out the intra-file permutation,
  * according to the order given by the global vector id
- * array newGlobalIndex[].
+ * permutation newGlobalIndex.
 */
 void datashuffler::procMedFile(void){
 
@@ -441,20 +410,21 @@ void datashuffler::procMedFile(void){
 		// open a medium file
 		string medfile = generateFileName(medPrefix, medId, 3);
 		// load the medium file to memory inputBuffer
-		loadInputFile(medfile);
-		// the offset is the index of the first vector of the medfile
-		unsigned offset = vectorCountPerFile * medId;
+		loadInputFile(medfile, medRecordLength);
 
 		byte* medPtr = inputBuffer;
 
 		// the main loop of medium file processing
 		for(unsigned vecId = 0; vecId < vectorCountPerFile; vecId++){
+			// the index of the vector in the output file follows the vector
+			unsigned vecIndexInFile;
+			memcpy((char*)&vecIndexInFile, (char*)(medPtr + vectorLength), sizeof(unsigned));
 			// the pointer to the destination of the vector
-			byte* outputPtr = outputBuffer + vecIndexInFile[vecId + offset] * vectorLength;
+			byte* outputPtr = outputBuffer + vecIndexInFile * vectorLength;
 			// copy the vector to the address in the output buffer
 			memcpy((char*)outputPtr, (char*)medPtr, vectorLength * sizeof(byte));
 
-			medPtr = medPtr + vectorLength;
+			medPtr = medPtr + medRecordLength;
 		}
 
 		// write the output file to disk
@@ -489,7 +459,29 @@ void datashuffler::run(void){
 }
 
 
+// the raw CIFAR images of useRawImages(): 32 x 32 pixels of 3 channels, 81 windows each
+#define RAW_IMAGE_WIDTH		32
+#define RAW_IMAGE_BYTES		(3 * RAW_IMAGE_WIDTH * RAW_IMAGE_WIDTH)
+#define RAW_WINDOW_NUM		81
+// the number of raw images in a shard of getExpectation()
+#define RAW_SHARD_IMAGE_NUM	5000
+
 dataProvider::dataProvider(string prefix, unsigned pixelperdata, unsigned batchSize, bool floatpoint){
+	init(prefix, pixelperdata, batchSize, floatpoint, 68000 * 30 * 81, NULL);
+}
+
+/*
+ * The images of an MNIST data set in memory, the MNIST object must live as long as the provider.
+ * The whole data set is one buffer, so the shuffling in buffer covers all images.
+*/
+dataProvider::dataProvider(MNIST* mnist, unsigned batchSize){
+	if(mnist->getImages() == NULL){
+		mnist->loadData();
+	}
+	init("", mnist->getPixelNum(), batchSize, true, mnist->getImageNum(), mnist->getImages());
+}
+
+void dataProvider::init(string prefix, unsigned pixelperdata, unsigned batchSize, bool floatpoint, unsigned dataNum, floatType* data){
 	dataFileNamePrefix = prefix;
 	nPixelPerData = pixelperdata;
 	nDataPerBatch = batchSize;
@@ -497,8 +489,10 @@ dataProvider::dataProvider(string prefix, unsigned pixelperdata, unsigned batchS
 	// true for GB-RBM and autoencoder and false for BB-RBM
 	floatPoint = floatpoint;
 
-	nDataPerFile = 68000 * 30 * 81;
-	nBatchNum = 68000 * 30 * 81 / 128;
+	nDataNum = dataNum;
+	// the float-point data has only one file while the patch data is split into 400 files
+	nDataPerFile = floatPoint ? nDataNum : nDataNum / 400;
+	nBatchNum = nDataNum / nDataPerBatch;
 
 	// select buffer size according to data size
 	nBatchInBuffer = 2500;
@@ -507,9 +501,15 @@ dataProvider::dataProvider(string prefix, unsigned pixelperdata, unsigned batchS
 	if(nPixelPerData > 512)
 		nBatchInBuffer = 800; 
 
-	batchDataBuffer = new floatType[nPixelPerData * nDataPerBatch * nBatchInBuffer];
+	// the data in memory is handed out in one piece
+	if(data != NULL){
+		nBatchInBuffer = nBatchNum;
+	}
+
+	batchDataBuffer = (data == NULL) ? new floatType[nPixelPerData * nDataPerBatch * nBatchInBuffer] : NULL;
 
 	// the counters for locating the next batch in the patch files
+	nLoadedVecNum = 0;
 	currentDataId = 0;
 	currentBatchId = 0;
 	currentFileId = 0;
@@ -518,86 +518,362 @@ dataProvider::dataProvider(string prefix, unsigned pixelperdata, unsigned batchS
 	mean = new floatType[nPixelPerData];
 	// the standard variance of the data
 	variance = new floatType[nPixelPerData];
+	// the normalization factors derived from the means and the standard variances
+	scale = new floatType[nPixelPerData];
+	offset = new floatType[nPixelPerData];
+	// the factors applied while loading, see setNormalization()
+	normScale = scale;
+	normOffset = offset;
+
+	// the byte files are read in spans of about 4 MB, which stay in cache for the conversion
+	nStagingVecNum = 0;
+	byteStagingBuffer = NULL;
+	if(!floatPoint){
+		nStagingVecNum = (4 << 20) / nPixelPerData;
+		byteStagingBuffer = new unsigned char[nStagingVecNum * nPixelPerData];
+	}
 
-	// the shuffled indices for shuffling in buffer
-	shuffledId = new unsigned[nBatchInBuffer * nDataPerBatch];
-	// default ascending order
-	for(unsigned i = 0; i < nBatchInBuffer * nDataPerBatch; i++){
-		shuffledId[i] = i;
-	} 
+	// the float-point file holds 32-bit values until setStorageFormat() is called
+	storage = STORAGE_FLOAT32;
+	packedStagingBuffer = NULL;
+	nPackedStagingVecNum = 0;
+
+	// the byte data is normalized when it is loaded until useCompactBuffer() is called
+	compact = false;
+	byteDataBuffer = NULL;
+	compactBatch = NULL;
+
+	// the permutation for shuffling in buffer, keyed by the seed (or the clock) and a counter
+	shuffle = true;
+	bufferShuffleKey = rngKey("buffer") << 32;
+	bufferPermutation = new permutation(nBatchInBuffer * nDataPerBatch, bufferShuffleKey);
+	batchIndex = new unsigned[nDataPerBatch];
+	shuffledBatch = new floatType[nPixelPerData * nDataPerBatch];
+
+	// the prefetching mode is off until startPrefetch() is called
+	prefetch = false;
+	nBufferNum = 0;
+	bufferRing = NULL;
+	bufferData = NULL;
+	bufferState = NULL;
+	consumerSlot = 0;
+	loaderSlot = 0;
+	loaderChunkId = 0;
+	consumerHoldsSlot = false;
+	loaderStop = 0;
+
+	// the file is read with ifstream until mapFloatFile() is called, the data in memory
+	// is handed out like a mapped file without the file
+	mapped = (data != NULL);
+	mappedData = data;
+	mappedSize = 0;
+	mappedFd = -1;
+
+	// the vectors are read from the patch files until useRawImages() is called
+	rawImages = false;
+	rawImageData = NULL;
+	rawImageSize = 0;
+	rawImageFd = -1;
+	nRawImageNum = 0;
+	imagePermutation = NULL;
+	imageShuffleKey = bufferShuffleKey ^ 0x9e3779b97f4a7c15ULL;
+
+	// the cache is off until setCacheBudget() is called
+	cacheBudget = 0;
+	cacheBytes = 0;
+	cacheHits = 0;
+	cacheMisses = 0;
+
+	// load the means and the second moments from file, they are for the byte data only
+	if(!floatPoint){
+		getStat();
+	}
+}
 
-	// load the means and the second moments from file
-	getStat();
+dataProvider::~dataProvider(){
+	stopPrefetch();
+	releaseBufferRing();
+	clearCache();
+	delete[] byteDataBuffer;
+	delete[] compactBatch;
+	if(mapped){
+		if(mappedFd >= 0){
+			munmap((void*)mappedData, mappedSize);
+			close(mappedFd);
+		}
+	}
+	else{
+		delete[] batchDataBuffer;
+	}
+	delete[] mean;
+	delete[] variance;
+	if(normScale != scale){
+		delete[] normScale;
+		delete[] normOffset;
+	}
+	delete[] scale;
+	delete[] offset;
+	delete[] byteStagingBuffer;
+	delete[] packedStagingBuffer;
+	delete bufferPermutation;
+	delete imagePermutation;
+	if(rawImages){
+		munmap((void*)rawImageData, rawImageSize);
+		close(rawImageFd);
+	}
+	delete[] batchIndex;
+	delete[] shuffledBatch;
+	for(unsigned l = 0; l < frozenLayers.size(); l++){
+		delete[] frozenLayers[l].weights;
+		delete[] frozenLayers[l].hidBias;
+		delete[] frozenLayers[l].output;
+	}
 }
 
 void dataProvider::reset(){
-	currentDataId = 0;
+	// In the prefetching mode the file cursors belong to the loader thread, which has 
+	// already wrapped around to the next epoch if the trainer consumed the whole epoch.
+	// Otherwise the loader is out of step with the trainer and has to be restarted.
+	if(prefetch && currentBatchId != 0 && currentBatchId != nBatchNum){
+		unsigned numBuffer = nBufferNum;
+		stopPrefetch();
+		startPrefetch(numBuffer);
+		return;
+	}
+
 	currentBatchId = 0; 
-	currentFileId = 0;
+	if(!prefetch){
+		currentDataId = 0;
+		currentFileId = 0;
+	}
+	return;
+}
+
+/*
+ * The statistics of one patch file: the number of vectors, the means and the sums of
+ * the squared deviations (M2) of the pixel values in [0, 255].
+ * The statistics are saved next to the file in <file>.stat with the size and the modification
+ * time (in nanoseconds) of the file, and reused while both are the same, so only the new or
+ * replaced files are scanned, even those copied with their old time.
+*/
+struct shardStat
+{
+	unsigned long long count;
+	double* mean;
+	double* m2;
+};
+
+// the magic number of the .stat files
+#define SHARD_STAT_MAGIC	0x32415453u
+
+// the size and the modification time of a data file as they are kept in its .stat file
+struct shardVersion
+{
+	long long size;
+	long long mtimeSec;
+	long long mtimeNsec;
+};
+
+static shardVersion getShardVersion(const struct stat& dataInfo){
+	shardVersion version;
+	version.size = (long long)dataInfo.st_size;
+	version.mtimeSec = (long long)dataInfo.st_mtim.tv_sec;
+	version.mtimeNsec = (long long)dataInfo.st_mtim.tv_nsec;
+	return version;
+}
+
+static bool loadShardStat(const string& dataFileName, const struct stat& dataInfo, shardStat& shard, unsigned nPixel){
+	string statFileName = dataFileName + ".stat";
+
+	ifstream fin;
+	fin.open(statFileName.c_str(), ios_base::binary);
+	if(!fin){
+		return false;
+	}
+	unsigned magic = 0, pixel = 0;
+	shardVersion saved;
+	fin.read((char*)&magic, sizeof(unsigned));
+	fin.read((char*)&pixel, sizeof(unsigned));
+	fin.read((char*)&saved, sizeof(shardVersion));
+	if(fin.fail() || magic != SHARD_STAT_MAGIC || pixel != nPixel){
+		return false;
+	}
+
+	// the statistics are out of date unless the data file is exactly the one scanned
+	shardVersion current = getShardVersion(dataInfo);
+	if(saved.size != current.size || saved.mtimeSec != current.mtimeSec || saved.mtimeNsec != current.mtimeNsec){
+		return false;
+	}
+	fin.read((char*)&shard.count, sizeof(unsigned long long));
+	fin.read((char*)shard.mean, nPixel * sizeof(double));
+	fin.read((char*)shard.m2, nPixel * sizeof(double));
+	return !fin.fail();
+}
+
+static void saveShardStat(const string& dataFileName, const struct stat& dataInfo, const shardStat& shard, unsigned nPixel){
+	string statFileName = dataFileName + ".stat";
+	unsigned magic = SHARD_STAT_MAGIC;
+	shardVersion version = getShardVersion(dataInfo);
+
+	ofstream fout;
+	fout.open(statFileName.c_str(), ios_base::binary | ios_base::trunc);
+	fout.write((char*)&magic, sizeof(unsigned));
+	fout.write((char*)&nPixel, sizeof(unsigned));
+	fout.write((char*)&version, sizeof(shardVersion));
+	fout.write((char*)&shard.count, sizeof(unsigned long long));
+	fout.write((char*)shard.mean, nPixel * sizeof(double));
+	fout.write((char*)shard.m2, nPixel * sizeof(double));
+	fout.close();
+}
+
+/*
+ * Add nVec vectors to the sums of the bytes and of their squares. The sums are
+ * integers, so they are exact and the order of the additions does not matter.
+*/
+static void accumulateBytes(unsigned long long* sum, unsigned long long* quadSum, const unsigned char* data, unsigned nVec, unsigned nPixel){
+	for(unsigned v = 0; v < nVec; v++){
+		const unsigned char* p = data + v * nPixel;
+		for(unsigned i = 0; i < nPixel; i++){
+			sum[i] += p[i];
+			quadSum[i] += p[i] * p[i];
+		}
+	}
+	return;
+}
+
+static void finishShard(shardStat& shard, const unsigned long long* sum, const unsigned long long* quadSum, unsigned nPixel){
+	// M2 = sum((x - mean)^2) = sum(x^2) - sum(x)^2 / n
+	for(unsigned i = 0; i < nPixel; i++){
+		double n = (shard.count == 0) ? 1.0 : (double)shard.count;
+		shard.mean[i] = sum[i] / n;
+		shard.m2[i] = quadSum[i] - (double)sum[i] * sum[i] / n;
+	}
 	return;
 }
 
 /*
- * Calculate the means and second moments of the data and save them in files
+ * Scan a patch file in 4 MB reads.
+*/
+static void scanShard(const string& dataFileName, shardStat& shard, unsigned nPixel){
+	unsigned long long* sum = new unsigned long long[nPixel];
+	unsigned long long* quadSum = new unsigned long long[nPixel];
+	memset(sum, 0, nPixel * sizeof(unsigned long long));
+	memset(quadSum, 0, nPixel * sizeof(unsigned long long));
+
+	unsigned nSpanVecNum = (4 << 20) / nPixel;
+	unsigned char* span = new unsigned char[nSpanVecNum * nPixel];
+
+	ifstream fin;
+	fin.open(dataFileName.c_str(), ios_base::binary);
+	shard.count = 0;
+	while(fin){
+		fin.read((char*)span, nSpanVecNum * nPixel);
+		unsigned nReadVecNum = fin.gcount() / nPixel;
+		accumulateBytes(sum, quadSum, span, nReadVecNum, nPixel);
+		shard.count += nReadVecNum;
+	}
+	fin.close();
+	finishShard(shard, sum, quadSum, nPixel);
+
+	delete[] sum;
+	delete[] quadSum;
+	delete[] span;
+}
+
+/*
+ * The statistics of the retina vectors of nImage raw images, which are made as in training.
+*/
+static void scanRawImages(const unsigned char* images, unsigned nImage, shardStat& shard, unsigned nPixel){
+	unsigned long long* sum = new unsigned long long[nPixel];
+	unsigned long long* quadSum = new unsigned long long[nPixel];
+	memset(sum, 0, nPixel * sizeof(unsigned long long));
+	memset(quadSum, 0, nPixel * sizeof(unsigned long long));
+
+	unsigned char windows[RAW_WINDOW_NUM * 3 * RETINA_VECTOR_SIZE];
+	unsigned char pooled[3 * (RAW_IMAGE_WIDTH / 2) * (RAW_IMAGE_WIDTH / 2)];
+	for(unsigned image = 0; image < nImage; image++){
+		retinaImage(windows, images + (size_t)image * RAW_IMAGE_BYTES, pooled, RAW_IMAGE_WIDTH, RAW_IMAGE_WIDTH, 3);
+		accumulateBytes(sum, quadSum, windows, RAW_WINDOW_NUM, nPixel);
+	}
+	shard.count = (unsigned long long)nImage * RAW_WINDOW_NUM;
+	finishShard(shard, sum, quadSum, nPixel);
+
+	delete[] sum;
+	delete[] quadSum;
+}
+
+/*
+ * Calculate the means and the second moments of the patch files and save them to
+ * ../data/means.dat and ../data/secondmoment.dat, the files read by getStat().
+ * After useRawImages() the vectors are made from the raw images instead.
+ * The files are scanned in parallel, and their statistics are merged in the order
+ * of the files with the formula of Chan et al., so the result does not depend on
+ * the number of threads.
 */
 void dataProvider::getExpectation(){
-	// the means of the data
-	floatType expectation[nPixelPerData];
-	// the second moments of the data
-	floatType secondMoment[nPixelPerData];
+	// the raw images are scanned in shards of RAW_SHARD_IMAGE_NUM images
+	unsigned nFileNum = rawImages ? (nRawImageNum + RAW_SHARD_IMAGE_NUM - 1) / RAW_SHARD_IMAGE_NUM : (nDataNum + nDataPerFile - 1) / nDataPerFile;
+
+	shardStat* stats = new shardStat[nFileNum];
+	for(unsigned fileId = 0; fileId < nFileNum; fileId++){
+		stats[fileId].mean = new double[nPixelPerData];
+		stats[fileId].m2 = new double[nPixelPerData];
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int fileId = 0; fileId < (int)nFileNum; fileId++){
+		if(rawImages){
+			unsigned first = fileId * RAW_SHARD_IMAGE_NUM;
+			unsigned nImage = (nRawImageNum - first > RAW_SHARD_IMAGE_NUM) ? RAW_SHARD_IMAGE_NUM : nRawImageNum - first;
+			scanRawImages(rawImageData + (size_t)first * RAW_IMAGE_BYTES, nImage, stats[fileId], nPixelPerData);
+			continue;
+		}
 
-	// clear the memory
-	memset(expectation, 0, nPixelPerData * sizeof(floatType));
-	memset(secondMoment, 0, nPixelPerData * sizeof(floatType));
-	
-	// calculate the means and the second moments by file in order to minimize the float-point error
-	for(int fileId = 0; fileId < 400; fileId++){
 		string dataFileName = dataFileNamePrefix;
 		generateFileName(&dataFileName, fileId, 3);
-		
-		// temp buffers for means and second moments of each file
-		floatType tempSum[nPixelPerData];
-		floatType tempQuadSum[nPixelPerData];
-		
-		// clear the temp buffer
-		memset(tempSum, 	0, nPixelPerData * sizeof(floatType));
-		memset(tempQuadSum, 0, nPixelPerData * sizeof(floatType));
-
-		// temp buffer for the data
-		unsigned char tempBuffer[nPixelPerData];
-
-		ifstream fin;
-		// open one data file and sum up the data values and the square of data values
-		fin.open(dataFileName.c_str(), ios_base::binary);
-		const unsigned nPatchPerFile = 68000 * 30 * 81 / 400;
-
-		for(unsigned patchId = 0; patchId < nPatchPerFile; patchId++){
-			// read one line of data to buffer
-			fin.read((char*)tempBuffer, sizeof(unsigned char) * nPixelPerData);
-			
-			for(unsigned i = 0; i < nPixelPerData; i++){
-				// second moment
-				tempQuadSum[i] += ((floatType)tempBuffer[i]) * ((floatType)tempBuffer[i]) / 255.0 / 255.0;
-				// mean
-				tempSum[i] += ((floatType)tempBuffer[i]) / 255.0;
-			}
+
+		// only the files without valid statistics are scanned, the version is taken before the scan
+		// so a file replaced during the scan is scanned again next time
+		struct stat dataInfo;
+		if(::stat(dataFileName.c_str(), &dataInfo) != 0){
+			printf("stat %s failed!\n", dataFileName.c_str());
+			exit(-1);
 		}
-		
-		fin.close();
-		
-		// add the sum of one file to the total sum
-		for(int i = 0; i < nPixelPerData; i++){
-			expectation[i] += tempSum[i];
-			secondMoment[i] += tempQuadSum[i];
+		if(!loadShardStat(dataFileName, dataInfo, stats[fileId], nPixelPerData)){
+			scanShard(dataFileName, stats[fileId], nPixelPerData);
+			saveShardStat(dataFileName, dataInfo, stats[fileId], nPixelPerData);
 		}
 	}
 
-	// means and second moments normalization
-	for(int i = 0; i < nPixelPerData; i++){
-		expectation[i] /= 68000 * 30 * 81;
-		secondMoment[i] /= 68000 * 30 * 81;
+	// merge the statistics of the files
+	double* totalMean = new double[nPixelPerData];
+	double* totalM2 = new double[nPixelPerData];
+	unsigned long long totalCount = 0;
+	memset(totalMean, 0, nPixelPerData * sizeof(double));
+	memset(totalM2, 0, nPixelPerData * sizeof(double));
+
+	for(unsigned fileId = 0; fileId < nFileNum; fileId++){
+		unsigned long long count = stats[fileId].count;
+		if(count == 0){
+			continue;
+		}
+		double n = (double)totalCount + count;
+		for(unsigned i = 0; i < nPixelPerData; i++){
+			double delta = stats[fileId].mean[i] - totalMean[i];
+			totalMean[i] += delta * count / n;
+			totalM2[i] += stats[fileId].m2[i] + delta * delta * ((double)totalCount * count / n);
+		}
+		totalCount += count;
 	}
 
+	// the means and the second moments of x / 255
+	floatType* expectation = new floatType[nPixelPerData];
+	floatType* secondMoment = new floatType[nPixelPerData];
+	for(unsigned i = 0; i < nPixelPerData; i++){
+		double variance = (totalCount == 0) ? 0.0 : totalM2[i] / totalCount;
+		expectation[i] = totalMean[i] / 255.0;
+		secondMoment[i] = (variance + totalMean[i] * totalMean[i]) / 255.0 / 255.0;
+	}
 
 	// save the means and second moments to files
 	ofstream fout;
@@ -608,6 +884,16 @@ void dataProvider::getExpectation(){
 	fout.open("../data/secondmoment.dat", ios_base::binary | ios_base::trunc);
 	fout.write((char*)secondMoment, nPixelPerData * sizeof(floatType));
 	fout.close();
+
+	for(unsigned fileId = 0; fileId < nFileNum; fileId++){
+		delete[] stats[fileId].mean;
+		delete[] stats[fileId].m2;
+	}
+	delete[] stats;
+	delete[] totalMean;
+	delete[] totalM2;
+	delete[] expectation;
+	delete[] secondMoment;
 }
 
 /*
@@ -630,6 +916,12 @@ void dataProvider::getStat(){
 	for(int i = 0; i < nPixelPerData; i++){
 		variance[i] = sqrt(variance[i] - mean[i] * mean[i]);
 	}
+
+	// (x / 255 - mean) / stdvar = x * scale + offset
+	for(unsigned i = 0; i < nPixelPerData; i++){
+		scale[i] = 1.0 / (255.0 * variance[i]);
+		offset[i] = - mean[i] / variance[i];
+	}
 	
 	return;
 }
@@ -638,13 +930,13 @@ void dataProvider::getStat(){
  * Load training data from files to memory
  * This function is for BB-RBM, which processes the float-point files
 */
-void dataProvider::loadFloatFileToBuffer()
+void dataProvider::loadFloatFileToBuffer(floatType* buffer)
 {
 	// the nextLoadIndex indicates the index of the first vector not included in this loading
-	int nextLoadIndex = currentDataId + nDataPerBatch * nBatchInBuffer;
+	unsigned nextLoadIndex = currentDataId + nDataPerBatch * nBatchInBuffer;
 
 	// if the end of the training data is reached, the nextLoadIndex is set to the end
-	nextLoadIndex = (nextLoadIndex > 68000 * 30 * 81) ? 68000 * 30 * 81 : nextLoadIndex;
+	nextLoadIndex = (nextLoadIndex > nDataNum) ? nDataNum : nextLoadIndex;
 	
 	// the total number of vectors to be loaded into memory
 	unsigned nLoadVecNum = nextLoadIndex - currentDataId;
@@ -656,14 +948,31 @@ void dataProvider::loadFloatFileToBuffer()
 	ifstream fin;
 	fin.open(dataFileName.c_str(), ios_base::binary);
 
-	// locate the first vector to load in the file
-	fin.seekg((currentDataId % nDataPerFile) * nPixelPerData * sizeof(floatType));	
+	// locate the first vector to load in the file, the offset may exceed 4 GB
+	fin.seekg((streamoff)(currentDataId % nDataPerFile) * storageSize(storage, nPixelPerData));	
 
-	// load the vectors until the buffer is filled or the end is reached
-	fin.read((char*)batchDataBuffer, sizeof(floatType) * nPixelPerData * nLoadVecNum);
+	if(storage == STORAGE_FLOAT32){
+		// load the vectors until the buffer is filled or the end is reached
+		fin.read((char*)buffer, sizeof(floatType) * nPixelPerData * nLoadVecNum);
+	}
+	else{
+		// the packed values are read in spans and converted while the span is in cache
+		for(unsigned nDone = 0; nDone < nLoadVecNum; nDone += nPackedStagingVecNum){
+			unsigned nSpanVecNum = (nLoadVecNum - nDone < nPackedStagingVecNum) ? nLoadVecNum - nDone : nPackedStagingVecNum;
+			size_t nValueNum = (size_t)nSpanVecNum * nPixelPerData;
+			fin.read((char*)packedStagingBuffer, storageSize(storage, nValueNum));
+			if(storage == STORAGE_BITS){
+				unpackBits(buffer + (size_t)nDone * nPixelPerData, packedStagingBuffer, nValueNum);
+			}
+			else{
+				halfToFloat(buffer + (size_t)nDone * nPixelPerData, (unsigned short*)packedStagingBuffer, nValueNum, storage);
+			}
+		}
+	}
 
 	// update the index of vector counter
 	currentDataId += nLoadVecNum;
+	nLoadedVecNum = nLoadVecNum;
 
 	fin.close();
 }
@@ -673,13 +982,33 @@ void dataProvider::loadFloatFileToBuffer()
  * Load training data from files to memory
  * This function is for GB-RBM and autoencoder, which processes the byte files
 */
-void dataProvider::loadByteFileToBuffer(){
+void dataProvider::loadByteFileToBuffer(floatType* buffer){
+	readByteFiles(byteStagingBuffer, buffer);
+	return;
+}
+
+/*
+ * Load training data from files to memory without the normalization
+ * This function is for the compact mode of the byte provider
+*/
+void dataProvider::loadRawByteFileToBuffer(unsigned char* buffer){
+	readByteFiles(buffer, NULL);
+	return;
+}
+
+/*
+ * Read the next nBatchInBuffer mini-batches from the patch files in spans of one read each.
+ * If buffer is NULL the bytes are stored at raw one after another, otherwise raw is the
+ * staging buffer for one span, which is normalized into buffer right after the reading.
+*/
+void dataProvider::readByteFiles(unsigned char* raw, floatType* buffer){
 
 	// the nextLoadIndex indicates the index of the first vector not included in this loading
-	int nextLoadIndex = currentDataId + nDataPerBatch * nBatchInBuffer;
+	unsigned nextLoadIndex = currentDataId + nDataPerBatch * nBatchInBuffer;
 
 	// if the end of the training data is reached, the nextLoadIndex is set to the end
-	nextLoadIndex = (nextLoadIndex > 68000 * 30 * 81) ? 68000 * 30 * 81 : nextLoadIndex;
+	nextLoadIndex = (nextLoadIndex > nDataNum) ? nDataNum : nextLoadIndex;
+	nLoadedVecNum = nextLoadIndex - currentDataId;
 
 	// open the corresponding patch file
 	string dataFileName = dataFileNamePrefix;
@@ -687,27 +1016,37 @@ void dataProvider::loadByteFileToBuffer(){
 	ifstream fin;
 	fin.open(dataFileName.c_str(), ios_base::binary);
 
-	// the index of the first vector in the memory buffer
-	unsigned int localDataId = 0;
+	// locate the first vector to be loaded in the file
+	fin.seekg((streamoff)(currentDataId % nDataPerFile) * nPixelPerData * sizeof(unsigned char));
 
-	// the temp buffer to cache a vector
-	unsigned char tempBuffer[nPixelPerData];
+	// the maximum number of vectors in one span
+	unsigned nMaxSpanVecNum = (buffer == NULL) ? nLoadedVecNum : nStagingVecNum;
 
 	while(currentDataId < nextLoadIndex){
-		// locate the vector to be loaded in the file
-		fin.seekg((currentDataId % nDataPerFile) * nPixelPerData * sizeof(unsigned char));
+		// a span ends at the end of this loading, the end of the file or the end of the staging buffer
+		unsigned nSpanVecNum = nextLoadIndex - currentDataId;
+		unsigned nVecLeftInFile = nDataPerFile - currentDataId % nDataPerFile;
+		nSpanVecNum = (nSpanVecNum > nVecLeftInFile) ? nVecLeftInFile : nSpanVecNum;
+		nSpanVecNum = (nSpanVecNum > nMaxSpanVecNum) ? nMaxSpanVecNum : nSpanVecNum;
 
-		// read one vector from the file
-		fin.read((char*)tempBuffer, sizeof(unsigned char) * nPixelPerData);
+		// read the whole span with one call
+		fin.read((char*)raw, sizeof(unsigned char) * nPixelPerData * nSpanVecNum);
 
-		// transfer byte to float
-		// here goes the preprocessing code, normalization, followed by x = (x - mean) / stdvar
-		for(int i = 0; i < nPixelPerData; i++){
-			batchDataBuffer[localDataId * nPixelPerData + i] = ((((floatType)tempBuffer[i]) / 255.0) - mean[i]) / variance[i];
+		if(buffer == NULL){
+			raw += nSpanVecNum * nPixelPerData;
+		}
+		else{
+			// transfer byte to float
+			// here goes the preprocessing code, normalization, followed by x = (x - mean) / stdvar
+			normalizeBytes(buffer, raw, normScale, normOffset, nSpanVecNum, nPixelPerData);
+			buffer += nSpanVecNum * nPixelPerData;
 		}
 
+		// update the counter of vector
+		currentDataId += nSpanVecNum;
+
 		// handle the end of files
-		if((currentDataId + 1) % nDataPerFile == 0){
+		if(currentDataId % nDataPerFile == 0){
 			// close the current file
 			fin.close();
 			// update the file counter
@@ -718,14 +1057,539 @@ void dataProvider::loadByteFileToBuffer(){
 			// open the next file to read
 			fin.open(dataFileName.c_str(), ios_base::binary);
 		}
-		// update the counter of vector
-		currentDataId++;
-		localDataId++;
 	}
 	// close the input file
 	fin.close();
 }
 
+/*
+ * Fill a host buffer with the subsequent batches from the files
+*/
+char* dataProvider::loadBuffer(char* buffer){
+	unsigned chunkId = currentDataId / (nDataPerBatch * nBatchInBuffer);
+	bool caching = (cacheBudget > 0 && !rawImages);
+	char* data = caching ? loadCachedChunk(chunkId) : NULL;
+
+	if(data != NULL){
+		cacheHits++;
+	}
+	else{
+		data = buffer;
+		// floatPoint - true for BB-RBM / false for GB-RBM and autoencoder
+		if(floatPoint){
+			loadFloatFileToBuffer((floatType*)buffer);
+		}
+		else if(rawImages){
+			loadRetinaBuffer(buffer);
+		}
+		else if(compact){
+			loadRawByteFileToBuffer((unsigned char*)buffer);
+		}
+		else{
+			loadByteFileToBuffer((floatType*)buffer);
+		}
+
+		if(caching){
+			cacheMisses++;
+			cacheLoadedChunk(chunkId, buffer);
+		}
+	}
+
+	// report the cache at the end of an epoch
+	if(caching && (currentDataId >= nDataNum || currentDataId / nDataPerBatch >= nBatchNum)){
+		printf("cache: %u hits, %u misses in this epoch\n", cacheHits, cacheMisses);
+		cacheHits = 0;
+		cacheMisses = 0;
+	}
+	return data;
+}
+
+char* dataProvider::loadCachedChunk(unsigned chunkId){
+	if(chunkId >= cacheChunk.size() || cacheChunk[chunkId] == NULL){
+		return NULL;
+	}
+
+	// move the cursors as the loading from the files does
+	nLoadedVecNum = cacheVecNum[chunkId];
+	currentDataId += nLoadedVecNum;
+	currentFileId = currentDataId / nDataPerFile;
+	return cacheChunk[chunkId];
+}
+
+void dataProvider::cacheLoadedChunk(unsigned chunkId, char* buffer){
+	size_t vecBytes = bufferBytes() / ((size_t)nDataPerBatch * nBatchInBuffer);
+	size_t size = nLoadedVecNum * vecBytes;
+
+	// the chunks cached first stay, the chunks after a full budget are read from the files in every epoch
+	if(cacheBytes + size > cacheBudget){
+		return;
+	}
+	if(chunkId >= cacheChunk.size()){
+		cacheChunk.resize(chunkId + 1, NULL);
+		cacheVecNum.resize(chunkId + 1, 0);
+	}
+	cacheChunk[chunkId] = new char[size];
+	memcpy(cacheChunk[chunkId], buffer, size);
+	cacheVecNum[chunkId] = nLoadedVecNum;
+	cacheBytes += size;
+	return;
+}
+
+void dataProvider::clearCache(){
+	for(unsigned i = 0; i < cacheChunk.size(); i++){
+		delete[] cacheChunk[i];
+	}
+	cacheChunk.clear();
+	cacheVecNum.clear();
+	cacheBytes = 0;
+	cacheHits = 0;
+	cacheMisses = 0;
+	return;
+}
+
+/*
+ * The cache belongs to the thread loading the buffers, so the loader thread is restarted.
+*/
+void dataProvider::setCacheBudget(size_t budget){
+	bool prefetching = prefetch;
+	unsigned numBuffer = nBufferNum;
+	stopPrefetch();
+
+	clearCache();
+	cacheBudget = budget;
+
+	reset();
+	if(prefetching){
+		startPrefetch(numBuffer);
+	}
+	return;
+}
+
+/*
+ * Make the next nBatchInBuffer mini-batches from the raw images. The vector v of an epoch is
+ * the window v % 81 of the image v / 81 in the order of imagePermutation, which is re-keyed
+ * at the beginning of each epoch. The windows of an image are together in the buffer and
+ * are mixed with the windows of the other images by the shuffling in buffer.
+*/
+void dataProvider::loadRetinaBuffer(char* buffer){
+	// the nextLoadIndex indicates the index of the first vector not included in this loading
+	unsigned nextLoadIndex = currentDataId + nDataPerBatch * nBatchInBuffer;
+
+	// if the end of the training data is reached, the nextLoadIndex is set to the end
+	nextLoadIndex = (nextLoadIndex > nDataNum) ? nDataNum : nextLoadIndex;
+	nLoadedVecNum = nextLoadIndex - currentDataId;
+
+	// a new order of the images for every epoch
+	if(currentDataId == 0){
+		imagePermutation->setKey(++imageShuffleKey);
+	}
+
+	// the images overlapping with this loading
+	unsigned firstLoadIndex = currentDataId;
+	int firstImage = firstLoadIndex / RAW_WINDOW_NUM;
+	int endImage = (nextLoadIndex + RAW_WINDOW_NUM - 1) / RAW_WINDOW_NUM;
+
+	// each image is independent, the vectors of an image are made in the stack of its thread
+	#pragma omp parallel for schedule(static)
+	for(int image = firstImage; image < endImage; image++){
+		unsigned char windows[RAW_WINDOW_NUM * 3 * RETINA_VECTOR_SIZE];
+		unsigned char pooled[3 * (RAW_IMAGE_WIDTH / 2) * (RAW_IMAGE_WIDTH / 2)];
+		const unsigned char* raw = rawImageData + (size_t)imagePermutation->forward(image) * RAW_IMAGE_BYTES;
+		retinaImage(windows, raw, pooled, RAW_IMAGE_WIDTH, RAW_IMAGE_WIDTH, 3);
+
+		// the windows of the image in this loading
+		unsigned first = image * RAW_WINDOW_NUM;
+		unsigned last = first + RAW_WINDOW_NUM;
+		first = (first < firstLoadIndex) ? firstLoadIndex : first;
+		last = (last > nextLoadIndex) ? nextLoadIndex : last;
+
+		const unsigned char* src = windows + (first % RAW_WINDOW_NUM) * nPixelPerData;
+		size_t dstOffset = (size_t)(first - firstLoadIndex) * nPixelPerData;
+		if(compact){
+			memcpy((unsigned char*)buffer + dstOffset, src, (last - first) * nPixelPerData);
+		}
+		else{
+			normalizeBytes((floatType*)buffer + dstOffset, src, normScale, normOffset, last - first, nPixelPerData);
+		}
+	}
+
+	currentDataId = nextLoadIndex;
+	return;
+}
+
+size_t dataProvider::bufferBytes(){
+	size_t nVec = (size_t)nDataPerBatch * nBatchInBuffer;
+	return compact ? nVec * nPixelPerData : nVec * nPixelPerData * sizeof(floatType);
+}
+
+/*
+ * Make batchDataBuffer point to the subsequent batches.
+ * Without prefetching the batches are loaded synchronously into the only buffer.
+ * With prefetching the buffer consumed so far is handed back to the loader thread
+ * and the trainer waits (normally not at all) for the next buffer in the ring.
+*/
+void dataProvider::loadNextBuffer(){
+	if(mapped){
+		loadMappedBuffer();
+		return;
+	}
+
+	// the only buffer is also the one loaded next, so a cached chunk is copied into it
+	if(!prefetch){
+		char* buffer = compact ? (char*)byteDataBuffer : (char*)batchDataBuffer;
+		char* data = loadBuffer(buffer);
+		if(data != buffer){
+			memcpy(buffer, data, nLoadedVecNum * (bufferBytes() / ((size_t)nDataPerBatch * nBatchInBuffer)));
+		}
+		return;
+	}
+
+	// hand the consumed buffer back to the loader thread
+	if(consumerHoldsSlot){
+		__atomic_store_n(&bufferState[consumerSlot], BUFFER_EMPTY, __ATOMIC_RELEASE);
+		consumerSlot = (consumerSlot + 1) % nBufferNum;
+	}
+
+	// wait for the loader thread to fill the next buffer
+	unsigned spin = 0;
+	while(__atomic_load_n(&bufferState[consumerSlot], __ATOMIC_ACQUIRE) != BUFFER_FULL){
+		if(++spin < 1000){
+			sched_yield();
+		}
+		else{
+			usleep(100);
+		}
+	}
+
+	if(compact){
+		byteDataBuffer = (unsigned char*)bufferData[consumerSlot];
+	}
+	else{
+		batchDataBuffer = (floatType*)bufferData[consumerSlot];
+	}
+	consumerHoldsSlot = true;
+	return;
+}
+
+/*
+ * The loader thread fills the ring buffers in order. After the last buffer of an
+ * epoch the file cursors are rewound, so the next epoch is prefetched as well.
+*/
+void dataProvider::loaderLoop(){
+	// the number of buffer-sized chunks consumed by the trainer in one epoch
+	unsigned nChunkPerEpoch = (nBatchNum + nBatchInBuffer - 1) / nBatchInBuffer;
+
+	while(!__atomic_load_n(&loaderStop, __ATOMIC_ACQUIRE)){
+		// wait for the trainer to release the buffer
+		if(__atomic_load_n(&bufferState[loaderSlot], __ATOMIC_ACQUIRE) != BUFFER_EMPTY){
+			usleep(100);
+			continue;
+		}
+
+		bufferData[loaderSlot] = loadBuffer(bufferRing[loaderSlot]);
+		__atomic_store_n(&bufferState[loaderSlot], BUFFER_FULL, __ATOMIC_RELEASE);
+		loaderSlot = (loaderSlot + 1) % nBufferNum;
+
+		// rewind the file cursors at the end of an epoch
+		if(++loaderChunkId == nChunkPerEpoch){
+			loaderChunkId = 0;
+			currentDataId = 0;
+			currentFileId = 0;
+		}
+	}
+	return;
+}
+
+void* dataProvider::loaderEntry(void* provider){
+	((dataProvider*)provider)->loaderLoop();
+	return NULL;
+}
+
+void dataProvider::startPrefetch(unsigned numBuffer){
+	// the kernel reads ahead for the mapped file, see loadMappedBuffer()
+	if(prefetch || mapped){
+		return;
+	}
+	if(numBuffer < 2){
+		numBuffer = 2;
+	}
+
+	// the first buffer of the ring reuses the buffer of the synchronous mode
+	if(bufferRing == NULL || nBufferNum != numBuffer){
+		releaseBufferRing();
+		nBufferNum = numBuffer;
+		bufferRing = new char*[nBufferNum];
+		bufferData = new char*[nBufferNum];
+		bufferState = new int[nBufferNum];
+		bufferRing[0] = compact ? (char*)byteDataBuffer : (char*)batchDataBuffer;
+		for(unsigned i = 1; i < nBufferNum; i++){
+			bufferRing[i] = new char[bufferBytes()];
+		}
+	}
+	for(unsigned i = 0; i < nBufferNum; i++){
+		bufferState[i] = BUFFER_EMPTY;
+	}
+
+	// the loader starts from the beginning of the data
+	currentDataId = 0;
+	currentBatchId = 0;
+	currentFileId = 0;
+	consumerSlot = 0;
+	loaderSlot = 0;
+	loaderChunkId = 0;
+	consumerHoldsSlot = false;
+	loaderStop = 0;
+	prefetch = true;
+
+	if(pthread_create(&loaderThread, NULL, loaderEntry, (void*)this) != 0){
+		printf("create loader thread failed!\n");
+		exit(-1);
+	}
+	return;
+}
+
+void dataProvider::stopPrefetch(){
+	if(!prefetch){
+		return;
+	}
+
+	__atomic_store_n(&loaderStop, 1, __ATOMIC_RELEASE);
+	pthread_join(loaderThread, NULL);
+	prefetch = false;
+	consumerHoldsSlot = false;
+
+	// go back to the synchronous mode with the first buffer of the ring
+	if(compact){
+		byteDataBuffer = (unsigned char*)bufferRing[0];
+	}
+	else{
+		batchDataBuffer = (floatType*)bufferRing[0];
+	}
+	return;
+}
+
+void dataProvider::releaseBufferRing(){
+	if(bufferRing == NULL){
+		return;
+	}
+	for(unsigned i = 1; i < nBufferNum; i++){
+		delete[] bufferRing[i];
+	}
+	delete[] bufferRing;
+	delete[] bufferState;
+	delete[] bufferData;
+	bufferRing = NULL;
+	bufferData = NULL;
+	bufferState = NULL;
+	nBufferNum = 0;
+	return;
+}
+
+/*
+ * The packed staging buffer holds about 4 MB of the file, like the byte staging buffer.
+ * The loader thread reads the file with the format, so it is restarted.
+*/
+void dataProvider::setStorageFormat(storageFormat format){
+	if(mapped || !floatPoint || format == storage){
+		return;
+	}
+	if(format == STORAGE_BITS && nPixelPerData % 8 != 0){
+		printf("the %u-dim vectors cannot be stored in bits!\n", nPixelPerData);
+		exit(-1);
+	}
+
+	bool prefetching = prefetch;
+	unsigned numBuffer = nBufferNum;
+	stopPrefetch();
+	clearCache();
+
+	storage = format;
+	delete[] packedStagingBuffer;
+	packedStagingBuffer = NULL;
+	nPackedStagingVecNum = 0;
+	if(storage != STORAGE_FLOAT32){
+		nPackedStagingVecNum = (4 << 20) / storageSize(storage, nPixelPerData);
+		nPackedStagingVecNum = (nPackedStagingVecNum == 0) ? 1 : nPackedStagingVecNum;
+		packedStagingBuffer = new unsigned char[storageSize(storage, (size_t)nPackedStagingVecNum * nPixelPerData)];
+	}
+
+	reset();
+	if(prefetching){
+		startPrefetch(numBuffer);
+	}
+	return;
+}
+
+/*
+ * Map the whole float-point file read-only. The host buffers are not needed any more.
+ * The 16-bit files are not mapped, their values have to be converted anyway.
+*/
+void dataProvider::mapFloatFile(){
+	if(mapped || !floatPoint || storage != STORAGE_FLOAT32){
+		return;
+	}
+
+	mappedFd = open(dataFileNamePrefix.c_str(), O_RDONLY);
+	if(mappedFd < 0){
+		printf("open %s failed!\n", dataFileNamePrefix.c_str());
+		exit(-1);
+	}
+
+	struct stat fileStat;
+	fstat(mappedFd, &fileStat);
+	mappedSize = fileStat.st_size;
+
+	void* addr = mmap(NULL, mappedSize, PROT_READ, MAP_SHARED, mappedFd, 0);
+	if(addr == MAP_FAILED){
+		printf("mmap %s failed!\n", dataFileNamePrefix.c_str());
+		exit(-1);
+	}
+	mappedData = (floatType*)addr;
+
+	// the file is read from the beginning to the end in each epoch
+	madvise(addr, mappedSize, MADV_SEQUENTIAL);
+
+	// the batches beyond the end of the file cannot be handed out
+	size_t nVecInFile = mappedSize / (nPixelPerData * sizeof(floatType));
+	if(nVecInFile < nDataNum){
+		printf("%s contains %u vectors only\n", dataFileNamePrefix.c_str(), (unsigned)nVecInFile);
+		nDataNum = nVecInFile;
+		nBatchNum = nDataNum / nDataPerBatch;
+	}
+
+	// release the host buffers
+	stopPrefetch();
+	clearCache();
+	releaseBufferRing();
+	delete[] batchDataBuffer;
+	batchDataBuffer = NULL;
+
+	mapped = true;
+	currentDataId = 0;
+	return;
+}
+
+/*
+ * Point batchDataBuffer to the next nBatchInBuffer batches in the mapped file.
+ * The window after it is requested from the disk in advance and the pages of the
+ * window consumed before are dropped, so the resident memory stays at two windows.
+*/
+void dataProvider::loadMappedBuffer(){
+	size_t vecSize = nPixelPerData * sizeof(floatType);
+	size_t windowSize = (size_t)nDataPerBatch * nBatchInBuffer * vecSize;
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	char* base = (char*)mappedData;
+
+	unsigned nextLoadIndex = currentDataId + nDataPerBatch * nBatchInBuffer;
+	nextLoadIndex = (nextLoadIndex > nDataNum) ? nDataNum : nextLoadIndex;
+
+	size_t offset = (size_t)currentDataId * vecSize;
+	batchDataBuffer = (floatType*)(base + offset);
+	nLoadedVecNum = nextLoadIndex - currentDataId;
+	currentDataId = nextLoadIndex;
+
+	// the data in memory needs no paging advice
+	if(mappedFd < 0){
+		return;
+	}
+
+	// drop the consumed window
+	if(offset >= windowSize){
+		size_t start = (offset - windowSize) / pageSize * pageSize;
+		madvise(base + start, offset / pageSize * pageSize - start, MADV_DONTNEED);
+	}
+
+	// read ahead the current and the next window
+	size_t start = offset / pageSize * pageSize;
+	size_t end = offset + 2 * windowSize;
+	end = (end > mappedSize) ? mappedSize : end;
+	if(end > start){
+		madvise(base + start, end - start, MADV_WILLNEED);
+	}
+	return;
+}
+
+/*
+ * Replace the float-point buffer with a byte buffer of numBatchInBuffer mini-batches.
+*/
+void dataProvider::useCompactBuffer(unsigned numBatchInBuffer){
+	if(compact || floatPoint){
+		return;
+	}
+
+	// the loader thread is restarted with byte buffers
+	bool prefetching = prefetch;
+	unsigned numBuffer = nBufferNum;
+	stopPrefetch();
+	clearCache();
+	releaseBufferRing();
+	delete[] batchDataBuffer;
+	batchDataBuffer = NULL;
+
+	// a byte takes a quarter of the memory of a float
+	nBatchInBuffer = (numBatchInBuffer == 0) ? 4 * nBatchInBuffer : numBatchInBuffer;
+	byteDataBuffer = new unsigned char[(size_t)nPixelPerData * nDataPerBatch * nBatchInBuffer];
+	compactBatch = new floatType[nPixelPerData * nDataPerBatch];
+
+	compact = true;
+	reset();
+	if(prefetching){
+		startPrefetch(numBuffer);
+	}
+	return;
+}
+
+/*
+ * Map the raw image file read-only and make the retina vectors from it while loading.
+*/
+void dataProvider::useRawImages(string rawFile){
+	if(rawImages || floatPoint){
+		return;
+	}
+	if(nPixelPerData != 3 * RETINA_VECTOR_SIZE){
+		printf("raw images need %u pixels per vector, not %u\n", 3 * RETINA_VECTOR_SIZE, nPixelPerData);
+		exit(-1);
+	}
+
+	rawImageFd = open(rawFile.c_str(), O_RDONLY);
+	if(rawImageFd < 0){
+		printf("open %s failed!\n", rawFile.c_str());
+		exit(-1);
+	}
+
+	struct stat fileStat;
+	fstat(rawImageFd, &fileStat);
+	rawImageSize = fileStat.st_size;
+
+	void* addr = mmap(NULL, rawImageSize, PROT_READ, MAP_SHARED, rawImageFd, 0);
+	if(addr == MAP_FAILED){
+		printf("mmap %s failed!\n", rawFile.c_str());
+		exit(-1);
+	}
+	rawImageData = (unsigned char*)addr;
+
+	// the images are visited in a random order
+	madvise(addr, rawImageSize, MADV_RANDOM);
+
+	// the loader thread is restarted with the new source
+	bool prefetching = prefetch;
+	unsigned numBuffer = nBufferNum;
+	stopPrefetch();
+	clearCache();
+
+	nRawImageNum = rawImageSize / RAW_IMAGE_BYTES;
+	nDataNum = nRawImageNum * RAW_WINDOW_NUM;
+	nBatchNum = nDataNum / nDataPerBatch;
+	imagePermutation = new permutation(nRawImageNum, imageShuffleKey);
+
+	rawImages = true;
+	reset();
+	if(prefetching){
+		startPrefetch(numBuffer);
+	}
+	return;
+}
+
 /*
  * This function returns the pointer to a memory buffer which contains the next mini-batch to be processed.
  * The function automatically read the subsequent batches. The user can call dataProvider::reset() to read from the beginning.
@@ -743,73 +1607,281 @@ floatType* dataProvider::getNextBatch(){
 
 	// If the batch is not in the buffer, load subsequent batches from files to the buffer
 	if(localBatchId == 0){
-		// floatPoint - true for BB-RBM / false for GB-RBM and autoencoder
-		if(floatPoint){
-			loadFloatFileToBuffer();
-		}
-		else{
-			loadByteFileToBuffer();
+		loadNextBuffer();
+		if(shuffle){
+			shuffleBuffer();
 		}
 	}
 
 	// return the pointer to the mini-batch in the buffer
-	floatType* batch = batchDataBuffer + localBatchId * nDataPerBatch * nPixelPerData;
+	floatType* batch;
+	if(shuffle){
+		// gather the vectors of this mini-batch
+		getBatchIndex(localBatchId);
+		batch = compact ? compactBatch : shuffledBatch;
+		for(unsigned i = 0; i < nDataPerBatch; i++){
+			if(compact){
+				normalizeBytes(batch + i * nPixelPerData, byteDataBuffer + batchIndex[i] * nPixelPerData, normScale, normOffset, 1, nPixelPerData);
+			}
+			else{
+				memcpy(batch + i * nPixelPerData, batchDataBuffer + batchIndex[i] * nPixelPerData, nPixelPerData * sizeof(floatType));
+			}
+		}
+	}
+	else if(compact){
+		// normalize the bytes of this mini-batch only
+		normalizeBytes(compactBatch, byteDataBuffer + localBatchId * nDataPerBatch * nPixelPerData, normScale, normOffset, nDataPerBatch, nPixelPerData);
+		batch = compactBatch;
+	}
+	else{
+		batch = batchDataBuffer + localBatchId * nDataPerBatch * nPixelPerData;
+	}
 
 	// update the mini-batch counter
 	currentBatchId++;
 
 	// return the pointer
+	return frozenLayers.empty() ? batch : applyFrozenLayers(batch);
+}
+
+unsigned dataProvider::frozenOutputSize(){
+	return frozenLayers.empty() ? nPixelPerData : frozenLayers.back().nHidNum;
+}
+
+void dataProvider::addFrozenLayer(unsigned nVis, unsigned nHid, const floatType* weights, const floatType* hidBias, bool binary, sigmoidMode mode){
+	if(nVis != frozenOutputSize()){
+		printf("the frozen layer takes %u-dim vectors instead of %u-dim ones!\n", nVis, frozenOutputSize());
+		exit(-1);
+	}
+
+	frozenLayer layer;
+	layer.nVisNum = nVis;
+	layer.nHidNum = nHid;
+	layer.binary = binary;
+	layer.mode = mode;
+	layer.weights = new floatType[nVis * nHid];
+	layer.hidBias = new floatType[nHid];
+	layer.output = new floatType[nHid * nDataPerBatch];
+	memcpy(layer.weights, weights, nVis * nHid * sizeof(floatType));
+	memcpy(layer.hidBias, hidBias, nHid * sizeof(floatType));
+	frozenLayers.push_back(layer);
+	return;
+}
+
+/*
+ * The same forward propagation as the positive phase of the RBM
+*/
+floatType* dataProvider::applyFrozenLayers(floatType* batch){
+	for(unsigned l = 0; l < frozenLayers.size(); l++){
+		frozenLayer& layer = frozenLayers[l];
+		gemmLayer('n', layer.nHidNum, nDataPerBatch, layer.nVisNum, layer.weights, layer.nHidNum, batch, layer.hidBias, layer.binary, layer.mode, layer.output, NULL, NULL);
+		batch = layer.output;
+	}
 	return batch;
 }
 
+void dataProvider::setShuffle(bool enable){
+	shuffle = enable;
+	return;
+}
+
 /*
- * This function is used for shuffling the vectors in the host buffer.
- * An extra buffer is allocated in the function and released before it terminates.
+ * The byte data is converted with the factors 1 and 0 instead of scale and offset when the
+ * normalization is off, the buffers loaded ahead are discarded.
 */
+void dataProvider::setNormalization(bool enable){
+	if(floatPoint || enable == (normScale == scale)){
+		return;
+	}
 
-void dataProvider::shuffleDataInBuffer(){
-	time_t t;
-	srand((unsigned)time(&t)); 
+	bool prefetching = prefetch;
+	unsigned numBuffer = nBufferNum;
+	stopPrefetch();
+	clearCache();
 
-	// the main loop of Knuth shuffling algorithm
-	for(unsigned i = 1; i < nBatchInBuffer * nDataPerBatch; i++){
-		//  return a pseudo-random integral number
-		unsigned j = rand() % i;
-		
-		// swap the contents of the elements p[i] and p[j]
-		shuffledId[i] = shuffledId[j];
-		shuffledId[j] = i;
+	if(enable){
+		delete[] normScale;
+		delete[] normOffset;
+		normScale = scale;
+		normOffset = offset;
 	}
-	
-	// allocate host memory for shuffling data
-	floatType* shuffleBuffer = new floatType[nBatchInBuffer * nDataPerBatch * nPixelPerData];
-	
-	// the main loop of shuffling data
-	for(unsigned i = 0; i < nBatchInBuffer * nDataPerBatch; i++){
-		floatType* dst = shuffleBuffer + shuffledId[i] * nPixelPerData;
-		floatType* src = batchDataBuffer + i * nPixelPerData;
-		memcpy((char*)dst, (char*)src, nPixelPerData * sizeof(floatType));
+	else{
+		normScale = new floatType[nPixelPerData];
+		normOffset = new floatType[nPixelPerData];
+		for(unsigned i = 0; i < nPixelPerData; i++){
+			normScale[i] = 1.0;
+			normOffset[i] = 0.0;
+		}
 	}
 
-	// copy the shuffled data back to the buffer
-	memcpy((char*)batchDataBuffer, (char*)shuffleBuffer, nBatchInBuffer * nDataPerBatch * nPixelPerData * sizeof(floatType));
+	reset();
+	if(prefetching){
+		startPrefetch(numBuffer);
+	}
+	return;
+}
 
-	// free the host memory for shuffling data
-	delete[] shuffleBuffer;
+/*
+ * A new permutation of the complete mini-batches in the buffer, the vectors after the last
+ * complete mini-batch of the data are never returned.
+*/
+void dataProvider::shuffleBuffer(){
+	unsigned nBatchInChunk = nBatchNum - currentBatchId;
+	nBatchInChunk = (nBatchInChunk > nBatchInBuffer) ? nBatchInBuffer : nBatchInChunk;
+	unsigned nVecInChunk = nBatchInChunk * nDataPerBatch;
+
+	// a new key for every buffer of every epoch
+	bufferShuffleKey++;
+	if(bufferPermutation->size() != nVecInChunk){
+		delete bufferPermutation;
+		bufferPermutation = new permutation(nVecInChunk, bufferShuffleKey);
+	}
+	else{
+		bufferPermutation->setKey(bufferShuffleKey);
+	}
+	return;
+}
 
+void dataProvider::getBatchIndex(unsigned localBatchId){
+	for(unsigned i = 0; i < nDataPerBatch; i++){
+		batchIndex[i] = bufferPermutation->backward(localBatchId * nDataPerBatch + i);
+	}
 	return;
 }
 
+#ifdef _AMD_GPU_
+
 /*
  * The constructor of the data provider for GPU, which is derived from the data provider for CPU.
 */
 dataProvider_GPU::dataProvider_GPU(CL_ENV env, string prefix, unsigned pixelperdata, unsigned batchSize, bool floatpoint)
 	:dataProvider(prefix, pixelperdata, batchSize, floatpoint){
+		initDevice(env);
+}
+
+/*
+ * The images of an MNIST data set are uploaded to the device once per epoch
+*/
+dataProvider_GPU::dataProvider_GPU(CL_ENV env, MNIST* mnist, unsigned batchSize)
+	:dataProvider(mnist, batchSize){
+		initDevice(env);
+}
+
+/*
+ * The device buffers and the kernels created by the provider
+*/
+dataProvider_GPU::~dataProvider_GPU(){
+	clReleaseMemObject(batchDataDeviceBuffer);
+	if(scaleDeviceBuffer != NULL){
+		clReleaseMemObject(scaleDeviceBuffer);
+		clReleaseMemObject(offsetDeviceBuffer);
+		clReleaseKernel(normalizeBytes);
+	}
+	clReleaseMemObject(batchIndexDeviceBuffer);
+	clReleaseKernel(gatherVectors);
+	clReleaseKernel(gatherNormalizeBytes);
+	if(frozenInputDeviceBuffer != NULL){
+		clReleaseMemObject(frozenInputDeviceBuffer);
+		clReleaseKernel(addBias);
+		clReleaseKernel(sigmoid);
+	}
+	for(unsigned l = 0; l < frozenWeightsDeviceBuffer.size(); l++){
+		clReleaseMemObject(frozenWeightsDeviceBuffer[l]);
+		clReleaseMemObject(frozenBiasDeviceBuffer[l]);
+	}
+	for(unsigned l = 0; l < frozenOutputDeviceBuffer.size(); l++){
+		clReleaseMemObject(frozenOutputDeviceBuffer[l]);
+	}
+}
+
+void dataProvider_GPU::initDevice(CL_ENV env){
 		// initialize the OpenCL environment
 		cl_env = env;
 		// create a device buffer on GPU
 		batchDataDeviceBuffer = clCreateBuffer(cl_env.ctx, CL_MEM_READ_WRITE, nBatchInBuffer * nDataPerBatch * nPixelPerData * sizeof(floatType), NULL, &cl_env.status);
 
+		// the buffers for the compact mode are created in useCompactBuffer()
+		scaleDeviceBuffer = NULL;
+		offsetDeviceBuffer = NULL;
+		normalizeBytes = NULL;
+
+		// the shuffled mini-batches are gathered by kernels
+		batchIndexDeviceBuffer = clCreateBuffer(cl_env.ctx, CL_MEM_READ_ONLY, nDataPerBatch * sizeof(unsigned int), NULL, &cl_env.status);
+		gatherVectors = clCreateKernel(cl_env.prog, "gatherVectors", &cl_env.status);
+		gatherNormalizeBytes = clCreateKernel(cl_env.prog, "gatherNormalizeBytes", &cl_env.status);
+		if(cl_env.status != CL_SUCCESS){
+			printf("Create the gather kernels failed");
+			exit(-1);
+		}
+
+		// the buffers of the frozen layers are created in addFrozenLayer()
+		frozenInputDeviceBuffer = NULL;
+		addBias = NULL;
+		sigmoid = NULL;
+}
+
+/*
+ * The output of a frozen layer is the input of the next one, the top layer writes
+ * into the batch of the RBM.
+*/
+void dataProvider_GPU::addFrozenLayer(unsigned nVis, unsigned nHid, const floatType* weights, const floatType* hidBias, bool binary, sigmoidMode mode){
+	dataProvider::addFrozenLayer(nVis, nHid, weights, hidBias, binary, mode);
+
+	if(frozenInputDeviceBuffer == NULL){
+		frozenInputDeviceBuffer = clCreateBuffer(cl_env.ctx, CL_MEM_READ_WRITE, nDataPerBatch * nPixelPerData * sizeof(floatType), NULL, &cl_env.status);
+		addBias = clCreateKernel(cl_env.prog, "addBias", &cl_env.status);
+		sigmoid = clCreateKernel(cl_env.prog, "sigmoid", &cl_env.status);
+		if(cl_env.status != CL_SUCCESS){
+			printf("Create the kernels of the frozen layers failed");
+			exit(-1);
+		}
+	}
+	else{
+		// the layer below is not the top one any more
+		unsigned nBelowHidNum = frozenLayers[frozenLayers.size() - 2].nHidNum;
+		frozenOutputDeviceBuffer.push_back(clCreateBuffer(cl_env.ctx, CL_MEM_READ_WRITE, nBelowHidNum * nDataPerBatch * sizeof(floatType), NULL, &cl_env.status));
+	}
+
+	frozenWeightsDeviceBuffer.push_back(clCreateBuffer(cl_env.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nVis * nHid * sizeof(floatType), (void*)frozenLayers.back().weights, &cl_env.status));
+	frozenBiasDeviceBuffer.push_back(clCreateBuffer(cl_env.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nHid * sizeof(floatType), (void*)frozenLayers.back().hidBias, &cl_env.status));
+	return;
+}
+
+/*
+ * The device buffer holds raw bytes in the compact mode, a mini-batch is normalized
+ * by a kernel when it is copied out of the device buffer.
+*/
+void dataProvider_GPU::useCompactBuffer(unsigned numBatchInBuffer){
+	if(compact || floatPoint){
+		return;
+	}
+	dataProvider::useCompactBuffer(numBatchInBuffer);
+
+	// replace the float-point device buffer with a byte one
+	clReleaseMemObject(batchDataDeviceBuffer);
+	batchDataDeviceBuffer = clCreateBuffer(cl_env.ctx, CL_MEM_READ_WRITE, nBatchInBuffer * nDataPerBatch * nPixelPerData * sizeof(unsigned char), NULL, &cl_env.status);
+
+	// the coefficients of the normalization
+	scaleDeviceBuffer = clCreateBuffer(cl_env.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nPixelPerData * sizeof(floatType), (void*)normScale, &cl_env.status);
+	offsetDeviceBuffer = clCreateBuffer(cl_env.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nPixelPerData * sizeof(floatType), (void*)normOffset, &cl_env.status);
+
+	normalizeBytes = clCreateKernel(cl_env.prog, "normalizeBytes", &cl_env.status);
+	if(cl_env.status != CL_SUCCESS){
+		printf("Create the normalizeBytes kernel failed");
+		exit(-1);
+	}
+	return;
+}
+
+void dataProvider_GPU::setNormalization(bool enable){
+	dataProvider::setNormalization(enable);
+
+	// the coefficients on the device are replaced in the compact mode
+	if(scaleDeviceBuffer != NULL){
+		cl_env.status = clEnqueueWriteBuffer(cl_env.queue, scaleDeviceBuffer, CL_TRUE, 0, nPixelPerData * sizeof(floatType), (void*)normScale, 0, NULL, NULL);
+		cl_env.status = clEnqueueWriteBuffer(cl_env.queue, offsetDeviceBuffer, CL_TRUE, 0, nPixelPerData * sizeof(floatType), (void*)normOffset, 0, NULL, NULL);
+	}
+	return;
 }
 
 /*
@@ -817,7 +1889,13 @@ dataProvider_GPU::dataProvider_GPU(CL_ENV env, string prefix, unsigned pixelperd
 */
 void dataProvider_GPU::loadDeviceBufferFromHost(){
 	
-	cl_env.status = clEnqueueWriteBuffer(cl_env.queue, batchDataDeviceBuffer, CL_TRUE, 0, nBatchInBuffer * nDataPerBatch * nPixelPerData * sizeof(floatType), (void*)batchDataBuffer, 0, NULL, NULL);
+	// only the loaded vectors are valid, the mapped file may end before the buffer is full
+	if(compact){
+		cl_env.status = clEnqueueWriteBuffer(cl_env.queue, batchDataDeviceBuffer, CL_TRUE, 0, nLoadedVecNum * nPixelPerData * sizeof(unsigned char), (void*)byteDataBuffer, 0, NULL, NULL);
+	}
+	else{
+		cl_env.status = clEnqueueWriteBuffer(cl_env.queue, batchDataDeviceBuffer, CL_TRUE, 0, nLoadedVecNum * nPixelPerData * sizeof(floatType), (void*)batchDataBuffer, 0, NULL, NULL);
+	}
 	if(cl_env.status != CL_SUCCESS){
 		printf("Load device buffer from host failed");
 		system("pause");
@@ -830,11 +1908,40 @@ void dataProvider_GPU::loadDeviceBufferFromHost(){
  * Copy the mini-batch to the destination cl_mem object.
  * The device buffer is seen as nBatchInBuffer slices of nDataPerBatch * nPixelPerData rectangles
 */
-void dataProvider_GPU::getNextDeviceBatch(cl_mem& batch)
+void dataProvider_GPU::getNextDeviceBatch(cl_mem& batch){
+	if(frozenLayers.empty()){
+		getNextInputDeviceBatch(batch);
+		return;
+	}
+
+	cl_mem input = frozenInputDeviceBuffer;
+	getNextInputDeviceBatch(input);
+	if(input == NULL){
+		batch = NULL;
+		return;
+	}
+
+	// the same forward propagation as the positive phase of RBM_GPU
+	for(unsigned l = 0; l < frozenLayers.size(); l++){
+		frozenLayer& layer = frozenLayers[l];
+		cl_mem output = (l + 1 == frozenLayers.size()) ? batch : frozenOutputDeviceBuffer[l];
+		gpu_addBias(cl_env, addBias, output, frozenBiasDeviceBuffer[l], layer.nHidNum, nDataPerBatch, NULL);
+		cl_env.status = clAmdBlasSgemm(cl_env.order, clAmdBlasNoTrans, clAmdBlasNoTrans, layer.nHidNum, nDataPerBatch, layer.nVisNum, 1.0,
+			frozenWeightsDeviceBuffer[l], layer.nHidNum, input, layer.nVisNum, 1.0, output, layer.nHidNum, 1, &cl_env.queue, 0, NULL, NULL);
+		if(layer.binary){
+			gpu_sigmoid(cl_env, sigmoid, output, layer.nHidNum * nDataPerBatch, NULL);
+		}
+		input = output;
+	}
+	return;
+}
+
+void dataProvider_GPU::getNextInputDeviceBatch(cl_mem& batch)
 {
 	// return NULL if the end of data is reached
 	if(currentBatchId >= nBatchNum){
 		batch = NULL;
+		return;
 	}
 
 	// the local index of the batch to be loaded in the buffer
@@ -844,17 +1951,36 @@ void dataProvider_GPU::getNextDeviceBatch(cl_mem& batch)
 	if(localBatchId == 0)
 	{
 		// load the batches from file to host memory
-		if(floatPoint){
-			loadFloatFileToBuffer();
-		}
-		else{
-			loadByteFileToBuffer();
+		loadNextBuffer();
+		if(shuffle){
+			shuffleBuffer();
 		}
 
 		// load the batches from host memory to device memory
 		loadDeviceBufferFromHost();
 	}
 
+	// gather the vectors of the batch into the dst cl_mem object
+	if(shuffle){
+		getBatchIndex(localBatchId);
+		cl_env.status = clEnqueueWriteBuffer(cl_env.queue, batchIndexDeviceBuffer, CL_TRUE, 0, nDataPerBatch * sizeof(unsigned int), (void*)batchIndex, 0, NULL, NULL);
+		if(compact){
+			gpu_gatherNormalizeBytes(cl_env, gatherNormalizeBytes, batch, batchDataDeviceBuffer, batchIndexDeviceBuffer, scaleDeviceBuffer, offsetDeviceBuffer, nPixelPerData, nDataPerBatch * nPixelPerData, NULL);
+		}
+		else{
+			gpu_gatherVectors(cl_env, gatherVectors, batch, batchDataDeviceBuffer, batchIndexDeviceBuffer, nPixelPerData, nDataPerBatch * nPixelPerData, NULL);
+		}
+		currentBatchId++;
+		return;
+	}
+
+	// normalize the bytes of the batch into the dst cl_mem object
+	if(compact){
+		gpu_normalizeBytes(cl_env, normalizeBytes, batch, batchDataDeviceBuffer, localBatchId * nDataPerBatch * nPixelPerData, scaleDeviceBuffer, offsetDeviceBuffer, nPixelPerData, nDataPerBatch * nPixelPerData, NULL);
+		currentBatchId++;
+		return;
+	}
+
 	size_t bufferOrigin[3], batchOrigin[3], region[3];
 
 	// the position of the batch in the device buffer
@@ -895,3 +2021,5 @@ void dataProvider_GPU::getNextDeviceBatch(cl_mem& batch)
 	return;
 
 }
+
+#endif
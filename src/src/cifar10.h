@@ -2,14 +2,19 @@
 #define _CIFAR10_H_
 
 #include "utils.h"
+#include "permutation.h"
+#include "simd.h"
 #include <string>
 #include <fstream>
+#include <pthread.h>
 
 void generateFileName(string* prefix, unsigned index, unsigned nDigitNum);
 string generateFileName(const string& prefix, unsigned index, unsigned nDigitNum);
 
 typedef unsigned char byte;
 
+class MNIST;
+
 class cifarPreProcessor
 {
 private:
@@ -24,15 +29,19 @@ private:
 	unsigned char* labels;
 	string rawDataFileName;
 	string patchDataFileName;
+
+	// the 81 windows x 3 channels of one image
+	void makeImagePatches(unsigned char* patch, unsigned char* raw);
 public:
 	cifarPreProcessor(string rawfile, string patchfile);
 	~cifarPreProcessor(){};
 
 	/*
 	 * Translate CIFAR-10 images to image patches.
+	 * numThreads is the number of threads generating the patches, 0 for all cores.
 	*/
 	void makePatchData();
-	void makePatchDataFiles();
+	void makePatchDataFiles(unsigned numThreads = 0);
 };
 
 /*
@@ -49,12 +58,20 @@ private:
 	unsigned 	vectorCountPerFile;		// the number of vectors in each file
 	unsigned	vectorLength;			// the length (in bytes) of each vector
 	
+	unsigned	medRecordLength;		// a vector and its 4-byte index in the output file
+
+	// the permutation, the ith vector moves to the position newGlobalIndex->forward(i)
+	permutation	*newGlobalIndex;
+	unsigned long long	shuffleKey;		// the key of the permutation, 0 for a key from the seed or the clock
+
 	// data buffers
-	unsigned	*newGlobalIndex;		// map the ith vector to the position of newIndex[i]
-	unsigned	*vecIndexInFile;		// the index of a vector in the corresponding file
-	unsigned	*fileIndex;				// the index of the file to which a vector belongs
 	byte		*inputBuffer;			// buffer for an input file
 	byte		*outputBuffer;			// buffer for an output file
+
+	// buckets of the single-pass scatter
+	unsigned	bucketVectorCount;		// the number of vectors in each bucket
+	unsigned	*bucketFill;			// the number of vectors in each bucket
+	byte		*bucketBuffer;			// one bucket for each medium file
 	
 	string 		inputPrefix;
 	string 		medPrefix;
@@ -63,27 +80,33 @@ private:
 	
 public:
 
-	datashuffler(const string& fileNamePrefix, unsigned numVec, unsigned numFile, unsigned vecLen);
+	datashuffler(const string& fileNamePrefix, unsigned numVec, unsigned numFile, unsigned vecLen, unsigned long long key = 0);
 	~datashuffler();
 	
 	/*
-	 * Generate a new permutation using Knuth shuffling algorithm.
-	 * Call this function to get newGlobalIndex, vecIndexInFile and fileIndex.
+	 * Generate a new permutation from shuffleKey, or from rngKey() if the key is 0.
+	 * Call this function to get newGlobalIndex.
 	*/
 	void genNewPerm(void);
 	/*
 	 * Read an input file from disk to the memory inputBuffer.
-	 * fname is the name of the input file.
+	 * fname is the name of the input file and recordLength the bytes per vector.
 	*/
-	void loadInputFile(const string& fname);
+	void loadInputFile(const string& fname, unsigned recordLength);
 	/*
-	 * The function generateMedFile() creates medium files
-	 * and form the mapping table src2med at the same time.
+	 * The function generateMedFile() creates medium files.
+	 * Each input file is read once, its vectors are scattered into the buckets
+	 * of their medium files, and the full buckets are appended to the files.
+	 * Each vector is followed by its index in the output file.
 	*/
 	void generateMedFile(void);
+	/*
+	 * Append the vectors in the bucket of a medium file to the file.
+	*/
+	void flushBucket(unsigned medId);
 	/*
 	 * Process the medium files to generate output files
-	 * with the help of src2med.
+	 * with the indices stored in the medium files.
 	*/
 	void procMedFile(void);
 
@@ -93,6 +116,18 @@ public:
 	void run(void);	
 };
 
+// a trained layer applied to the mini-batches, see dataProvider::addFrozenLayer()
+struct frozenLayer
+{
+	unsigned	nVisNum;		// the size of the input vectors
+	unsigned	nHidNum;		// the size of the output vectors
+	bool		binary;			// true if the sigmoid is applied to the output
+	sigmoidMode	mode;			// the accuracy of the sigmoid, that of the RBM the layer was trained in
+	floatType*	weights;		// nHidNum x nVisNum in column major, as in the RBM
+	floatType*	hidBias;
+	floatType*	output;			// the hidden probabilities of a mini-batch
+};
+
 class dataProvider
 {
 protected:
@@ -100,7 +135,9 @@ protected:
 	unsigned int nBatchNum; // total number of mini-batches
 	unsigned int nDataPerBatch; // total number of patch images in a mini-batch
 	unsigned int nDataPerFile; // total number of patch images in a file
+	unsigned int nDataNum; // total number of patch images in the training data
 	unsigned int nBatchInBuffer; // the number of mini-batches loaded in host memory
+	unsigned int nLoadedVecNum; // the number of vectors available in the buffer after the last loading
 	unsigned int currentDataId; // the patch index in all the training patch images
 	unsigned int currentBatchId; // the batch index
 	unsigned int currentFileId; // the file index
@@ -109,32 +146,237 @@ protected:
 	
 	floatType* 	mean;
 	floatType* 	variance;
+	floatType*	scale;		// 1 / (255 * variance), the per-pixel factor of the byte normalization
+	floatType*	offset;		// -mean / variance, the per-pixel offset of the byte normalization
+	floatType*	normScale;	// the factors applied while loading, scale or 1 if the normalization is off
+	floatType*	normOffset;	// the offsets applied while loading, offset or 0 if the normalization is off
 	floatType* 	batchDataBuffer;
-	unsigned*	shuffledId;
+	unsigned char*	byteStagingBuffer;	// the bytes of one bulk read from a patch file
+	unsigned	nStagingVecNum;			// the number of vectors in byteStagingBuffer
+	storageFormat	storage;			// the format of the values in the float-point file
+	unsigned char*	packedStagingBuffer;	// the 16-bit values or the bits of one bulk read from the float-point file
+	unsigned	nPackedStagingVecNum;		// the number of vectors in packedStagingBuffer
+
+	// the shuffling in buffer
+	bool		shuffle;			// true if the mini-batches are gathered from the buffer in a random order
+	permutation*	bufferPermutation;	// the order of the vectors in the buffer, re-keyed for each buffer
+	unsigned long long	bufferShuffleKey;
+	unsigned*	batchIndex;			// the buffer indices of the vectors in the next mini-batch
+	floatType*	shuffledBatch;		// the gathered mini-batch returned by getNextBatch()
+
+	// the compact mode for byte files
+	bool		compact;			// true if the buffer keeps the raw bytes and only the returned batch is normalized
+	unsigned char*	byteDataBuffer;	// the raw bytes of nBatchInBuffer mini-batches
+	floatType*	compactBatch;		// the normalized mini-batch returned by getNextBatch()
+
+	// the background prefetching mode
+	bool		prefetch;			// true if a loader thread fills the buffer ring in the background
+	unsigned	nBufferNum;			// the number of host buffers in the ring
+	char**		bufferRing;			// the host buffers
+	char**		bufferData;			// the data of each slot, its buffer or a cached chunk, batchDataBuffer (or byteDataBuffer) points to the one being consumed
+	volatile int*	bufferState;	// BUFFER_EMPTY or BUFFER_FULL for each buffer in the ring
+	unsigned	consumerSlot;		// the ring slot read by the trainer
+	unsigned	loaderSlot;			// the ring slot to be filled next by the loader thread
+	unsigned	loaderChunkId;		// the index of the next buffer-sized chunk of an epoch to be loaded
+	bool		consumerHoldsSlot;	// true if the trainer still reads from bufferRing[consumerSlot]
+	volatile int	loaderStop;		// set to 1 to terminate the loader thread
+	pthread_t	loaderThread;
+
+	// the memory-mapped mode for float-point files, also used for the data in memory
+	bool		mapped;				// true if batches are handed out directly from the mapped file
+	floatType*	mappedData;			// the first vector of the mapped file
+	size_t		mappedSize;			// the size of the mapping in bytes
+	int			mappedFd;			// the file descriptor of the mapped file, -1 for the data in memory
+
+	// the retina vectors made from the raw images while loading
+	bool		rawImages;			// true if the vectors are made from the raw images instead of the patch files
+	unsigned char*	rawImageData;	// the mapped raw image file
+	size_t		rawImageSize;		// the size of the mapping in bytes
+	int			rawImageFd;			// the file descriptor of the raw image file
+	unsigned	nRawImageNum;		// the number of images in the file
+	permutation*	imagePermutation;	// the order of the images, re-keyed for each epoch
+	unsigned long long	imageShuffleKey;
+
+	// the chunks of the data kept in memory across the epochs
+	size_t		cacheBudget;		// the maximum bytes of the cached chunks, 0 if the cache is off
+	size_t		cacheBytes;			// the bytes of the cached chunks
+	vector<char*>	cacheChunk;		// the copy of each buffer-sized chunk of an epoch, NULL if not cached
+	vector<unsigned>	cacheVecNum;	// the number of vectors in each cached chunk
+	unsigned	cacheHits;			// the chunks served from the cache in this epoch
+	unsigned	cacheMisses;		// the chunks loaded from the files in this epoch
+
+	// the trained lower layers in front of the data
+	vector<frozenLayer>	frozenLayers;
+
+	// the constructors share this, data is NULL for the files or the first vector of the data in memory
+	void init(string prefix, unsigned pixelperdata, unsigned batchSize, bool floatpoint, unsigned dataNum, floatType* data);
+
+	// the size in bytes of a host buffer
+	size_t bufferBytes();
+	// fill a host buffer with the next nBatchInBuffer mini-batches, return the buffer or the cached chunk holding them
+	char* loadBuffer(char* buffer);
+	// read the next nBatchInBuffer mini-batches from the patch files, see loadByteFileToBuffer()
+	void readByteFiles(unsigned char* raw, floatType* buffer);
+	// make the next nBatchInBuffer mini-batches from the raw images
+	void loadRetinaBuffer(char* buffer);
+	// the cached chunk, NULL if the chunk is not cached
+	char* loadCachedChunk(unsigned chunkId);
+	// keep a copy of the chunk just loaded while the budget allows it
+	void cacheLoadedChunk(unsigned chunkId, char* buffer);
+	// drop all the cached chunks when the content of the buffers changes
+	void clearCache();
+	// make batchDataBuffer point to the next buffer-sized chunk of the training data
+	void loadNextBuffer();
+	// free the buffers of the ring except the first one
+	void releaseBufferRing();
+	// make batchDataBuffer point to the next chunk of the mapped file
+	void loadMappedBuffer();
+	// draw a new order of the vectors in the buffer just loaded
+	void shuffleBuffer();
+	// fill batchIndex for the mini-batch localBatchId of the buffer
+	void getBatchIndex(unsigned localBatchId);
+	// forward-propagate a mini-batch through the frozen layers, return the output of the top one
+	floatType* applyFrozenLayers(floatType* batch);
+	// the size of the vectors handed out, the output of the top frozen layer or nPixelPerData
+	unsigned frozenOutputSize();
+	// the main loop of the loader thread
+	void loaderLoop();
+	static void* loaderEntry(void* provider);
 
 public:
 	dataProvider(string prefix, unsigned pixelperdata, unsigned batchSize, bool floatpoint);
+	dataProvider(MNIST* mnist, unsigned batchSize);
+	virtual ~dataProvider();
 	void reset();
 	void getExpectation();
 	void getStat();
-	void loadFloatFileToBuffer();
-	void loadByteFileToBuffer();
-	void shuffleDataInBuffer();
+	void loadFloatFileToBuffer(floatType* buffer);
+	void loadByteFileToBuffer(floatType* buffer);
+	void loadRawByteFileToBuffer(unsigned char* buffer);
+	/*
+	 * Shuffle the vectors within each host buffer, on by default. Only the order is shuffled,
+	 * the vectors of a mini-batch are gathered from the buffer when the batch is requested.
+	*/
+	void setShuffle(bool enable);
+	inline bool getShuffle(){return shuffle;};
+	/*
+	 * Start a loader thread which fills numBuffer host buffers ahead of the trainer.
+	 * The data is rewound to the beginning. The loader wraps around at the end of the
+	 * data, so consecutive epochs are prefetched without stalls as long as the trainer 
+	 * consumes whole epochs between the calls of reset().
+	*/
+	void startPrefetch(unsigned numBuffer);
+	void stopPrefetch();
+	inline bool isPrefetching(){return prefetch;};
+	/*
+	 * Map the float-point file into memory instead of copying it into host buffers.
+	 * The host buffers are released and getNextBatch() returns pointers into the mapping.
+	 * Only for the float-point provider, i.e. the BB-RBM layers.
+	*/
+	void mapFloatFile();
+	/*
+	 * Keep the byte data in the host buffer as it is in the files and normalize only the
+	 * mini-batch handed to the trainer. numBatchInBuffer is the new buffer size in batches,
+	 * 0 selects four times the float-point buffer, which takes the same memory.
+	 * Only for the byte provider, i.e. the GB-RBM layer and the autoencoder.
+	*/
+	virtual void useCompactBuffer(unsigned numBatchInBuffer);
+	/*
+	 * Make the retina vectors from the raw images while the buffers are loaded instead of
+	 * reading them from the patch files, so makePatchDataFiles() and datashuffler are not needed.
+	 * rawFile holds 3072-byte images as written for makePatchDataFiles(). Every epoch visits the
+	 * images in a new random order and yields all 81 windows x 3 channels of each image.
+	 * Only for the byte provider of 336-byte vectors. Call getExpectation() and getStat()
+	 * afterwards if the statistics are not computed yet.
+	*/
+	void useRawImages(string rawFile);
+	/*
+	 * Hand out the byte data as it is (0 to 255 as float-point) if enable is false, so the
+	 * normalization x * scale + offset can be folded into the first layer, see RBM::foldNormalization().
+	 * Only for the byte provider, the normalization is on by default.
+	*/
+	virtual void setNormalization(bool enable);
+	/*
+	 * Keep up to budget bytes of the loaded buffers in memory, so the following epochs read
+	 * them from memory instead of the files. The chunks of the first epoch are kept until the budget
+	 * is full and never evicted: the epochs read the chunks in order, so an LRU cache smaller than
+	 * the data would evict every chunk just before it is needed. With prefetching a cached chunk is
+	 * handed out in place, without a copy. The hits and misses are printed for each epoch.
+	 * 0 turns the cache off, which is the default.
+	 * The chunks are cached as they are in the buffer, i.e. normalized or raw in the compact mode.
+	 * Not for the mapped data, which is in the page cache already, or for the raw images,
+	 * which are sampled differently in each epoch.
+	*/
+	void setCacheBudget(size_t budget);
+	/*
+	 * Read the float-point file as 16-bit values or bits of the format, see RBM::transform(). The values
+	 * are converted to float-point while loading. STORAGE_FLOAT32 is the default.
+	 * STORAGE_BITS needs vectors of a multiple of 8 values.
+	 * Only for the float-point provider reading the file, not for the mapped data or the data in memory.
+	*/
+	void setStorageFormat(storageFormat format);
+	/*
+	 * Forward-propagate the mini-batches through a trained layer before they are handed out,
+	 * so the next layer of a DBN is trained without writing and reading the hidden probabilities.
+	 * The weights and the biases are copied, so the layer is frozen and may be deleted afterwards.
+	 * The layers are stacked in the order they are added, nVis is the size of the vectors of
+	 * the data or the nHid of the last layer added. The layer sees the normalized vectors.
+	 * The CPU sigmoid of the layer has the accuracy mode, the GPU kernels have their own.
+	*/
+	virtual void addFrozenLayer(unsigned nVis, unsigned nHid, const floatType* weights, const floatType* hidBias, bool binary, sigmoidMode mode = SIGMOID_POLY);
+	inline floatType* getScale(){return scale;};
+	inline floatType* getOffset(){return offset;};
 	inline unsigned int getBatchNum(){return nBatchNum;};
 	floatType* getNextBatch();
 
 };
 
+#ifdef _AMD_GPU_
+
 class dataProvider_GPU : public dataProvider{
 private:
 	CL_ENV cl_env;
 	cl_mem batchDataDeviceBuffer;
 
+	// the normalization on the device in the compact mode
+	cl_mem scaleDeviceBuffer;
+	cl_mem offsetDeviceBuffer;
+	cl_kernel normalizeBytes;
+
+	// the gathering of the shuffled mini-batch on the device
+	cl_mem batchIndexDeviceBuffer;
+	cl_kernel gatherVectors;
+	cl_kernel gatherNormalizeBytes;
+
+	// the frozen layers on the device
+	cl_mem frozenInputDeviceBuffer;		// the mini-batch of the data before the frozen layers
+	vector<cl_mem> frozenWeightsDeviceBuffer;
+	vector<cl_mem> frozenBiasDeviceBuffer;
+	vector<cl_mem> frozenOutputDeviceBuffer;	// the output of each frozen layer but the top one
+	cl_kernel addBias;
+	cl_kernel sigmoid;
+
+	// fill batch with the next mini-batch of the data
+	void getNextInputDeviceBatch(cl_mem& batch);
+
+	// create the device buffers and the kernels
+	void initDevice(CL_ENV env);
+
 public:
 	dataProvider_GPU(CL_ENV env, string prefix, unsigned pixelperdata, unsigned batchSize, bool floatpoint);
+	dataProvider_GPU(CL_ENV env, MNIST* mnist, unsigned batchSize);
+	~dataProvider_GPU();
+	// the raw bytes are uploaded and normalized on the device into the destination batch
+	void useCompactBuffer(unsigned numBatchInBuffer);
+	// the coefficients on the device follow the host
+	void setNormalization(bool enable);
+	// the weights are uploaded, the frozen layers run on the device
+	void addFrozenLayer(unsigned nVis, unsigned nHid, const floatType* weights, const floatType* hidBias, bool binary, sigmoidMode mode = SIGMOID_POLY);
 	void loadDeviceBufferFromHost();
 	void getNextDeviceBatch(cl_mem&);
 };
 
+#endif
+
 
 #endif
@@ -1,6 +1,11 @@
 #!/bin/bash
 
-g++ -I /opt/acml5.3.1/ifort64_fma4_mp/include/ -I /opt/AMDAPP/include -I /opt/clAmdBlas-1.10.321/include/ -L /opt/acml5.3.1/ifort64_fma4_mp/lib/ -L /opt/AMDAPP/lib/x86_64 -L /opt/clAmdBlas-1.10.321/lib64/ main.cpp cifar10.cpp mnist.cpp rbm.cpp rbm_gpu.cpp autoencoder.cpp autoencoder_gpu.cpp utils.cpp -l OpenCL -l clAmdBlas -l acml_mp -l iomp5 -o ../bin/autoencoder
+g++ -std=c++11 -fopenmp -DGEMM_ACML -I /opt/acml5.3.1/ifort64_fma4_mp/include/ -I /opt/AMDAPP/include -I /opt/clAmdBlas-1.10.321/include/ -L /opt/acml5.3.1/ifort64_fma4_mp/lib/ -L /opt/AMDAPP/lib/x86_64 -L /opt/clAmdBlas-1.10.321/lib64/ main.cpp cifar10.cpp mnist.cpp rbm.cpp rbm_gpu.cpp autoencoder.cpp autoencoder_gpu.cpp utils.cpp simd.cpp retina.cpp permutation.cpp asyncwriter.cpp pipeline.cpp gemm.cpp rng.cpp -l OpenCL -l clAmdBlas -l acml_mp -l iomp5 -l pthread -o ../bin/autoencoder
 
+# the CPU implementation alone, without OpenCL and clAmdBlas, the GEMM backend is chosen with
+# -DGEMM_OPENBLAS, -DGEMM_BLIS (-l blis), -DGEMM_MKL (-l mkl_rt) or -DGEMM_ACML, see gemm.h
+g++ -std=c++11 -O2 -fopenmp -DCPU_ONLY -DGEMM_OPENBLAS main.cpp cifar10.cpp mnist.cpp rbm.cpp autoencoder.cpp utils.cpp simd.cpp retina.cpp permutation.cpp asyncwriter.cpp pipeline.cpp gemm.cpp rng.cpp -l openblas -l pthread -o ../bin/autoencoder_cpu
+
+g++ -std=c++11 -O2 -fopenmp -DCPU_ONLY -DGEMM_OPENBLAS benchmark.cpp simd.cpp retina.cpp gemm.cpp rng.cpp utils.cpp -l openblas -l pthread -o ../bin/benchmark
 
 #g++ -Wall shuffledata.cpp -o ../bin/shuffledata
@@ -0,0 +1,250 @@
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<pthread.h>
+#include "gemm.h"
+
+#if defined(GEMM_OPENBLAS) && defined(GEMM_MKL)
+#error "GEMM_OPENBLAS and GEMM_MKL both define cblas_sgemm, choose one of them"
+#endif
+
+#ifdef GEMM_OPENBLAS
+#include<cblas.h>
+#endif
+
+#ifdef GEMM_MKL
+#include<mkl_cblas.h>
+#endif
+
+#ifdef GEMM_BLIS
+#include<blis.h>
+#endif
+
+#ifdef GEMM_ACML
+#include<acml.h>
+#endif
+
+static bool isTransposed(char trans){
+	return trans == 't' || trans == 'T';
+}
+
+/*
+ * The reference implementation, one column of c per iteration over the threads.
+ * The column j of op(b) is copied and scaled by alpha first, then
+ * - for op(a) = a the columns of a are added to the column of c, skipping the zeros of op(b),
+ *   which are many for the binary states of the hidden units
+ * - for op(a) = a' each entry of the column of c is the dot product of a column of a
+*/
+static void gemmReference(char transa, char transb, int m, int n, int k, floatType alpha, const floatType* a, int lda, const floatType* b, int ldb, floatType beta, floatType* c, int ldc){
+	bool ta = isTransposed(transa);
+	bool tb = isTransposed(transb);
+
+	#pragma omp parallel
+	{
+		floatType* bj = new floatType[k > 0 ? k : 1];
+
+		#pragma omp for
+		for(int j = 0; j < n; j++){
+			floatType* cj = c + (size_t)j * ldc;
+
+			for(int l = 0; l < k; l++){
+				bj[l] = alpha * (tb ? b[j + (size_t)l * ldb] : b[l + (size_t)j * ldb]);
+			}
+
+			if(beta == 0){
+				memset(cj, 0, m * sizeof(floatType));
+			}
+			else if(beta != 1){
+				for(int i = 0; i < m; i++){
+					cj[i] *= beta;
+				}
+			}
+
+			if(!ta){
+				for(int l = 0; l < k; l++){
+					floatType s = bj[l];
+					if(s == 0){
+						continue;
+					}
+					const floatType* al = a + (size_t)l * lda;
+					for(int i = 0; i < m; i++){
+						cj[i] += al[i] * s;
+					}
+				}
+			}
+			else{
+				for(int i = 0; i < m; i++){
+					const floatType* ai = a + (size_t)i * lda;
+					floatType s = 0;
+					#pragma omp simd reduction(+:s)
+					for(int l = 0; l < k; l++){
+						s += ai[l] * bj[l];
+					}
+					cj[i] += s;
+				}
+			}
+		}
+
+		delete[] bj;
+	}
+	return;
+}
+
+void gemm(char transa, char transb, int m, int n, int k, floatType alpha, const floatType* a, int lda, const floatType* b, int ldb, floatType beta, floatType* c, int ldc, gemmBackend backend){
+	switch(backend){
+#if defined(GEMM_OPENBLAS) || defined(GEMM_MKL)
+	case GEMM_BACKEND_OPENBLAS:
+	case GEMM_BACKEND_MKL:
+		cblas_sgemm(CblasColMajor, isTransposed(transa) ? CblasTrans : CblasNoTrans, isTransposed(transb) ? CblasTrans : CblasNoTrans, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+		return;
+#endif
+#ifdef GEMM_BLIS
+	case GEMM_BACKEND_BLIS:
+		// the typed API of BLIS takes the row and the column strides of each matrix
+		bli_sgemm(isTransposed(transa) ? BLIS_TRANSPOSE : BLIS_NO_TRANSPOSE, isTransposed(transb) ? BLIS_TRANSPOSE : BLIS_NO_TRANSPOSE, m, n, k, &alpha, (float*)a, 1, lda, (float*)b, 1, ldb, &beta, c, 1, ldc);
+		return;
+#endif
+#ifdef GEMM_ACML
+	case GEMM_BACKEND_ACML:
+		sgemm(transa, transb, m, n, k, alpha, (float*)a, lda, (float*)b, ldb, beta, c, ldc);
+		return;
+#endif
+	default:
+		gemmReference(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+		return;
+	}
+}
+
+void gemm(char transa, char transb, int m, int n, int k, floatType alpha, const floatType* a, int lda, const floatType* b, int ldb, floatType beta, floatType* c, int ldc){
+	gemm(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, gemmSelected());
+	return;
+}
+
+bool gemmAvailable(gemmBackend backend){
+	switch(backend){
+	case GEMM_BACKEND_REFERENCE:
+		return true;
+#ifdef GEMM_OPENBLAS
+	case GEMM_BACKEND_OPENBLAS:
+		return true;
+#endif
+#ifdef GEMM_BLIS
+	case GEMM_BACKEND_BLIS:
+		return true;
+#endif
+#ifdef GEMM_MKL
+	case GEMM_BACKEND_MKL:
+		return true;
+#endif
+#ifdef GEMM_ACML
+	case GEMM_BACKEND_ACML:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* gemmName(gemmBackend backend){
+	static const char* names[GEMM_BACKEND_NUM] = {"reference", "openblas", "blis", "mkl", "acml"};
+
+	if(backend < 0 || backend >= GEMM_BACKEND_NUM){
+		return "unknown";
+	}
+	return names[backend];
+}
+
+static int selected = -1;
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * The first library compiled in, unless RBM_GEMM names another backend compiled in,
+ * chosen once even when the pipeline threads ask at the same time
+*/
+static void selectBackend(){
+	int backend = GEMM_BACKEND_REFERENCE;
+	for(int i = GEMM_BACKEND_NUM - 1; i > GEMM_BACKEND_REFERENCE; i--){
+		if(gemmAvailable((gemmBackend)i)){
+			backend = i;
+		}
+	}
+
+	const char* name = getenv("RBM_GEMM");
+	if(name != NULL){
+		int i = 0;
+		while(i < GEMM_BACKEND_NUM && strcmp(name, gemmName((gemmBackend)i)) != 0){
+			i++;
+		}
+		if(i < GEMM_BACKEND_NUM && gemmAvailable((gemmBackend)i)){
+			backend = i;
+		}
+		else{
+			printf("RBM_GEMM=%s is not compiled in, using %s\n", name, gemmName((gemmBackend)backend));
+		}
+	}
+	__atomic_store_n(&selected, backend, __ATOMIC_RELEASE);
+	return;
+}
+
+gemmBackend gemmSelected(){
+	pthread_once(&selectOnce, selectBackend);
+	return (gemmBackend)__atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+}
+
+void setGemmBackend(gemmBackend backend){
+	if(!gemmAvailable(backend)){
+		printf("The GEMM backend %s is not compiled in\n", gemmName(backend));
+		exit(-1);
+	}
+	// the choice from the environment must not replace this one later
+	pthread_once(&selectOnce, selectBackend);
+	__atomic_store_n(&selected, (int)backend, __ATOMIC_RELEASE);
+	return;
+}
+
+/*
+ * The vectors of a tile of gemmLayer() fill about 256 KB, which stays in the L2 cache.
+ * Narrower tiles make the BLAS libraries slower than the passes they save.
+*/
+static const int nLayerTileValue = 65536;
+
+double gemmLayer(char transw, int nOut, int nVec, int nIn, const floatType* w, int ldw, const floatType* in, const floatType* bias, bool activate, sigmoidMode mode, floatType* out, floatType* sum, const floatType* target){
+	int nTile = nLayerTileValue / nOut;
+	nTile = (nTile < 8) ? 8 : nTile - nTile % 8;
+	double error = 0;
+
+	if(sum != NULL){
+		memset(sum, 0, nOut * sizeof(floatType));
+	}
+
+	for(int first = 0; first < nVec; first += nTile){
+		int nCol = (nVec - first < nTile) ? nVec - first : nTile;
+		floatType* tile = out + (size_t)first * nOut;
+		gemm(transw, 'n', nOut, nCol, nIn, 1.0, w, ldw, in + (size_t)first * nIn, nIn, 0.0, tile, nOut);
+
+		for(int j = 0; j < nCol; j++){
+			floatType* col = tile + (size_t)j * nOut;
+			for(int i = 0; i < nOut; i++){
+				col[i] += bias[i];
+			}
+			if(activate){
+				sigmoid(col, nOut, mode);
+			}
+			if(sum != NULL){
+				for(int i = 0; i < nOut; i++){
+					sum[i] += col[i];
+				}
+			}
+			if(target != NULL){
+				const floatType* t = target + (size_t)(first + j) * nOut;
+				floatType e = 0;
+				for(int i = 0; i < nOut; i++){
+					floatType d = col[i] - t[i];
+					e += d * d;
+				}
+				error += e;
+			}
+		}
+	}
+	return error;
+}
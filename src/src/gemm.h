@@ -0,0 +1,57 @@
+#ifndef _GEMM_H_
+#define _GEMM_H_
+
+#include "simd.h"
+
+/*
+ * The matrix multiplication of the CPU implementation, behind one interface for several BLAS libraries.
+ * The backends are chosen when compiling with -DGEMM_OPENBLAS, -DGEMM_BLIS, -DGEMM_MKL or -DGEMM_ACML,
+ * the reference implementation is always compiled in. The first library compiled in is used by default,
+ * the environment variable RBM_GEMM (reference, openblas, blis, mkl or acml) overrides it at run time.
+ * This header does not depend on ACML or OpenCL, so the backends can be benchmarked alone.
+*/
+
+// the libraries the multiplication can be dispatched to
+enum gemmBackend
+{
+	GEMM_BACKEND_REFERENCE = 0,
+	GEMM_BACKEND_OPENBLAS = 1,
+	GEMM_BACKEND_BLIS = 2,
+	GEMM_BACKEND_MKL = 3,
+	GEMM_BACKEND_ACML = 4,
+	GEMM_BACKEND_NUM = 5
+};
+
+/*
+ * c = alpha * op(a) * op(b) + beta * c with column major matrices, op(a) is m x k, op(b) is k x n.
+ * The arguments are those of the BLAS sgemm, transa and transb are 'n' or 't'.
+ * With beta = 0 the input values of c are not read.
+*/
+void gemm(char transa, char transb, int m, int n, int k, floatType alpha, const floatType* a, int lda, const floatType* b, int ldb, floatType beta, floatType* c, int ldc);
+
+// the same multiplication with a given backend, used by the benchmark
+void gemm(char transa, char transb, int m, int n, int k, floatType alpha, const floatType* a, int lda, const floatType* b, int ldb, floatType beta, floatType* c, int ldc, gemmBackend backend);
+
+// return the backend used by gemm()
+gemmBackend gemmSelected();
+
+// use the backend for the following calls of gemm(), which must be compiled in
+void setGemmBackend(gemmBackend backend);
+
+// whether the backend is compiled in
+bool gemmAvailable(gemmBackend backend);
+
+// the name of the backend, as in RBM_GEMM
+const char* gemmName(gemmBackend backend);
+
+/*
+ * One layer of the forward propagation, out = sigmoid(op(w) * in + bias) for nVec vectors, where op(w) is
+ * nOut x nIn: w for transw = 'n', or the transpose of the nIn x nOut w for 't' as in the negative phase.
+ * in and out hold the vectors one after another. The product is computed a few vectors at a time and
+ * the bias, the sigmoid (if activate), the sum and the error are applied while those vectors are in cache:
+ * - sum[i] is the sum of out[i] over the vectors, skipped if sum is NULL
+ * - the return value is the sum of (out - target)^2, 0 if target is NULL
+*/
+double gemmLayer(char transw, int nOut, int nVec, int nIn, const floatType* w, int ldw, const floatType* in, const floatType* bias, bool activate, sigmoidMode mode, floatType* out, floatType* sum, const floatType* target);
+
+#endif
@@ -795,6 +795,57 @@ __kernel void reset(
 	}
 }
 
+__kernel void normalizeBytes(
+	__global floatType* dst,
+	__global const uchar* src,
+	unsigned int srcOffset,
+	__global floatType* scale,
+	__global floatType* offset,
+	unsigned int nPixel,
+	unsigned int n
+	){
+	unsigned int index = get_global_id(0);
+	if(index < n){
+		unsigned int pixel = index % nPixel;
+		dst[index] = src[srcOffset + index] * scale[pixel] + offset[pixel];
+	}
+	return;
+}
+
+__kernel void gatherVectors(
+	__global floatType* dst,
+	__global floatType* src,
+	__global const unsigned int* index,
+	unsigned int nPixel,
+	unsigned int n
+	){
+	unsigned int gid = get_global_id(0);
+	if(gid < n){
+		unsigned int vec = gid / nPixel;
+		unsigned int pixel = gid % nPixel;
+		dst[gid] = src[index[vec] * nPixel + pixel];
+	}
+	return;
+}
+
+__kernel void gatherNormalizeBytes(
+	__global floatType* dst,
+	__global const uchar* src,
+	__global const unsigned int* index,
+	__global floatType* scale,
+	__global floatType* offset,
+	unsigned int nPixel,
+	unsigned int n
+	){
+	unsigned int gid = get_global_id(0);
+	if(gid < n){
+		unsigned int vec = gid / nPixel;
+		unsigned int pixel = gid % nPixel;
+		dst[gid] = src[index[vec] * nPixel + pixel] * scale[pixel] + offset[pixel];
+	}
+	return;
+}
+
 __kernel void addBias(
 	__global floatType* prob,
 	__global floatType* bias,
@@ -851,6 +902,53 @@ __kernel void sigmoid(
 	return;
 }
 
+/*
+ * Convert n values to 16-bit values rounded to the nearest even, fp16 if bf16 is 0 and bf16 otherwise.
+ * The results are the same as those of floatToHalf() on the host.
+*/
+__kernel void floatToHalf(
+	__global ushort* dst,
+	__global floatType* src,
+	unsigned int bf16,
+	unsigned int n
+	){
+	unsigned int index = get_global_id(0);
+	if(index < n){
+		if(bf16){
+			uint bits = as_uint(src[index]);
+			if((bits & 0x7fffffff) > 0x7f800000){
+				dst[index] = (ushort)((bits >> 16) | 0x40);
+			}
+			else{
+				dst[index] = (ushort)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+			}
+		}
+		else{
+			vstore_half_rte(src[index], index, (__global half*)dst);
+		}
+	}
+	return;
+}
+
+/*
+ * Pack 8 binary values into each of the n bytes, bit j of dst[i] is 1 if src[8i + j] > 0.5
+*/
+__kernel void packBits(
+	__global uchar* dst,
+	__global floatType* src,
+	unsigned int n
+	){
+	unsigned int index = get_global_id(0);
+	if(index < n){
+		uchar byte = 0;
+		for(unsigned int j = 0; j < 8; j++){
+			byte |= (src[8 * index + j] > 0.5f) << j;
+		}
+		dst[index] = byte;
+	}
+	return;
+}
+
 __kernel void squareError(
 	__global floatType* a,
 	__global floatType* b,
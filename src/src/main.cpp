@@ -1,4 +1,5 @@
 #include "rbm.h"
+#include "pipeline.h"
 #include "autoencoder.h"
 #include "mnist.h"
 #include "cifar10.h"
@@ -73,21 +74,47 @@ int main(void)
 	// dsl->run();
 	// delete dsl;
 
+#ifdef _AMD_GPU_
+	// MNIST as an end-to-end benchmark of the training pipeline
+	//MNIST* mnist = new MNIST("../data/train-images-idx3-ubyte", "../data/train-labels-idx1-ubyte");
+	//mnist->loadData();
+	//RBM_GPU* rbmMnist = new RBM_GPU(0, 784, 500, false, 10, 60000 / 100, 100, 0.1, 0.5, 0.9, "mnist");
+	//rbmMnist->dataprovider = new dataProvider_GPU(rbmMnist->gpu_env, mnist, 100);
+	//rbmMnist->train();
+	//delete rbmMnist;
+	//delete mnist;
+
 	//RBM_GPU* rbm0 = new RBM_GPU(0, 336, 1024, true, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "first");
 	//rbm0->dataprovider = new dataProvider_GPU(rbm0->gpu_env, inputFile0, 336, 128, false);
+	// or make the patches from the raw images while training, without the patch files
+	//rbm0->dataprovider->useRawImages(rawfile);
+	//rbm0->dataprovider->useCompactBuffer(0);
 	//rbm0->dataprovider->getExpectation();
 	//rbm0->train();
 	//rbm0->test();
+	// or write the probabilities in 16 bits, which halves the file and the reading of the next layer
+	//rbm0->transform(inputFile1, STORAGE_FP16);
+	// or feed the second layer from the first one batch by batch without the file
+	//RBM_GPU* rbm1 = new RBM_GPU(0, 1024, 512, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "second");
+	//rbm1->dataprovider = new dataProvider_GPU(rbm1->gpu_env, inputFile0, 336, 128, false);
+	//rbm0->freezeInto(rbm1->dataprovider);
+	//rbm1->train();
 	//delete rbm0;
 
 	RBM_GPU* rbm1 = new RBM_GPU(0, 1024, 512, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "second");
 	rbm1->dataprovider = new dataProvider_GPU(rbm1->gpu_env, inputFile1, 1024, 128, true);
+	// the 16-bit file is converted while loading instead of being mapped
+	//rbm1->dataprovider->setStorageFormat(STORAGE_FP16);
+	rbm1->dataprovider->mapFloatFile();
 	rbm1->train();
 	rbm1->test();
 	delete rbm1;
 
 	RBM_GPU* rbm2 = new RBM_GPU(0, 512, 256, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "third");
 	rbm2->dataprovider = new dataProvider_GPU(rbm2->gpu_env, inputFile2, 512, 128, true);
+	// or the sampled states written by rbm1->transform(inputFile2, STORAGE_BITS), 32 times smaller
+	//rbm2->dataprovider->setStorageFormat(STORAGE_BITS);
+	rbm2->dataprovider->mapFloatFile();
 	rbm2->train();
 	rbm2->test();
 	delete rbm2;
@@ -97,9 +124,32 @@ int main(void)
 	//rbm3->train();
 	//delete rbm3;
 
+	// or train the layers at the same time, the layers above the first one need no data provider
+	//RBM_GPU* layer0 = new RBM_GPU(0, 336, 1024, true, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "first");
+	//layer0->dataprovider = new dataProvider_GPU(layer0->gpu_env, inputFile0, 336, 128, false);
+	//rbmPipeline* dbn = new rbmPipeline(nBatchNum / 10);
+	//dbn->addLayer(layer0);
+	//dbn->addLayer(new RBM_GPU(0, 1024, 512, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "second"));
+	//dbn->addLayer(new RBM_GPU(0, 512, 256, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "third"));
+	//dbn->addLayer(new RBM_GPU(0, 256, 128, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "fourth"));
+	//dbn->train();
+	//delete dbn;
+
 	//autoencoder_GPU* ae = new autoencoder_GPU;
 	//ae->dataprovider = new dataProvider_GPU(ae->gpu_env, inputFile0, 336, 128, false);
 	//ae->train();
+#else
+	// the CPU implementation, the matrix products use the backend of gemm.h
+	RBM* rbm1 = new RBM(1024, 512, false, 80, nBatchNum, 128, 0.0002, 0.9, 0.9, "second");
+	rbm1->dataprovider = new dataProvider(inputFile1, 1024, 128, true);
+	rbm1->dataprovider->mapFloatFile();
+	// the vectorized exp() is the default, the table is less accurate and faster on CPUs without AVX2
+	//rbm1->setSigmoidMode(SIGMOID_TABLE);
+	rbm1->train();
+	rbm1->transform(inputFile2);
+	delete rbm1->dataprovider;
+	delete rbm1;
+#endif
 
 	return 0;
 }
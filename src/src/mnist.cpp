@@ -1,49 +1,46 @@
 #include "mnist.h"
+#include "simd.h"
+#include "rng.h"
+#include<cstring>
 
-bool cmp(Pair a, Pair b){
-	return a.seed < b.seed;
+/*
+ * Read a big-endian 32-bit integer of an IDX header
+*/
+static unsigned int readBigEndian(const byte* p){
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
 }
 
 MNIST::MNIST(string fdata, string ldata){
 	nPixelPerImage = 0;
 	nImageNum = 0;
 	rawData = NULL;
+	batchBuffer = NULL;
+	nBatchBufferSize = 0;
+	shuffledIndex = NULL;
 	label = NULL;
 	strDataFileName = fdata;
 	strLabelFileName = ldata;
+
+	rngState = rngKey("mnist");
 }
 
+MNIST::~MNIST(){
+	delete[] rawData;
+	delete[] batchBuffer;
+	delete[] shuffledIndex;
+	delete[] label;
+}
 
 void MNIST::loadData(void){
 	ifstream fin;
 	fin.open(strDataFileName.c_str(), ios_base::binary);
 
-	// default data size
-	// later to be modified to read from file
-	unsigned int magicNum = 0, row = 0, column = 0;
-	nImageNum = 0;
-
-	byte buf;
-	for(int i = 0; i < 4; i++){
-		fin.read((char*)&buf, 1);
-		magicNum <<= 8;
-		magicNum |= buf;
-	}
-	for(int i = 0; i < 4; i++){
-		fin.read((char*)&buf, 1);
-		nImageNum <<= 8;
-		nImageNum |= buf;
-	}
-	for(int i = 0; i < 4; i++){
-		fin.read((char*)&buf, 1);
-		row <<= 8;
-		row |= buf;
-	}
-	for(int i = 0; i < 4; i++){
-		fin.read((char*)&buf, 1);
-		column <<= 8;
-		column |= buf;
-	}
+	// the header: magic number, number of images, rows and columns
+	byte header[16];
+	fin.read((char*)header, 16);
+	nImageNum = readBigEndian(header + 4);
+	unsigned int row = readBigEndian(header + 8);
+	unsigned int column = readBigEndian(header + 12);
 
 	nPixelPerImage = row * column;
 	if(rawData != NULL){
@@ -51,57 +48,86 @@ void MNIST::loadData(void){
 	}
 	rawData = new floatType[nPixelPerImage * nImageNum];
 
-	// read data from file
-	for(int index = 0; index < nImageNum; index++){
-		for(int feature = 0; feature < nPixelPerImage; feature++){
-			byte temp;
-			fin.read((char*)&temp, 1);
-			rawData[feature + index * nPixelPerImage] = ((floatType)temp) / 255.0;
-		}
+	// read data from file in one read and scale it to [0, 1]
+	byte* pixels = new byte[nPixelPerImage * nImageNum];
+	fin.read((char*)pixels, nPixelPerImage * nImageNum);
+	fin.close();
+
+	floatType* scale = new floatType[nPixelPerImage];
+	floatType* offset = new floatType[nPixelPerImage];
+	for(unsigned int i = 0; i < nPixelPerImage; i++){
+		scale[i] = 1.0 / 255.0;
+		offset[i] = 0.0;
 	}
+	normalizeBytes(rawData, pixels, scale, offset, nImageNum, nPixelPerImage);
 
-	fin.close();
+	delete[] pixels;
+	delete[] scale;
+	delete[] offset;
 
 	fin.open(strLabelFileName.c_str(), ios_base::binary);
 
-	// read labels from file
+	// read labels from file, the header is the magic number and the number of labels
 	if(label != NULL){
 		delete[] label;
 	}
 	label = new byte[nImageNum];
-	for(int i = 0; i < 4; i++){
-		fin >> buf;
-		magicNum <<= 8;
-		magicNum |= buf;
-	}
-	for(int i = 0; i < 4; i++){
-		fin >> buf;
-		nImageNum <<= 8;
-		nImageNum |= buf;
-	}
+	fin.read((char*)header, 8);
 	fin.read((char*)label, nImageNum);
 	fin.close();
 
+	// the images are in the file order until the first shuffle
+	delete[] shuffledIndex;
+	shuffledIndex = new unsigned int[nImageNum];
+	for(unsigned int i = 0; i < nImageNum; i++){
+		shuffledIndex[i] = i;
+	}
+
 	return;
 }
 
+/*
+ * splitmix64 with rejection sampling, so every integer in [0, n) is equally likely
+*/
+unsigned int MNIST::randomBelow(unsigned int n){
+	unsigned long long limit = 0xffffffffffffffffULL - 0xffffffffffffffffULL % n;
+	unsigned long long x;
+	do{
+		rngState += 0x9e3779b97f4a7c15ULL;
+		x = rngState;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		x = x ^ (x >> 31);
+	}while(x >= limit);
+	return (unsigned int)(x % n);
+}
+
 void MNIST::makeBatch(unsigned int numBatch){
-	Pair* perm = new Pair[nImageNum];
-	for(int i = 0; i < nImageNum; i++){
-		perm[i].seed = rand();
-		perm[i].index = i;
+	// Fisher-Yates shuffling of the image indices
+	for(unsigned int i = nImageNum; i > 1; i--){
+		unsigned int j = randomBelow(i);
+		unsigned int temp = shuffledIndex[i - 1];
+		shuffledIndex[i - 1] = shuffledIndex[j];
+		shuffledIndex[j] = temp;
 	}
-	sort(perm, perm + nImageNum, cmp);
-	
+
 	unsigned int nVectorPerBatch = nImageNum / numBatch;
-	for(int i = 0; i < numBatch; i++){
-		floatType* batch = new floatType[nPixelPerImage * nVectorPerBatch];
-		for(int index = 0; index < nVectorPerBatch; index++){
-			for(int feature = 0; feature < nPixelPerImage; feature++){
-				batch[feature + index * nPixelPerImage] = rawData[feature + nPixelPerImage * perm[i * nVectorPerBatch + index].index];
-			}
-		}
-		batchData.push_back(batch);
+
+	// the buffer is allocated only when the size of the batches changes
+	if(nBatchBufferSize != nPixelPerImage * nVectorPerBatch * numBatch){
+		delete[] batchBuffer;
+		nBatchBufferSize = nPixelPerImage * nVectorPerBatch * numBatch;
+		batchBuffer = new floatType[nBatchBufferSize];
+	}
+
+	// gather the images in the shuffled order
+	for(unsigned int index = 0; index < nVectorPerBatch * numBatch; index++){
+		memcpy(batchBuffer + index * nPixelPerImage, rawData + shuffledIndex[index] * nPixelPerImage, nPixelPerImage * sizeof(floatType));
+	}
+
+	batchData.clear();
+	for(unsigned int i = 0; i < numBatch; i++){
+		batchData.push_back(batchBuffer + i * nVectorPerBatch * nPixelPerImage);
 	}
 }
 
@@ -7,27 +7,42 @@
 
 typedef unsigned char byte;
 
-typedef struct{
-	floatType seed;
-	unsigned int index;
-}Pair;
-
 class MNIST
 {
 protected:
 	unsigned int nPixelPerImage;
 	unsigned int nImageNum;
-	vector<floatType*> batchData;
+	vector<floatType*> batchData;	// the batches, which point into batchBuffer
 	floatType* rawData;
+	floatType* batchBuffer;			// the shuffled images, reused by every call of makeBatch()
+	unsigned int nBatchBufferSize;	// the number of floats in batchBuffer
+	unsigned int* shuffledIndex;	// the order of the images in batchBuffer
+	unsigned long long rngState;	// the state of the random number generator of the shuffling
 	byte* label;
 	string strDataFileName;
 	string strLabelFileName;
+
+	// a uniform random integer in [0, n)
+	unsigned int randomBelow(unsigned int n);
 public:
 	MNIST(string fdata, string ldata);
 	~MNIST();
+	/*
+	 * Read the IDX image and label files, each with one read for the header and one for the data.
+	*/
 	void loadData(void);
+	/*
+	 * Shuffle the images with the Fisher-Yates algorithm and gather them into numBatch batches.
+	 * The batches are views into a buffer which is allocated once, so the batches returned by
+	 * the previous call are overwritten.
+	*/
 	void makeBatch(unsigned int numBatch);
 	vector<floatType*> getData(unsigned int numBatch);
+
+	// the images scaled to [0, 1] after loadData(), one row per image
+	floatType* getImages(){return rawData;};
+	unsigned int getImageNum(){return nImageNum;};
+	unsigned int getPixelNum(){return nPixelPerImage;};
 };
 
-#endif
\ No newline at end of file
+#endif
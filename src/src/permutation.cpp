@@ -0,0 +1,78 @@
+#include "permutation.h"
+
+/*
+ * The finalizer of MurmurHash3, it mixes every input bit into every output bit
+*/
+static unsigned long long mix64(unsigned long long x){
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+permutation::permutation(unsigned n, unsigned long long key){
+	nDomain = n;
+
+	// the domain of the network has an even number of bits, at least 2
+	nHalfBits = 1;
+	while(nHalfBits < 16 && ((unsigned long long)1 << (2 * nHalfBits)) < n){
+		nHalfBits++;
+	}
+	halfMask = (1u << nHalfBits) - 1;
+
+	setKey(key);
+}
+
+void permutation::setKey(unsigned long long key){
+	for(unsigned r = 0; r < 4; r++){
+		roundKey[r] = (unsigned)mix64(key + 0x9e3779b97f4a7c15ULL * (r + 1));
+	}
+	return;
+}
+
+unsigned permutation::round(unsigned half, unsigned r) const{
+	return (unsigned)mix64(((unsigned long long)roundKey[r] << 32) | half) & halfMask;
+}
+
+unsigned permutation::encrypt(unsigned x) const{
+	unsigned left = (x >> nHalfBits) & halfMask;
+	unsigned right = x & halfMask;
+	for(unsigned r = 0; r < 4; r++){
+		unsigned temp = right;
+		right = left ^ round(right, r);
+		left = temp;
+	}
+	return (left << nHalfBits) | right;
+}
+
+unsigned permutation::decrypt(unsigned x) const{
+	unsigned left = (x >> nHalfBits) & halfMask;
+	unsigned right = x & halfMask;
+	for(unsigned r = 4; r > 0; r--){
+		unsigned temp = left;
+		left = right ^ round(left, r - 1);
+		right = temp;
+	}
+	return (left << nHalfBits) | right;
+}
+
+/*
+ * The domain is less than 4n, so the walk takes less than 4 steps on average
+*/
+unsigned permutation::forward(unsigned i) const{
+	unsigned x = encrypt(i);
+	while(x >= nDomain){
+		x = encrypt(x);
+	}
+	return x;
+}
+
+unsigned permutation::backward(unsigned j) const{
+	unsigned x = decrypt(j);
+	while(x >= nDomain){
+		x = decrypt(x);
+	}
+	return x;
+}
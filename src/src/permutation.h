@@ -0,0 +1,35 @@
+#ifndef _PERMUTATION_H_
+#define _PERMUTATION_H_
+
+/*
+ * A keyed pseudo-random permutation of {0, 1, ..., n - 1}.
+ * forward(i) is the position vector i moves to and backward(j) is the vector which moves to j.
+ * No table is stored: a 4-round Feistel network permutes the smallest domain of 2^(2k)
+ * integers that holds n, and the values out of range are encrypted again until they fall
+ * into [0, n) (cycle-walking). A new key gives a new permutation.
+*/
+class permutation
+{
+private:
+	unsigned	nDomain;			// n
+	unsigned	nHalfBits;			// k, the bits of one half of the Feistel network
+	unsigned	halfMask;			// 2^k - 1
+	unsigned	roundKey[4];		// the keys of the rounds derived from the key
+
+	unsigned	round(unsigned half, unsigned r) const;
+	unsigned	encrypt(unsigned x) const;
+	unsigned	decrypt(unsigned x) const;
+public:
+	permutation(unsigned n, unsigned long long key);
+
+	/*
+	 * Change the permutation without changing n.
+	*/
+	void setKey(unsigned long long key);
+
+	unsigned forward(unsigned i) const;
+	unsigned backward(unsigned j) const;
+	unsigned size() const { return nDomain; }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+// the states of a slot in the queue
+#define SLOT_EMPTY	0
+#define SLOT_FULL	1
+
+batchQueue::batchQueue(size_t batchSize, unsigned numSlot){
+	nSlotNum = (numSlot < 2) ? 2 : numSlot;
+	slot = new floatType*[nSlotNum];
+	slotState = new int[nSlotNum];
+	for(unsigned i = 0; i < nSlotNum; i++){
+		slot[i] = new floatType[batchSize];
+		slotState[i] = SLOT_EMPTY;
+	}
+	pushSlot = 0;
+	popSlot = 0;
+}
+
+batchQueue::~batchQueue(){
+	for(unsigned i = 0; i < nSlotNum; i++){
+		delete[] slot[i];
+	}
+	delete[] slot;
+	delete[] slotState;
+}
+
+/*
+ * Wait for a slot to reach the state, yield the CPU first and then sleep, as the
+ * other thread takes a training step to change it.
+*/
+static void waitForSlot(int* state, int expected){
+	unsigned spin = 0;
+	while(__atomic_load_n(state, __ATOMIC_ACQUIRE) != expected){
+		if(++spin < 1000){
+			sched_yield();
+		}
+		else{
+			usleep(100);
+		}
+	}
+	return;
+}
+
+floatType* batchQueue::back(){
+	waitForSlot(&slotState[pushSlot], SLOT_EMPTY);
+	return slot[pushSlot];
+}
+
+void batchQueue::push(){
+	__atomic_store_n(&slotState[pushSlot], SLOT_FULL, __ATOMIC_RELEASE);
+	pushSlot = (pushSlot + 1) % nSlotNum;
+	return;
+}
+
+floatType* batchQueue::front(){
+	waitForSlot(&slotState[popSlot], SLOT_FULL);
+	return slot[popSlot];
+}
+
+void batchQueue::pop(){
+	__atomic_store_n(&slotState[popSlot], SLOT_EMPTY, __ATOMIC_RELEASE);
+	popSlot = (popSlot + 1) % nSlotNum;
+	return;
+}
+
+rbmPipeline::rbmPipeline(unsigned lag, unsigned numSlot){
+	nLagBatchNum = lag;
+	nQueueSlotNum = numSlot;
+}
+
+rbmPipeline::~rbmPipeline(){
+	for(unsigned k = 0; k < queues.size(); k++){
+		delete queues[k];
+	}
+}
+
+void rbmPipeline::addLayer(RBM* layer){
+	if(!layers.empty()){
+		RBM* below = layers.back();
+		if(layer->getVisSize() != below->getHidSize() || layer->getBatchSize() != below->getBatchSize()){
+			printf("the layer of %u visible units does not fit on the layer of %u hidden units!\n", layer->getVisSize(), below->getHidSize());
+			exit(-1);
+		}
+		queues.push_back(new batchQueue((size_t)below->getHidSize() * below->getBatchSize(), nQueueSlotNum));
+	}
+	layers.push_back(layer);
+	return;
+}
+
+/*
+ * Layer k has to hand lag + nStepNum[k + 1] mini-batches to the layer above, so it runs for
+ * that many steps if its own training is shorter.
+*/
+void rbmPipeline::train(){
+	unsigned nLayerNum = layers.size();
+	nStepNum.assign(nLayerNum, 0);
+	for(unsigned k = nLayerNum; k > 0; k--){
+		RBM* layer = layers[k - 1];
+		unsigned long long nTrainStepNum = (unsigned long long)layer->getEpochNum() * layer->getBatchNum();
+		nStepNum[k - 1] = nTrainStepNum;
+		if(k < nLayerNum && nLagBatchNum + nStepNum[k] > nTrainStepNum){
+			nStepNum[k - 1] = nLagBatchNum + nStepNum[k];
+		}
+	}
+
+	vector<pthread_t> thread(nLayerNum);
+	vector<stage> arg(nLayerNum);
+	for(unsigned k = 0; k < nLayerNum; k++){
+		arg[k].pipeline = this;
+		arg[k].layerId = k;
+		if(pthread_create(&thread[k], NULL, stageEntry, (void*)&arg[k]) != 0){
+			printf("create stage thread failed!\n");
+			exit(-1);
+		}
+	}
+	for(unsigned k = 0; k < nLayerNum; k++){
+		pthread_join(thread[k], NULL);
+	}
+	return;
+}
+
+void rbmPipeline::stageLoop(unsigned layerId){
+	RBM* layer = layers[layerId];
+	batchQueue* input = (layerId > 0) ? queues[layerId - 1] : NULL;
+	batchQueue* output = (layerId + 1 < layers.size()) ? queues[layerId] : NULL;
+	unsigned long long nOutputNum = (output != NULL) ? nStepNum[layerId + 1] : 0;
+	unsigned long long nTrainStepNum = (unsigned long long)layer->getEpochNum() * layer->getBatchNum();
+	unsigned nBatchNum = layer->getBatchNum();
+
+	unsigned long long nPushedNum = 0;
+	for(unsigned long long step = 0; step < nStepNum[layerId]; step++){
+		// the first layer reads its data provider, which is rewound for each epoch
+		if(step % nBatchNum == 0){
+			layer->startEpoch(step / nBatchNum);
+		}
+
+		floatType* batch = (input != NULL) ? input->front() : NULL;
+		if(step < nTrainStepNum){
+			layer->trainStep(batch);
+		}
+		else{
+			layer->forwardStep(batch);
+		}
+		if(input != NULL){
+			input->pop();
+		}
+
+		// the layer above starts after the lag
+		if(output != NULL && step >= nLagBatchNum && nPushedNum < nOutputNum){
+			layer->getHidProbs(output->back());
+			output->push();
+			nPushedNum++;
+		}
+
+		if(step < nTrainStepNum && (step + 1) % nBatchNum == 0){
+			printf("Layer %u Epoch %u Error %f\n", layerId + 1, (unsigned)(step / nBatchNum) + 1, layer->takeError());
+		}
+		if(step + 1 == nTrainStepNum){
+			layer->saveParameters();
+		}
+	}
+	return;
+}
+
+void* rbmPipeline::stageEntry(void* arg){
+	stage* s = (stage*)arg;
+	s->pipeline->stageLoop(s->layerId);
+	return NULL;
+}
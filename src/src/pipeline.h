@@ -0,0 +1,82 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <pthread.h>
+#include <vector>
+#include "rbm.h"
+
+using namespace std;
+
+/*
+ * A ring of mini-batches handed from one thread to another, one producer and one consumer.
+*/
+class batchQueue
+{
+private:
+	unsigned	nSlotNum;
+	floatType**	slot;
+	int*		slotState;		// SLOT_EMPTY or SLOT_FULL
+	unsigned	pushSlot;		// the slot filled next by the producer
+	unsigned	popSlot;		// the slot read next by the consumer
+
+public:
+	batchQueue(size_t batchSize, unsigned numSlot);
+	~batchQueue();
+
+	// the slot to be filled, waits until the consumer has released it
+	floatType* back();
+	// hand the filled slot to the consumer
+	void push();
+	// the oldest filled slot, waits until the producer has filled it
+	floatType* front();
+	// give the slot back to the producer
+	void pop();
+};
+
+/*
+ * Train all the layers of a DBN at the same time instead of one after another.
+ * Each layer runs on its own thread (and its own command queue for RBM_GPU), and layer k + 1
+ * is trained on the hidden probabilities of each mini-batch computed by the current weights of
+ * layer k, which are handed over through a batchQueue. The wall-clock time approaches the
+ * time of the slowest layer instead of the sum of all the layers.
+ * Layer k + 1 starts after layer k has trained lag mini-batches. The layers above the first one
+ * are fed by the pipeline, so only the first layer needs a data provider. A layer which runs out
+ * of training before the layers above have enough data keeps producing the hidden probabilities
+ * with its final weights. All the layers need the same mini-batch size.
+*/
+class rbmPipeline
+{
+private:
+	vector<RBM*>		layers;
+	vector<batchQueue*>	queues;			// queues[k] carries the output of layer k to layer k + 1
+	vector<unsigned long long>	nStepNum;	// the mini-batches each layer consumes
+	unsigned			nLagBatchNum;
+	unsigned			nQueueSlotNum;
+
+	// the arguments of a stage thread
+	struct stage
+	{
+		rbmPipeline*	pipeline;
+		unsigned		layerId;
+	};
+
+	// the main loop of the thread training layers[layerId]
+	void stageLoop(unsigned layerId);
+	static void* stageEntry(void* arg);
+
+public:
+	/*
+	 * lag is the number of mini-batches layer k trains before layer k + 1 starts.
+	 * numSlot is the number of mini-batches buffered between two layers.
+	*/
+	rbmPipeline(unsigned lag, unsigned numSlot = 4);
+	~rbmPipeline();
+
+	// add the next layer of the stack, its visible layer is the hidden layer of the last one
+	void addLayer(RBM* layer);
+
+	// train all the layers, the parameters of each layer are saved when it finishes
+	void train();
+};
+
+#endif
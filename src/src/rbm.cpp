@@ -1,5 +1,9 @@
 #include <sys/time.h>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 #include "rbm.h"
+#include "asyncwriter.h"
 
 RBM::RBM(){
 	// initialize hyper parameters
@@ -48,7 +52,8 @@ RBM::RBM(){
 	eps_vb = 0.001;
 	eps_hb = 0.001;
 
-	gaussInit(weights, nHidLayerSize * nVisLayerSize, 0, 0.01);
+	rng = rngMake(dataTag.c_str());
+	rngNormal(rng, weights, nHidLayerSize * nVisLayerSize, 0, 0.01);
 	reset(hidBias, nHidLayerSize);
 	reset(visBias, nVisLayerSize);
 	reset(posHidProbs, nHidLayerSize * nVectorPerBatch);
@@ -58,6 +63,18 @@ RBM::RBM(){
 	reset(delta_weights, nHidLayerSize * nVisLayerSize);
 	reset(delta_hidBias, nHidLayerSize);
 	reset(delta_visBias, nVisLayerSize);
+
+	folded = false;
+	inputScale = NULL;
+	inputOffset = NULL;
+	foldedHidBias = NULL;
+	negInput = NULL;
+	exportWeights = NULL;
+
+	errorSum = 0.0;
+	batchError = 0.0;
+	sigMode = SIGMOID_POLY;
+	dataprovider = NULL;
 }
 
 RBM::RBM(unsigned int vis, unsigned int hid, bool linearity, unsigned numEpoch, unsigned numBatch, unsigned nVecPerBatch, floatType wCost, floatType initMom, floatType finalMom, string layertag){
@@ -120,11 +137,12 @@ RBM::RBM(unsigned int vis, unsigned int hid, bool linearity, unsigned numEpoch,
 		eps_hb = 0.01;
 	}
 	
+	rng = rngMake(dataTag.c_str());
 	if(linear){
-		gaussInit(weights, nHidLayerSize * nVisLayerSize, 0, 0.1);
+		rngNormal(rng, weights, nHidLayerSize * nVisLayerSize, 0, 0.1);
 	}
 	else{
-		gaussInit(weights, nHidLayerSize * nVisLayerSize, 0, 0.01);
+		rngNormal(rng, weights, nHidLayerSize * nVisLayerSize, 0, 0.01);
 	}
 	reset(hidBias, nHidLayerSize);
 	reset(visBias, nVisLayerSize);
@@ -136,6 +154,18 @@ RBM::RBM(unsigned int vis, unsigned int hid, bool linearity, unsigned numEpoch,
 	reset(delta_hidBias, nHidLayerSize);
 	reset(delta_visBias, nVisLayerSize);
 	reset(error, nVisLayerSize * nVectorPerBatch);
+
+	folded = false;
+	inputScale = NULL;
+	inputOffset = NULL;
+	foldedHidBias = NULL;
+	negInput = NULL;
+	exportWeights = NULL;
+
+	errorSum = 0.0;
+	batchError = 0.0;
+	sigMode = SIGMOID_POLY;
+	dataprovider = NULL;
 }
 
 void RBM::setInputData(vector<floatType*> trainData){
@@ -144,59 +174,81 @@ void RBM::setInputData(vector<floatType*> trainData){
 }
 
 void RBM::posProp(){
-	addBias(posHidProbs, hidBias, nHidLayerSize, nVectorPerBatch);
-	sgemm('n', 'n', nHidLayerSize, nVectorPerBatch, nVisLayerSize, 1.0, weights, nHidLayerSize, posData, nVisLayerSize, 1.0, posHidProbs, nHidLayerSize);
-	
-	if(!linear){
-		sigmoid(posHidProbs, nHidLayerSize * nVectorPerBatch);
-	}
+	// (W * diag(scale)) * x + (hidBias + W * offset) = W * z + hidBias
+	gemmLayer('n', nHidLayerSize, nVectorPerBatch, nVisLayerSize, weights, nHidLayerSize, posData, folded ? foldedHidBias : hidBias, !linear, sigMode, posHidProbs, posHidAct, NULL);
 
-	sgemm('n', 't', nHidLayerSize, nVisLayerSize, nVectorPerBatch, 1.0, posHidProbs, nHidLayerSize, posData, nVisLayerSize, 0.0, posProds, nHidLayerSize);
-	sumBatch(posHidProbs, posHidAct, nHidLayerSize, nVectorPerBatch);
+	gemm('n', 't', nHidLayerSize, nVisLayerSize, nVectorPerBatch, 1.0, posHidProbs, nHidLayerSize, posData, nVisLayerSize, 0.0, posProds, nHidLayerSize);
 	sumBatch(posData, posVisAct, nVisLayerSize, nVectorPerBatch);
 
 	return;
 }
 
 void RBM::generateStates(){
+	// the random numbers are drawn and used in one pass, posHidStates is written once
 	if(linear){
-		gaussInit(posHidStates, nHidLayerSize * nVectorPerBatch, 0.0, 1.0);
-		for(int i = 0; i < nHidLayerSize * nVectorPerBatch; i++){
-			posHidStates[i] += posHidProbs[i];
-		}
+		rngGaussian(rng, posHidProbs, posHidStates, nHidLayerSize * nVectorPerBatch);
 	}
 	else{
-		randomInit(posHidStates, nHidLayerSize * nVectorPerBatch, 0.0, 1.0);
-		for(int i = 0; i < nHidLayerSize * nVectorPerBatch; i++){
-			posHidStates[i] = (posHidProbs[i] > posHidStates[i]) ? 1.0 : 0.0;
-		}
+		rngBernoulli(rng, posHidProbs, posHidStates, NULL, nHidLayerSize * nVectorPerBatch);
 	}
 	return;
 }
 
 void RBM::negProp(){
-	addBias(negData, visBias, nVisLayerSize, nVectorPerBatch);
-	sgemm('t', 'n', nVisLayerSize, nVectorPerBatch, nHidLayerSize, 1.0, weights, nHidLayerSize, posHidStates, nHidLayerSize, 1.0, negData, nVisLayerSize);
-	
-	sigmoid(negData, nVisLayerSize * nVectorPerBatch);
-
-	addBias(negHidProbs, hidBias, nHidLayerSize, nVectorPerBatch);
-	sgemm('n', 'n', nHidLayerSize, nVectorPerBatch, nVisLayerSize, 1.0, weights, nHidLayerSize, negData, nVisLayerSize, 1.0, negHidProbs, nHidLayerSize);
-	if(!linear){
-		sigmoid(negHidProbs, nHidLayerSize * nVectorPerBatch);
+	if(folded){
+		// the folded weights give scale * (W^T * h), which is divided by the scale before the sigmoid
+		gemm('t', 'n', nVisLayerSize, nVectorPerBatch, nHidLayerSize, 1.0, weights, nHidLayerSize, posHidStates, nHidLayerSize, 0.0, negData, nVisLayerSize);
+		for(int j = 0; j < nVectorPerBatch; j++){
+			for(int i = 0; i < nVisLayerSize; i++){
+				negData[j * nVisLayerSize + i] = visBias[i] + negData[j * nVisLayerSize + i] / inputScale[i];
+			}
+		}
+		sigmoid(negData, (size_t)nVisLayerSize * nVectorPerBatch, sigMode);
+		for(int j = 0; j < nVectorPerBatch; j++){
+			for(int i = 0; i < nVisLayerSize; i++){
+				negInput[j * nVisLayerSize + i] = negData[j * nVisLayerSize + i] / inputScale[i];
+			}
+		}
+		sumBatch(negData, negVisAct, nVisLayerSize, nVectorPerBatch);
+		batchError = foldedEuDist(posData, negData, inputScale, inputOffset, nVisLayerSize, nVectorPerBatch);
+	}
+	else{
+		// the reconstruction error is summed while the reconstruction is in cache
+		batchError = gemmLayer('t', nVisLayerSize, nVectorPerBatch, nHidLayerSize, weights, nHidLayerSize, posHidStates, visBias, true, sigMode, negData, negVisAct, posData);
 	}
 
-	sgemm('n', 't', nHidLayerSize, nVisLayerSize, nVectorPerBatch, 1.0, negHidProbs, nHidLayerSize, negData, nVisLayerSize, 0.0, negProds, nHidLayerSize);
-	sumBatch(negHidProbs, negHidAct, nHidLayerSize, nVectorPerBatch);
-	sumBatch(negData, negVisAct, nVisLayerSize, nVectorPerBatch);
+	// (W * diag(scale)) * (z / scale) = W * z
+	gemmLayer('n', nHidLayerSize, nVectorPerBatch, nVisLayerSize, weights, nHidLayerSize, folded ? negInput : negData, hidBias, !linear, sigMode, negHidProbs, negHidAct, NULL);
+
+	gemm('n', 't', nHidLayerSize, nVisLayerSize, nVectorPerBatch, 1.0, negHidProbs, nHidLayerSize, negData, nVisLayerSize, 0.0, negProds, nHidLayerSize);
 
 	return;
 }
 
 void RBM::update(){
-	for(int i = 0; i < nVisLayerSize * nHidLayerSize; i++){
-		delta_weights[i] = momentum * delta_weights[i] + eps_w * ((posProds[i] - negProds[i]) / nVectorPerBatch - weightCost * weights[i]);
-		weights[i] += delta_weights[i];
+	if(folded){
+		// The positive products are of the raw input, those of z = x * scale + offset are
+		// posProds * scale + posHidAct * offset. The increments of W are multiplied by the scale,
+		// and the folded hidden bias is accumulated in the same pass over the weights.
+		reset(foldedHidBias, nHidLayerSize);
+		for(int i = 0; i < nVisLayerSize; i++){
+			floatType s = inputScale[i];
+			floatType o = inputOffset[i];
+			for(int j = 0; j < nHidLayerSize; j++){
+				int k = i * nHidLayerSize + j;
+				floatType posProd = posProds[k] * s + posHidAct[j] * o;
+				delta_weights[k] = momentum * delta_weights[k] + eps_w * ((posProd - negProds[k]) / nVectorPerBatch * s - weightCost * weights[k]);
+				weights[k] += delta_weights[k];
+				foldedHidBias[j] += weights[k] * (o / s);
+			}
+			posVisAct[i] = posVisAct[i] * s + nVectorPerBatch * o;
+		}
+	}
+	else{
+		for(int i = 0; i < nVisLayerSize * nHidLayerSize; i++){
+			delta_weights[i] = momentum * delta_weights[i] + eps_w * ((posProds[i] - negProds[i]) / nVectorPerBatch - weightCost * weights[i]);
+			weights[i] += delta_weights[i];
+		}
 	}
 	for(int i = 0; i < nVisLayerSize; i++){
 		delta_visBias[i] = momentum * delta_visBias[i] + (eps_vb / nVectorPerBatch) * (posVisAct[i] - negVisAct[i]);
@@ -206,26 +258,69 @@ void RBM::update(){
 		delta_hidBias[i] = momentum * delta_hidBias[i] + (eps_hb / nVectorPerBatch) * (posHidAct[i] - negHidAct[i]);
 		hidBias[i] += delta_hidBias[i];
 	}
+	if(folded){
+		for(int i = 0; i < nHidLayerSize; i++){
+			foldedHidBias[i] += hidBias[i];
+		}
+	}
 	
 	return;
 }
 
+/*
+ * The weights and their increments are multiplied by the scale of their visible unit,
+ * scale is not 0 as the standard variances are finite.
+*/
+void RBM::foldNormalization(){
+	if(folded){
+		return;
+	}
+	dataprovider->setNormalization(false);
+	inputScale = dataprovider->getScale();
+	inputOffset = dataprovider->getOffset();
+
+	foldedHidBias = new floatType[nHidLayerSize];
+	negInput = new floatType[nVisLayerSize * nVectorPerBatch];
+	exportWeights = new floatType[nHidLayerSize * nVisLayerSize];
+
+	for(int j = 0; j < nHidLayerSize; j++){
+		foldedHidBias[j] = hidBias[j];
+	}
+	for(int i = 0; i < nVisLayerSize; i++){
+		for(int j = 0; j < nHidLayerSize; j++){
+			int k = i * nHidLayerSize + j;
+			foldedHidBias[j] += weights[k] * inputOffset[i];
+			weights[k] *= inputScale[i];
+			delta_weights[k] *= inputScale[i];
+		}
+	}
+
+	folded = true;
+	return;
+}
+
+floatType* RBM::getWeights(){
+	if(!folded){
+		return weights;
+	}
+	for(int i = 0; i < nVisLayerSize; i++){
+		for(int j = 0; j < nHidLayerSize; j++){
+			exportWeights[i * nHidLayerSize + j] = weights[i * nHidLayerSize + j] / inputScale[i];
+		}
+	}
+	return exportWeights;
+}
+
 void RBM::train(){
 
 	for(int epoch = 0; epoch < nEpochNum; epoch++){
-		dataprovider->reset();
-		double errsum = 0.0;
+		startEpoch(epoch);
 		printf("Epoch %d\n", epoch + 1);
-		momentum = (epoch < 5) ? initialMomentum : finalMomentum;
 		for(int batch = 0; batch < nBatchNum; batch++){
 			printf("Epoch %d Batch %d\n", epoch + 1, batch + 1);
-			posData = dataprovider->getNextBatch();
-			posProp();
-			generateStates();
-			negProp();
-			errsum += EuDist(posData, negData, nVisLayerSize * nVectorPerBatch);
-			update();
+			trainStep(NULL);
 		}
+		double errsum = takeError();
 		printf("Epoch %d Error %f\n", epoch + 1, errsum);
 
 		ofstream fout;
@@ -237,7 +332,7 @@ void RBM::train(){
 
 		string logWeightFileName = logTag.append("Weight");
 		generateFileName(&logWeightFileName, epoch, 3);
-		logData(logWeightFileName, weights, nVisLayerSize * nHidLayerSize, nHidLayerSize, 1);
+		logData(logWeightFileName, getWeights(), nVisLayerSize * nHidLayerSize, nHidLayerSize, 1);
 		string logHidBiasFileName = logTag.append("HidBias");
 		generateFileName(&logHidBiasFileName, epoch, 3);
 		logData(logHidBiasFileName, hidBias, nHidLayerSize, nHidLayerSize, 1);
@@ -250,6 +345,116 @@ void RBM::train(){
 	return;
 }
 
+void RBM::transform(string fileName, storageFormat format){
+	size_t nValueNum = nHidLayerSize * nVectorPerBatch;
+	size_t batchBytes = storageSize(format, nValueNum);
+	if(format == STORAGE_BITS && (linear || nHidLayerSize % 8 != 0)){
+		printf("the hidden states of %s cannot be stored in bits!\n", dataTag.c_str());
+		exit(-1);
+	}
+	// a batch is reserved in one piece, so a block holds a few of them
+	asyncWriter writer(fileName, max((size_t)8 << 20, 4 * batchBytes));
+
+	// the vectors are written in the order of the input file, the modes of the training are restored at the end
+	bool shuffled = dataprovider->getShuffle();
+	bool prefetching = dataprovider->isPrefetching();
+	dataprovider->setShuffle(false);
+	dataprovider->startPrefetch(3);
+	dataprovider->reset();
+	for(int batch = 0; batch < nBatchNum; batch++){
+		posData = dataprovider->getNextBatch();
+
+		// the probabilities are computed in the block of the writer, as in the positive phase,
+		// or in posHidProbs if they are converted to 16 bits or sampled
+		floatType* probs = (format == STORAGE_FLOAT32) ? (floatType*)writer.reserve(batchBytes) : posHidProbs;
+		gemmLayer('n', nHidLayerSize, nVectorPerBatch, nVisLayerSize, weights, nHidLayerSize, posData, folded ? foldedHidBias : hidBias, !linear, sigMode, probs, NULL, NULL);
+		if(format == STORAGE_BITS){
+			// the states are sampled straight into the bits of the block
+			rngBernoulli(rng, posHidProbs, NULL, (unsigned char*)writer.reserve(batchBytes), nValueNum);
+		}
+		else if(format != STORAGE_FLOAT32){
+			floatToHalf((unsigned short*)writer.reserve(batchBytes), probs, nValueNum, format);
+		}
+	}
+	// the batch belongs to the data provider
+	posData = NULL;
+	writer.close();
+	if(!prefetching){
+		dataprovider->stopPrefetch();
+	}
+	dataprovider->setShuffle(shuffled);
+	return;
+}
+
+/*
+ * The layer is frozen in the normalized space, so the provider has to normalize the data
+*/
+void RBM::freezeInto(dataProvider* provider){
+	provider->addFrozenLayer(nVisLayerSize, nHidLayerSize, getWeights(), hidBias, !linear, sigMode);
+	return;
+}
+
+void RBM::startEpoch(unsigned epoch){
+	if(dataprovider != NULL){
+		dataprovider->reset();
+	}
+	momentum = (epoch < 5) ? initialMomentum : finalMomentum;
+	return;
+}
+
+void RBM::trainStep(floatType* batch){
+	posData = (batch != NULL) ? batch : dataprovider->getNextBatch();
+	posProp();
+	generateStates();
+	negProp();
+	errorSum += batchError;
+	update();
+
+	// the batch belongs to the data provider or the pipeline
+	posData = NULL;
+	return;
+}
+
+void RBM::forwardStep(floatType* batch){
+	posData = (batch != NULL) ? batch : dataprovider->getNextBatch();
+	gemmLayer('n', nHidLayerSize, nVectorPerBatch, nVisLayerSize, weights, nHidLayerSize, posData, folded ? foldedHidBias : hidBias, !linear, sigMode, posHidProbs, NULL, NULL);
+	posData = NULL;
+	return;
+}
+
+void RBM::getHidProbs(floatType* probs){
+	memcpy(probs, posHidProbs, nHidLayerSize * nVectorPerBatch * sizeof(floatType));
+	return;
+}
+
+double RBM::takeError(){
+	double errsum = errorSum;
+	errorSum = 0.0;
+	return errsum;
+}
+
+void RBM::saveParameters(){
+	ofstream fout;
+	string dataWeightName = dataTag;
+	dataWeightName.append("Weight.dat");
+	fout.open(dataWeightName.c_str(), ios_base::binary | ios_base::trunc);
+	fout.write((char*)getWeights(), nVisLayerSize * nHidLayerSize * sizeof(floatType));
+	fout.close();
+
+	string dataHidBiasName = dataTag;
+	dataHidBiasName.append("HidBias.dat");
+	fout.open(dataHidBiasName.c_str(), ios_base::binary | ios_base::trunc);
+	fout.write((char*)hidBias, nHidLayerSize * sizeof(floatType));
+	fout.close();
+
+	string dataVisBiasName = dataTag;
+	dataVisBiasName.append("VisBias.dat");
+	fout.open(dataVisBiasName.c_str(), ios_base::binary | ios_base::trunc);
+	fout.write((char*)visBias, nVisLayerSize * sizeof(floatType));
+	fout.close();
+	return;
+}
+
 RBM::~RBM(){
 	delete[] weights; 
 	delete[] hidBias; 
@@ -270,4 +475,7 @@ RBM::~RBM(){
 	delete[] negHidAct; 
 	delete[] negVisAct; 
 	delete[] posHidStates;
+	delete[] foldedHidBias;
+	delete[] negInput;
+	delete[] exportWeights;
 }		  
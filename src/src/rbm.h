@@ -1,3 +1,6 @@
+#ifndef _RBM_H_
+#define _RBM_H_
+
 #include "utils.h"
 #include "cifar10.h"
 
@@ -52,6 +55,21 @@ protected:
 
 	vector<floatType*> batchPosHidProbs; // training data for next RBM
 
+	// the normalization of the input folded into the layer, see foldNormalization()
+	bool folded; // true if weights holds the folded weights and the input is not normalized
+	floatType* inputScale; // the per-pixel factors of the normalization, owned by the data provider
+	floatType* inputOffset; // the per-pixel offsets of the normalization, owned by the data provider
+	floatType* foldedHidBias; // hidBias + (weights / inputScale) * inputOffset, the hidden bias for the raw input [nHidLayerSize]
+	floatType* negInput; // negData / inputScale, the reconstruction in the scale of the raw input [nVisLayerSize * nVectorPerBatch]
+	floatType* exportWeights; // the unfolded weights for the logs [nHidLayerSize * nVisLayerSize]
+
+	double errorSum; // the squared reconstruction errors of the steps since the last takeError()
+	double batchError; // the squared reconstruction error of the last negProp()
+
+	sigmoidMode sigMode; // the accuracy of the sigmoid of the CPU implementation, SIGMOID_POLY by default
+
+	rngStream rng; // the random numbers of the layer, made from dataTag and the global seed, shared by the CPU and the GPU
+
 public:
 	dataProvider* dataprovider;
 
@@ -69,11 +87,67 @@ public:
 	// update weights as well as the biases of the visible and the hidden layer
 	virtual void update(); 
 
+	/*
+	 * Train on the raw input x of the byte data provider instead of z = x * scale + offset.
+	 * The layer keeps W * diag(scale) as its weights, so the positive phase multiplies the raw
+	 * input directly, and the updates are those of W in the normalized space. The reconstruction
+	 * and the visible bias stay in the normalized space. The logged weights are unfolded.
+	 * Call it after the data provider is set, for the CPU implementation only.
+	*/
+	void foldNormalization();
+	// the weights in the normalized space
+	floatType* getWeights();
+
 	// RBM training entry
 	virtual void train(); 
 
+	/*
+	 * Write the hidden probabilities of the whole data set to fileName in the order of the input,
+	 * which is the training data of the next layer. The data is prefetched and the file is written in large blocks
+	 * by a background thread, so the reading, the computing and the writing overlap.
+	 * The probabilities are written as 16-bit values of the format unless it is STORAGE_FLOAT32,
+	 * which halves the file. STORAGE_BITS writes the sampled binary states instead, one bit per unit,
+	 * for the binary layers with a multiple of 8 hidden units. Read such a file with dataProvider::setStorageFormat().
+	*/
+	virtual void transform(string fileName, storageFormat format = STORAGE_FLOAT32);
+
+	/*
+	 * Put a frozen copy of this layer in front of the provider of the next layer, which is then
+	 * trained on the hidden probabilities computed batch by batch instead of a file written by
+	 * transform(). The provider reads the same data as this layer, a file is written only if
+	 * transform() is called.
+	*/
+	virtual void freezeInto(dataProvider* provider);
+
+	/*
+	 * The steps of train(), so the layers of a stack can be trained at the same time, see rbmPipeline.
+	 * batch is a mini-batch on the host, or NULL for the next mini-batch of the data provider.
+	*/
+	// set the momentum and rewind the data provider if there is one
+	virtual void startEpoch(unsigned epoch);
+	// one step of the contrastive divergence
+	virtual void trainStep(floatType* batch);
+	// compute the hidden probabilities only, the layer is not changed
+	virtual void forwardStep(floatType* batch);
+	// copy the hidden probabilities of the last step to probs [nHidLayerSize * nVectorPerBatch]
+	virtual void getHidProbs(floatType* probs);
+	// the sum of the squared reconstruction errors since the last call
+	virtual double takeError();
+	// write the weights and the biases to the data files of the layer, as at the end of train()
+	virtual void saveParameters();
+
+	inline unsigned getVisSize(){return nVisLayerSize;};
+	inline unsigned getHidSize(){return nHidLayerSize;};
+	inline unsigned getBatchSize(){return nVectorPerBatch;};
+	inline unsigned getBatchNum(){return nBatchNum;};
+	inline unsigned getEpochNum(){return nEpochNum;};
+
+	inline void setSigmoidMode(sigmoidMode mode){sigMode = mode;};
+
 };
 
+#ifdef _AMD_GPU_
+
 class RBM_GPU: public RBM
 {
 protected:
@@ -116,6 +190,8 @@ protected:
 	cl_kernel randNum;
 	cl_kernel randn;
 	cl_kernel reset;
+	cl_kernel toHalf;
+	cl_kernel packBits;
 
 public:
 	// OpenCL objects
@@ -134,6 +210,23 @@ public:
 	void update();	// update weights and biases
 	void train();
 	void test();
+	// the copies from the device go directly into the blocks of the writer without waiting,
+	// the 16-bit values and the bits are converted on the device so only their bytes are copied
+	void transform(string fileName, storageFormat format = STORAGE_FLOAT32);
+	// the parameters are read back from the device first
+	void freezeInto(dataProvider* provider);
+
+	// the host mini-batches are uploaded, the errors are summed on the device
+	void startEpoch(unsigned epoch);
+	void trainStep(floatType* batch);
+	void forwardStep(floatType* batch);
+	void getHidProbs(floatType* probs);
+	double takeError();
+	void saveParameters();
 
 	void gpu_release();
 };
+
+#endif
+
+#endif
@@ -1,5 +1,7 @@
 #include <sys/time.h>
+#include <algorithm>
 #include "rbm.h"
+#include "asyncwriter.h"
 #define KERNEL_SOURCE_LENGTH 50000
 
 // constructor
@@ -9,6 +11,7 @@ RBM_GPU::RBM_GPU(unsigned int deviceIndex, unsigned int vis, unsigned int hid, b
 
 	// initialize the OpenCL environment
 	gpu_init(gpu_env, deviceIndex);
+	dataprovider = NULL;
 
 	// allocate device buffers
 	d_weights 	= clCreateBuffer(gpu_env.ctx, CL_MEM_READ_WRITE, nVisLayerSize * nHidLayerSize * sizeof(floatType), NULL, &gpu_env.status);
@@ -77,13 +80,16 @@ RBM_GPU::RBM_GPU(unsigned int deviceIndex, unsigned int vis, unsigned int hid, b
 	randNum			= clCreateKernel(gpu_env.prog, "PRNG_threefry4x32", &gpu_env.status);
 	randn			= clCreateKernel(gpu_env.prog, "PRNGn_threefry4x32", &gpu_env.status);
 	reset			= clCreateKernel(gpu_env.prog, "reset", &gpu_env.status);
+	toHalf			= clCreateKernel(gpu_env.prog, "floatToHalf", &gpu_env.status);
+	packBits		= clCreateKernel(gpu_env.prog, "packBits", &gpu_env.status);
 
-	// Random initialization of RBM weights
+	// Random initialization of RBM weights, from the start of the stream as the CPU weights
+	rng = rngMake(dataTag.c_str());
 	if(linear){
-		gpu_gaussInit(gpu_env, randn, d_weights, nVisLayerSize * nHidLayerSize, 0.0, 0.1, NULL);
+		gpu_gaussInit(gpu_env, randn, d_weights, nVisLayerSize * nHidLayerSize, 0.0, 0.1, rng, NULL);
 	}
 	else{
-		gpu_gaussInit(gpu_env, randn, d_weights, nVisLayerSize * nHidLayerSize, 0.0, 0.01, NULL);
+		gpu_gaussInit(gpu_env, randn, d_weights, nVisLayerSize * nHidLayerSize, 0.0, 0.01, rng, NULL);
 	}
 }
 
@@ -123,7 +129,7 @@ void RBM_GPU::posProp(){
 void RBM_GPU::generateStates(){
 
 	// produce uniform distributed numbers in the span (0, 1)
-	gpu_randomInit(gpu_env, randNum, d_posHidStates, nHidLayerSize * nVectorPerBatch, 0.0, 1.0, NULL);
+	gpu_randomInit(gpu_env, randNum, d_posHidStates, nHidLayerSize * nVectorPerBatch, 0.0, 1.0, rng, NULL);
 	// sample the states according to the distribution
 	gpu_getStates(gpu_env, getStates, d_posHidStates, d_posHidProbs, nHidLayerSize * nVectorPerBatch, NULL);
 	
@@ -199,29 +205,15 @@ void RBM_GPU::train(){
 	posData = new floatType[nVisLayerSize * nVectorPerBatch];
 
 	for(int epoch = 0; epoch <nEpochNum; epoch++){
-		dataprovider->reset();
-		double errsum = 0.0;
-		gpu_reset(gpu_env, reset, d_error, nVisLayerSize * nVectorPerBatch, NULL);	
+		startEpoch(epoch);
 		printf("Epoch %d\n", epoch + 1);
-		momentum = (epoch < 5) ? initialMomentum : finalMomentum;
 		for(int batch = 0; batch < nBatchNum; batch++){
 			if((batch + 1) % 100000 == 0){
 				printf("Epoch %d Batch %d\n", epoch + 1, batch + 1);
 			}
-
-			dataprovider->getNextDeviceBatch(d_posData);
-			posProp();
-			generateStates();
-			negProp();
-			gpu_squareError(gpu_env, squareError, d_posData, d_negData, d_error, nVisLayerSize * nVectorPerBatch);
-			update();
-
-			clFlush(gpu_env.queue);
-		}
-		gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_error, CL_TRUE, 0, nVisLayerSize * nVectorPerBatch * sizeof(floatType), (void*)error, 0, NULL, NULL);
-		for(int i = 0; i < nVisLayerSize * nVectorPerBatch; i++){
-		 	errsum += error[i];
+			trainStep(NULL);
 		}
+		double errsum = takeError();
 
 		// update the info in the command window for monitoring
 		printf("Epoch %d Error %f\n", epoch + 1, errsum);
@@ -239,23 +231,7 @@ void RBM_GPU::train(){
 		gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_visBias, CL_TRUE, 0, nVisLayerSize * sizeof(floatType), (void*)visBias, 0, NULL, NULL);
 
 		if(epoch == nEpochNum - 1){
-			string dataWeightName = dataTag;
-			dataWeightName.append("Weight.dat");
-			fout.open(dataWeightName.c_str(), ios_base::binary | ios_base::trunc);
-			fout.write((char*)weights, nVisLayerSize * nHidLayerSize * sizeof(floatType));
-			fout.close();
-
-			string dataHidBiasName = dataTag;
-			dataHidBiasName.append("HidBias.dat");
-			fout.open(dataHidBiasName.c_str(), ios_base::binary | ios_base::trunc);
-			fout.write((char*)hidBias, nHidLayerSize * sizeof(floatType));
-			fout.close();
-
-			string dataVisBiasName = dataTag;
-			dataVisBiasName.append("VisBias.dat");
-			fout.open(dataVisBiasName.c_str(), ios_base::binary | ios_base::trunc);
-			fout.write((char*)visBias, nVisLayerSize * sizeof(floatType));
-			fout.close();			
+			RBM::saveParameters();
 		}
 		// save these parameters into the disc.
 		string logWeightFileName = logTag;
@@ -299,35 +275,147 @@ void RBM_GPU::test(){
 	gpu_env.status = clEnqueueWriteBuffer(gpu_env.queue, d_hidBias, CL_TRUE, 0, nHidLayerSize * sizeof(floatType), 			(void*)hidBias, 0, NULL, NULL);
 
 
-	posData = new floatType[nVisLayerSize * nVectorPerBatch];
-
 	// propagate forward
-	{
-		dataprovider->reset();
-		double errsum = 0.0;
-		gpu_reset(gpu_env, reset, d_error, nVisLayerSize * nVectorPerBatch, NULL);	
-
-		for(int batch = 0; batch < nBatchNum; batch++)
-		{
-			dataprovider->getNextDeviceBatch(d_posData);
-
-			// forth-propagate from the visible layer to the hidden layer
-			gpu_addBias(gpu_env, addBias, d_posHidProbs, d_hidBias, nHidLayerSize, nVectorPerBatch, NULL);
-			gpu_env.status = clAmdBlasSgemm(gpu_env.order, clAmdBlasNoTrans, clAmdBlasNoTrans, nHidLayerSize, nVectorPerBatch, nVisLayerSize, 1.0, 
-				d_weights, nHidLayerSize, d_posData, nVisLayerSize, 1.0, d_posHidProbs, nHidLayerSize, 1, &gpu_env.queue, 0, NULL, NULL);
-			gpu_sigmoid(gpu_env, sigmoid, d_posHidProbs, nHidLayerSize * nVectorPerBatch, NULL);
-
-			// flush the command queue to execute the commands and read the result back to the host
-			gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_posHidProbs, CL_TRUE, 0, nHidLayerSize * nVectorPerBatch * sizeof(floatType), (void*)posHidProbs, 0, NULL, NULL);
-
-			// save the result into the disc
-			ofstream fout;
-			string testProbName = dataTag;
-			testProbName.append("Prob.dat");
-			fout.open(testProbName.c_str(), ios_base::binary | ios_base::app);
-			fout.write((char*)posHidProbs, nHidLayerSize * nVectorPerBatch * sizeof(floatType));
+	string testProbName = dataTag;
+	testProbName.append("Prob.dat");
+	transform(testProbName);
+}
+
+/*
+ * The device works through the batches in the order of the queue. The host only waits for
+ * the copies before their block is handed to the writer thread.
+*/
+void RBM_GPU::transform(string fileName, storageFormat format){
+	unsigned nValueNum = nHidLayerSize * nVectorPerBatch;
+	size_t batchBytes = storageSize(format, nValueNum);
+	if(format == STORAGE_BITS && nHidLayerSize % 8 != 0){
+		printf("the hidden states of %s cannot be stored in bits!\n", dataTag.c_str());
+		exit(-1);
+	}
+	// a batch is reserved in one piece, so a block holds a few of them
+	asyncWriter writer(fileName, max((size_t)8 << 20, 4 * batchBytes));
+
+	// the 16-bit values or the bits of a batch on the device
+	cl_mem d_packedHidProbs = NULL;
+	if(format != STORAGE_FLOAT32){
+		d_packedHidProbs = clCreateBuffer(gpu_env.ctx, CL_MEM_READ_WRITE, batchBytes, NULL, &gpu_env.status);
+	}
+
+	// the vectors are written in the order of the input file, the modes of the training are restored at the end
+	bool shuffled = dataprovider->getShuffle();
+	bool prefetching = dataprovider->isPrefetching();
+	dataprovider->setShuffle(false);
+	dataprovider->startPrefetch(3);
+	dataprovider->reset();
+	for(int batch = 0; batch < nBatchNum; batch++){
+		dataprovider->getNextDeviceBatch(d_posData);
+
+		// forth-propagate from the visible layer to the hidden layer
+		gpu_addBias(gpu_env, addBias, d_posHidProbs, d_hidBias, nHidLayerSize, nVectorPerBatch, NULL);
+		gpu_env.status = clAmdBlasSgemm(gpu_env.order, clAmdBlasNoTrans, clAmdBlasNoTrans, nHidLayerSize, nVectorPerBatch, nVisLayerSize, 1.0, 
+			d_weights, nHidLayerSize, d_posData, nVisLayerSize, 1.0, d_posHidProbs, nHidLayerSize, 1, &gpu_env.queue, 0, NULL, NULL);
+		gpu_sigmoid(gpu_env, sigmoid, d_posHidProbs, nHidLayerSize * nVectorPerBatch, NULL);
+
+		cl_mem d_output = d_posHidProbs;
+		if(format == STORAGE_BITS){
+			generateStates();
+			gpu_packBits(gpu_env, packBits, d_packedHidProbs, d_posHidStates, nValueNum, NULL);
+			d_output = d_packedHidProbs;
 		}
+		else if(format != STORAGE_FLOAT32){
+			gpu_floatToHalf(gpu_env, toHalf, d_packedHidProbs, d_posHidProbs, format, nValueNum, NULL);
+			d_output = d_packedHidProbs;
+		}
+
+		// the copies into the current block have to be done before it is handed over
+		if(writer.available() < batchBytes){
+			clFinish(gpu_env.queue);
+		}
+		gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_output, CL_FALSE, 0, batchBytes, writer.reserve(batchBytes), 0, NULL, NULL);
+	}
+	clFinish(gpu_env.queue);
+	writer.close();
+	if(d_packedHidProbs != NULL){
+		clReleaseMemObject(d_packedHidProbs);
+	}
+	if(!prefetching){
+		dataprovider->stopPrefetch();
+	}
+	dataprovider->setShuffle(shuffled);
+	return;
+}
+
+/*
+ * The hidden units are binary in the positive phase of RBM_GPU, so the sigmoid is always applied
+*/
+void RBM_GPU::freezeInto(dataProvider* provider){
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_weights, CL_TRUE, 0, nVisLayerSize * nHidLayerSize * sizeof(floatType), (void*)weights, 0, NULL, NULL);
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_hidBias, CL_TRUE, 0, nHidLayerSize * sizeof(floatType), (void*)hidBias, 0, NULL, NULL);
+	provider->addFrozenLayer(nVisLayerSize, nHidLayerSize, weights, hidBias, true);
+	return;
+}
+
+void RBM_GPU::startEpoch(unsigned epoch){
+	if(dataprovider != NULL){
+		dataprovider->reset();
+	}
+	momentum = (epoch < 5) ? initialMomentum : finalMomentum;
+	gpu_reset(gpu_env, reset, d_error, nVisLayerSize * nVectorPerBatch, NULL);
+	return;
+}
+
+void RBM_GPU::trainStep(floatType* batch){
+	if(batch != NULL){
+		gpu_env.status = clEnqueueWriteBuffer(gpu_env.queue, d_posData, CL_TRUE, 0, nVisLayerSize * nVectorPerBatch * sizeof(floatType), (void*)batch, 0, NULL, NULL);
 	}
+	else{
+		dataprovider->getNextDeviceBatch(d_posData);
+	}
+	posProp();
+	generateStates();
+	negProp();
+	gpu_squareError(gpu_env, squareError, d_posData, d_negData, d_error, nVisLayerSize * nVectorPerBatch);
+	update();
+
+	clFlush(gpu_env.queue);
+	return;
+}
+
+void RBM_GPU::forwardStep(floatType* batch){
+	if(batch != NULL){
+		gpu_env.status = clEnqueueWriteBuffer(gpu_env.queue, d_posData, CL_TRUE, 0, nVisLayerSize * nVectorPerBatch * sizeof(floatType), (void*)batch, 0, NULL, NULL);
+	}
+	else{
+		dataprovider->getNextDeviceBatch(d_posData);
+	}
+	gpu_addBias(gpu_env, addBias, d_posHidProbs, d_hidBias, nHidLayerSize, nVectorPerBatch, NULL);
+	gpu_env.status = clAmdBlasSgemm(gpu_env.order, clAmdBlasNoTrans, clAmdBlasNoTrans, nHidLayerSize, nVectorPerBatch, nVisLayerSize, 1.0, 
+		d_weights, nHidLayerSize, d_posData, nVisLayerSize, 1.0, d_posHidProbs, nHidLayerSize, 1, &gpu_env.queue, 0, NULL, NULL);
+	gpu_sigmoid(gpu_env, sigmoid, d_posHidProbs, nHidLayerSize * nVectorPerBatch, NULL);
+	return;
+}
+
+void RBM_GPU::getHidProbs(floatType* probs){
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_posHidProbs, CL_TRUE, 0, nHidLayerSize * nVectorPerBatch * sizeof(floatType), (void*)probs, 0, NULL, NULL);
+	return;
+}
+
+double RBM_GPU::takeError(){
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_error, CL_TRUE, 0, nVisLayerSize * nVectorPerBatch * sizeof(floatType), (void*)error, 0, NULL, NULL);
+	double errsum = 0.0;
+	for(int i = 0; i < nVisLayerSize * nVectorPerBatch; i++){
+		errsum += error[i];
+	}
+	gpu_reset(gpu_env, reset, d_error, nVisLayerSize * nVectorPerBatch, NULL);
+	return errsum;
+}
+
+void RBM_GPU::saveParameters(){
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_weights, CL_TRUE, 0, nVisLayerSize * nHidLayerSize * sizeof(floatType), (void*)weights, 0, NULL, NULL);
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_hidBias, CL_TRUE, 0, nHidLayerSize * sizeof(floatType), (void*)hidBias, 0, NULL, NULL);
+	gpu_env.status = clEnqueueReadBuffer(gpu_env.queue, d_visBias, CL_TRUE, 0, nVisLayerSize * sizeof(floatType), (void*)visBias, 0, NULL, NULL);
+	RBM::saveParameters();
+	return;
 }
 
 void RBM_GPU::gpu_release(){
@@ -365,6 +453,8 @@ void RBM_GPU::gpu_release(){
 	clReleaseKernel(randNum);
 	clReleaseKernel(randn);
 	clReleaseKernel(reset);
+	clReleaseKernel(toHalf);
+	clReleaseKernel(packBits);
 	
 }
 
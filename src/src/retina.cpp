@@ -0,0 +1,114 @@
+#include<cstring>
+#include "retina.h"
+#include "simd.h"
+
+/*
+ * The rows of the default layout:
+ * rows 0-3 and 12-15 of the window are pooled over the full width,
+ * rows 4-11 are pooled at the left and right 4 pixels with the 8 pixels in between kept.
+*/
+const retinaSegment retinaLayout[] = {
+	{RETINA_POOL, 0, 0, 8},
+	{RETINA_POOL, 1, 0, 8},
+	{RETINA_POOL, 2, 0, 2}, {RETINA_COPY, 4, 4, 8}, {RETINA_COPY, 5, 4, 8}, {RETINA_POOL, 2, 6, 2},
+	{RETINA_POOL, 3, 0, 2}, {RETINA_COPY, 6, 4, 8}, {RETINA_COPY, 7, 4, 8}, {RETINA_POOL, 3, 6, 2},
+	{RETINA_POOL, 4, 0, 2}, {RETINA_COPY, 8, 4, 8}, {RETINA_COPY, 9, 4, 8}, {RETINA_POOL, 4, 6, 2},
+	{RETINA_POOL, 5, 0, 2}, {RETINA_COPY, 10, 4, 8}, {RETINA_COPY, 11, 4, 8}, {RETINA_POOL, 5, 6, 2},
+	{RETINA_POOL, 6, 0, 8},
+	{RETINA_POOL, 7, 0, 8}
+};
+
+const unsigned nRetinaSegmentNum = sizeof(retinaLayout) / sizeof(retinaSegment);
+
+/*
+ * The pooling is done for each window, this version needs no pooled image
+*/
+void retinaPermutation(unsigned char* odata, unsigned char* idata, unsigned int imageWidth, unsigned int imageHeight){
+	for(unsigned s = 0; s < nRetinaSegmentNum; s++){
+		const retinaSegment& seg = retinaLayout[s];
+
+		if(seg.source == RETINA_COPY){
+			memcpy(odata, idata + seg.row * imageWidth + seg.col, seg.width);
+			odata += seg.width;
+			continue;
+		}
+
+		// the floor of the average of a 2x2 block
+		unsigned char* p = idata + 2 * seg.row * imageWidth + 2 * seg.col;
+		for(unsigned i = 0; i < seg.width; i++){
+			unsigned int iavg = p[0] + p[1] + p[imageWidth] + p[imageWidth + 1];
+			*(odata++) = (unsigned char)(iavg >> 2);
+			p += 2;
+		}
+	}
+	return;
+}
+
+/*
+ * Copy a segment, the common widths are copied with one move instead of a call to memcpy
+*/
+static inline void copySegment(unsigned char* odata, const unsigned char* p, unsigned width){
+	if(width == 8){
+		memcpy(odata, p, 8);
+	}
+	else if(width == 2){
+		memcpy(odata, p, 2);
+	}
+	else{
+		memcpy(odata, p, width);
+	}
+}
+
+void retinaRowFromPooled(unsigned char* odata, unsigned outStride, unsigned nWindow, const unsigned char* pooled, unsigned pooledWidth, const unsigned char* idata, unsigned imageWidth){
+	for(unsigned w = 0; w < nWindow; w++){
+		unsigned char* o = odata;
+
+		// the table is known at compile time, so the walk unrolls into one move per segment
+		#pragma GCC unroll 64
+		for(unsigned s = 0; s < nRetinaSegmentNum; s++){
+			const retinaSegment& seg = retinaLayout[s];
+
+			if(seg.source == RETINA_COPY){
+				copySegment(o, idata + seg.row * imageWidth + seg.col, seg.width);
+			}
+			else{
+				copySegment(o, pooled + seg.row * pooledWidth + seg.col, seg.width);
+			}
+			o += seg.width;
+		}
+
+		// the next window is 2 pixels or 1 pooled pixel to the right
+		odata += outStride;
+		pooled += 1;
+		idata += 2;
+	}
+	return;
+}
+
+unsigned retinaWindowNum(unsigned imageWidth, unsigned imageHeight){
+	return ((imageWidth - RETINA_WINDOW_SIZE) / 2 + 1) * ((imageHeight - RETINA_WINDOW_SIZE) / 2 + 1);
+}
+
+void retinaImage(unsigned char* odata, const unsigned char* image, unsigned char* pooled, unsigned imageWidth, unsigned imageHeight, unsigned nChannel){
+	// the pooled pixels are shared by the overlapping windows, so each channel is pooled once
+	unsigned nPooledPerRow = imageWidth / 2;
+	unsigned nPooledPerChannel = nPooledPerRow * (imageHeight / 2);
+	for(unsigned channel = 0; channel < nChannel; channel++){
+		poolBytes2x2(pooled + channel * nPooledPerChannel, image + channel * imageWidth * imageHeight, imageWidth, imageHeight);
+	}
+
+	// the windows move from left to right in the stride of 2 pixels
+	unsigned nWindowPerRow = (imageWidth - RETINA_WINDOW_SIZE) / 2 + 1;
+	unsigned windowStride = nChannel * RETINA_VECTOR_SIZE;
+
+	for(unsigned row = 0; row <= imageHeight - RETINA_WINDOW_SIZE; row += 2){
+		for(unsigned channel = 0; channel < nChannel; channel++){
+			// the head of this row of windows in the pooled and the original image
+			const unsigned char* pooledRow = pooled + channel * nPooledPerChannel + (row / 2) * nPooledPerRow;
+			const unsigned char* imageRow = image + channel * imageWidth * imageHeight + row * imageWidth;
+			retinaRowFromPooled(odata + channel * RETINA_VECTOR_SIZE, windowStride, nWindowPerRow, pooledRow, nPooledPerRow, imageRow, imageWidth);
+		}
+		odata += nWindowPerRow * windowStride;
+	}
+	return;
+}
@@ -0,0 +1,59 @@
+#ifndef _RETINA_H_
+#define _RETINA_H_
+
+/*
+ * The retina format of an image window: the periphery is 2x2 average pooled and
+ * the fovea keeps the original pixels. The layout is described by a table of
+ * segments, so a new layout only needs a new table.
+ * This header does not depend on ACML or OpenCL, so the code can be benchmarked alone.
+*/
+
+// the sources of a segment
+enum retinaSource
+{
+	RETINA_POOL = 0,	// width pooled pixels, row and col in pooled pixels of the window
+	RETINA_COPY = 1		// width original pixels, row and col in pixels of the window
+};
+
+// a run of consecutive bytes of the retina vector
+struct retinaSegment
+{
+	unsigned char source;
+	unsigned char row;
+	unsigned char col;
+	unsigned char width;
+};
+
+// the size of the window and of the retina vector of the default layout
+#define RETINA_WINDOW_SIZE	16
+#define RETINA_VECTOR_SIZE	112
+
+// the default layout: a 16x16 window with an 8x8 fovea in the center
+extern const retinaSegment retinaLayout[];
+extern const unsigned nRetinaSegmentNum;
+
+/*
+ * The function generates a 112-dim retina image vector from a 16x16 pixels region
+ * Notice: this function is for ONE CHANNEL ONLY!
+*/
+void retinaPermutation(unsigned char* odata, unsigned char* idata, unsigned int imageWidth, unsigned int imageHeight);
+
+/*
+ * The vectors of nWindow windows in a row from the pooled image, which is computed once for all
+ * the windows. The windows are 2 pixels apart and their vectors are outStride bytes apart.
+ * pooled points to the pooled pixel of the first window origin and idata to the original pixel.
+ * The window origins must be at even rows and columns.
+*/
+void retinaRowFromPooled(unsigned char* odata, unsigned outStride, unsigned nWindow, const unsigned char* pooled, unsigned pooledWidth, const unsigned char* idata, unsigned imageWidth);
+
+// the number of windows in an image, the windows move in the stride of 2 pixels
+unsigned retinaWindowNum(unsigned imageWidth, unsigned imageHeight);
+
+/*
+ * The vectors of all the windows of an image with nChannel planes of imageHeight x imageWidth bytes.
+ * The windows are in row-major order, and the nChannel vectors of a window are stored together.
+ * pooled is a scratch buffer of nChannel * (imageWidth / 2) * (imageHeight / 2) bytes.
+*/
+void retinaImage(unsigned char* odata, const unsigned char* image, unsigned char* pooled, unsigned imageWidth, unsigned imageHeight, unsigned nChannel);
+
+#endif
@@ -0,0 +1,626 @@
+#include<immintrin.h>
+#include<cstdlib>
+#include<cstring>
+#include<cmath>
+#include<ctime>
+#include "rng.h"
+
+rngStream rngMake(unsigned seed){
+	rngStream stream;
+	stream.seed = seed;
+	stream.counter = 0;
+	return stream;
+}
+
+static bool seeded = false;
+static bool seedGiven = false;
+static unsigned globalSeed = 0;
+
+unsigned rngSeed(){
+	if(!seeded){
+		const char* value = getenv("RBM_SEED");
+		if(value != NULL){
+			globalSeed = (unsigned)strtoul(value, NULL, 0);
+			seedGiven = true;
+		}
+		seeded = true;
+	}
+	return globalSeed;
+}
+
+void rngSetSeed(unsigned seed){
+	globalSeed = seed;
+	seeded = true;
+	seedGiven = true;
+	return;
+}
+
+/*
+ * The 32-bit FNV-1a hash of the 4 bytes of the global seed followed by the name
+*/
+rngStream rngMake(const char* name){
+	unsigned seed = rngSeed();
+	unsigned hash = 2166136261u;
+	for(int i = 0; i < 4; i++){
+		hash = (hash ^ ((seed >> (8 * i)) & 0xFF)) * 16777619u;
+	}
+	for(; *name != 0; name++){
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	}
+	return rngMake(hash);
+}
+
+unsigned long long rngKey(const char* name){
+	rngSeed();
+	if(!seedGiven){
+		time_t t;
+		return (unsigned long long)time(&t);
+	}
+
+	rngStream stream = rngMake(name);
+	unsigned ctr[4] = {stream.counter, stream.counter, stream.seed, stream.seed};
+	unsigned key[4] = {0, 0, 0, 0};
+	unsigned out[4];
+	threefry4x32(out, ctr, key);
+	return ((unsigned long long)out[1] << 32) | out[0];
+}
+
+// the rotations of Threefry-4x32, and the rounds the kernels are run with
+static const int threefryRounds = 20;
+static const int threefryRot[8][2] = {{10, 26}, {11, 21}, {13, 27}, {23, 5}, {6, 20}, {17, 11}, {25, 10}, {18, 20}};
+
+static inline unsigned rotl32(unsigned x, int n){
+	return (x << n) | (x >> (32 - n));
+}
+
+void threefry4x32(unsigned out[4], const unsigned ctr[4], const unsigned key[4]){
+	unsigned ks[5];
+	unsigned x[4];
+
+	ks[4] = 0x1BD11BDA;
+	for(int i = 0; i < 4; i++){
+		ks[i] = key[i];
+		x[i] = ctr[i] + key[i];
+		ks[4] ^= key[i];
+	}
+
+	for(int r = 0; r < threefryRounds; r++){
+		// the even rounds mix (0, 1) and (2, 3), the odd rounds (0, 3) and (2, 1)
+		int b = (r % 2 == 0) ? 1 : 3;
+		int d = (r % 2 == 0) ? 3 : 1;
+		x[0] += x[b];
+		x[b] = rotl32(x[b], threefryRot[r % 8][0]);
+		x[b] ^= x[0];
+		x[2] += x[d];
+		x[d] = rotl32(x[d], threefryRot[r % 8][1]);
+		x[d] ^= x[2];
+		// the key is injected after every 4 rounds
+		if(r % 4 == 3){
+			int s = (r + 1) / 4;
+			for(int i = 0; i < 4; i++){
+				x[i] += ks[(i + s) % 5];
+			}
+			x[3] += s;
+		}
+	}
+
+	memcpy(out, x, 4 * sizeof(unsigned));
+	return;
+}
+
+
+// word / 2^32, the division by (float)0xFFFFFFFF of the kernels
+static const floatType unitScale = 2.3283064365386963e-10f;
+static const floatType twoPi = 6.28318530717958648f;
+
+// the numbers of block g in [0, 1]
+static inline void unitBlock(unsigned g, const unsigned ctr[4], floatType u[4]){
+	unsigned key[4] = {g, g, g, g};
+	unsigned x[4];
+	threefry4x32(x, ctr, key);
+	for(int j = 0; j < 4; j++){
+		u[j] = (floatType)x[j] * unitScale;
+	}
+	return;
+}
+
+// the normal numbers of block g, of mean 0 and standard deviation 1
+static inline void normalBlock(unsigned g, const unsigned ctr[4], floatType z[4]){
+	unsigned key1[4] = {g, 0, g, 0};
+	unsigned key2[4] = {0, g, 0, g};
+	unsigned x1[4], x2[4];
+	threefry4x32(x1, ctr, key1);
+	threefry4x32(x2, ctr, key2);
+
+	// the kernel moves all four u2 away from 0 if one of them is 0
+	floatType shift = (x2[0] == 0 || x2[1] == 0 || x2[2] == 0 || x2[3] == 0) ? 0.0001f : 0.0f;
+	for(int j = 0; j < 4; j++){
+		floatType u1 = (floatType)x1[j] * unitScale;
+		floatType u2 = (floatType)x2[j] * unitScale + shift;
+		z[j] = std::cos(twoPi * u1) * std::sqrt(-2 * std::log(u2));
+	}
+	return;
+}
+
+/*
+ * The scalar functions compute the numbers first to first + n - 1, first is a multiple of 4.
+ * The states are written to bit i % 8 of bits[i / 8], the other bits of the byte are kept.
+*/
+static void uniformScalar(floatType* a, size_t first, size_t n, const unsigned ctr[4], floatType inf, floatType sup){
+	floatType u[4];
+	for(size_t i = first; i < first + n; i++){
+		if(i % 4 == 0){
+			unitBlock((unsigned)(i / 4), ctr, u);
+		}
+		a[i] = u[i % 4] * (sup - inf) + inf;
+	}
+	return;
+}
+
+static void normalScalar(floatType* a, size_t first, size_t n, const unsigned ctr[4], floatType E, floatType V){
+	floatType z[4];
+	for(size_t i = first; i < first + n; i++){
+		if(i % 4 == 0){
+			normalBlock((unsigned)(i / 4), ctr, z);
+		}
+		a[i] = z[i % 4] * V + E;
+	}
+	return;
+}
+
+static void bernoulliScalar(const floatType* p, floatType* states, unsigned char* bits, size_t first, size_t n, const unsigned ctr[4]){
+	floatType u[4];
+	for(size_t i = first; i < first + n; i++){
+		if(i % 4 == 0){
+			unitBlock((unsigned)(i / 4), ctr, u);
+		}
+		bool on = p[i] > u[i % 4];
+		if(states != NULL){
+			states[i] = on ? 1.0 : 0.0;
+		}
+		if(bits != NULL){
+			unsigned char mask = (unsigned char)(1 << (i % 8));
+			bits[i / 8] = on ? (bits[i / 8] | mask) : (bits[i / 8] & ~mask);
+		}
+	}
+	return;
+}
+
+static void gaussianScalar(const floatType* mean, floatType* states, size_t first, size_t n, const unsigned ctr[4]){
+	floatType z[4];
+	for(size_t i = first; i < first + n; i++){
+		if(i % 4 == 0){
+			normalBlock((unsigned)(i / 4), ctr, z);
+		}
+		states[i] = z[i % 4] + mean[i];
+	}
+	return;
+}
+
+/*
+ * 8 blocks per step, one block per lane, so 32 numbers. The SIMD functions compute the numbers of the whole steps
+ * from first on and return their count, the caller computes the rest with the scalar code once the upper halves
+ * of the registers are cleared.
+*/
+#define ROTL_AVX2(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+#define MIX_AVX2(x, a, b, c, d, r0, r1) \
+	x[a] = _mm256_add_epi32(x[a], x[b]); x[b] = _mm256_xor_si256(ROTL_AVX2(x[b], r0), x[a]); \
+	x[c] = _mm256_add_epi32(x[c], x[d]); x[d] = _mm256_xor_si256(ROTL_AVX2(x[d], r1), x[c]);
+
+// 4 rounds with the rotations of the rounds 0 to 3 or 4 to 7, then the key injection s
+#define ROUNDS_AVX2_0(x, ks, s) \
+	MIX_AVX2(x, 0, 1, 2, 3, 10, 26) MIX_AVX2(x, 0, 3, 2, 1, 11, 21) \
+	MIX_AVX2(x, 0, 1, 2, 3, 13, 27) MIX_AVX2(x, 0, 3, 2, 1, 23, 5) \
+	INJECT_AVX2(x, ks, s)
+#define ROUNDS_AVX2_1(x, ks, s) \
+	MIX_AVX2(x, 0, 1, 2, 3, 6, 20) MIX_AVX2(x, 0, 3, 2, 1, 17, 11) \
+	MIX_AVX2(x, 0, 1, 2, 3, 25, 10) MIX_AVX2(x, 0, 3, 2, 1, 18, 20) \
+	INJECT_AVX2(x, ks, s)
+#define INJECT_AVX2(x, ks, s) \
+	x[0] = _mm256_add_epi32(x[0], ks[(s) % 5]); x[1] = _mm256_add_epi32(x[1], ks[(s + 1) % 5]); \
+	x[2] = _mm256_add_epi32(x[2], ks[(s + 2) % 5]); \
+	x[3] = _mm256_add_epi32(_mm256_add_epi32(x[3], ks[(s + 3) % 5]), _mm256_set1_epi32(s));
+
+__attribute__((target("avx2"), always_inline))
+static inline void threefry4x32AVX2(__m256i x[4], const unsigned ctr[4], const __m256i key[4]){
+	__m256i ks[5];
+	ks[4] = _mm256_set1_epi32(0x1BD11BDA);
+	for(int i = 0; i < 4; i++){
+		ks[i] = key[i];
+		x[i] = _mm256_add_epi32(_mm256_set1_epi32(ctr[i]), key[i]);
+		ks[4] = _mm256_xor_si256(ks[4], key[i]);
+	}
+	ROUNDS_AVX2_0(x, ks, 1)
+	ROUNDS_AVX2_1(x, ks, 2)
+	ROUNDS_AVX2_0(x, ks, 3)
+	ROUNDS_AVX2_1(x, ks, 4)
+	ROUNDS_AVX2_0(x, ks, 5)
+	return;
+}
+
+/*
+ * AVX2 has no unsigned conversion: hi * 65536 is exact, so the sum with lo is rounded once, as the scalar cast
+*/
+__attribute__((target("avx2"), always_inline))
+static inline __m256 unitAVX2(__m256i x){
+	__m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 16));
+	__m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(x, _mm256_set1_epi32(0xFFFF)));
+	return _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo), _mm256_set1_ps(unitScale));
+}
+
+/*
+ * Word j of the block of lane g is number 4g + j, a 4x8 transpose: w[k] becomes the numbers 8k to 8k + 7
+*/
+__attribute__((target("avx2"), always_inline))
+static inline void transposeBlocksAVX2(__m256 w[4]){
+	__m256 t0 = _mm256_unpacklo_ps(w[0], w[1]);
+	__m256 t1 = _mm256_unpackhi_ps(w[0], w[1]);
+	__m256 t2 = _mm256_unpacklo_ps(w[2], w[3]);
+	__m256 t3 = _mm256_unpackhi_ps(w[2], w[3]);
+	__m256 q0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 q1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 q2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 q3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	w[0] = _mm256_permute2f128_ps(q0, q1, 0x20);
+	w[1] = _mm256_permute2f128_ps(q2, q3, 0x20);
+	w[2] = _mm256_permute2f128_ps(q0, q1, 0x31);
+	w[3] = _mm256_permute2f128_ps(q2, q3, 0x31);
+	return;
+}
+
+// the numbers in [0, 1] of the blocks g to g + 7, transposed
+__attribute__((target("avx2"), always_inline))
+static inline void unitStepAVX2(unsigned g, const unsigned ctr[4], __m256 w[4]){
+	__m256i lane = _mm256_add_epi32(_mm256_set1_epi32(g), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i key[4] = {lane, lane, lane, lane};
+	__m256i x[4];
+	threefry4x32AVX2(x, ctr, key);
+	for(int j = 0; j < 4; j++){
+		w[j] = unitAVX2(x[j]);
+	}
+	transposeBlocksAVX2(w);
+	return;
+}
+
+/*
+ * The states of 32 numbers from i on: p > u, stored as 1.0 or 0.0 and as the sign bits of the comparisons
+*/
+__attribute__((target("avx2"), always_inline))
+static inline void sampleStepAVX2(const floatType* p, floatType* states, unsigned char* bits, size_t i, const __m256 u[4]){
+	for(int k = 0; k < 4; k++){
+		__m256 on = _mm256_cmp_ps(_mm256_loadu_ps(p + i + 8 * k), u[k], _CMP_GT_OQ);
+		if(states != NULL){
+			_mm256_storeu_ps(states + i + 8 * k, _mm256_and_ps(on, _mm256_set1_ps(1.0f)));
+		}
+		if(bits != NULL){
+			bits[i / 8 + k] = (unsigned char)_mm256_movemask_ps(on);
+		}
+	}
+	return;
+}
+
+__attribute__((target("avx2")))
+static size_t uniformAVX2(floatType* a, size_t first, size_t n, const unsigned ctr[4], floatType inf, floatType sup){
+	size_t nBody = n & ~(size_t)31;
+	const __m256 range = _mm256_set1_ps(sup - inf);
+	const __m256 low = _mm256_set1_ps(inf);
+
+	for(size_t i = first; i < first + nBody; i += 32){
+		__m256 w[4];
+		unitStepAVX2((unsigned)(i / 4), ctr, w);
+		for(int k = 0; k < 4; k++){
+			_mm256_storeu_ps(a + i + 8 * k, _mm256_add_ps(_mm256_mul_ps(w[k], range), low));
+		}
+	}
+	return nBody;
+}
+
+__attribute__((target("avx2")))
+static size_t bernoulliAVX2(const floatType* p, floatType* states, unsigned char* bits, size_t first, size_t n, const unsigned ctr[4]){
+	size_t nBody = n & ~(size_t)31;
+
+	for(size_t i = first; i < first + nBody; i += 32){
+		__m256 u[4];
+		unitStepAVX2((unsigned)(i / 4), ctr, u);
+		sampleStepAVX2(p, states, bits, i, u);
+	}
+	return nBody;
+}
+
+/*
+ * log(x) for normal x > 0, the polynomial of the Cephes logf()
+*/
+__attribute__((target("avx2,fma")))
+static inline __m256 logAVX2(__m256 x){
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256i xi = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(xi, 23), _mm256_set1_epi32(126)));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(xi, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+
+	// m in [sqrt(1/2), sqrt(2)) - 1
+	__m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+	e = _mm256_sub_ps(e, _mm256_and_ps(small, one));
+	m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), one);
+
+	__m256 z = _mm256_mul_ps(m, m);
+	__m256 y = _mm256_set1_ps(7.0376836292e-2f);
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.1514610310e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(1.1676998740e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.2420140846e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(1.4249322787e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.6668057665e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(2.0000714765e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-2.4999993993e-1f));
+	y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(3.3333331174e-1f));
+	y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+	y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+	y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, y);
+	return _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), _mm256_add_ps(m, y));
+}
+
+/*
+ * cos(2 pi u) for u in [0, 1]: u = q / 4 + f / (2 pi) with f in [-pi / 4, pi / 4],
+ * then cos(f), -sin(f), -cos(f) or sin(f) for q mod 4, with the polynomials of the Cephes sinf() and cosf()
+*/
+__attribute__((target("avx2,fma")))
+static inline __m256 cos2PiAVX2(__m256 u){
+	__m256 t = _mm256_mul_ps(u, _mm256_set1_ps(4.0f));
+	__m256 q = _mm256_round_ps(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 f = _mm256_mul_ps(_mm256_sub_ps(t, q), _mm256_set1_ps(1.57079632679489662f));
+	__m256 z = _mm256_mul_ps(f, f);
+
+	__m256 c = _mm256_set1_ps(2.443315711809948e-5f);
+	c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(-1.388731625493765e-3f));
+	c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(4.166664568298827e-2f));
+	c = _mm256_mul_ps(_mm256_mul_ps(c, z), z);
+	c = _mm256_add_ps(_mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, c), _mm256_set1_ps(1.0f));
+
+	__m256 s = _mm256_set1_ps(-1.9515295891e-4f);
+	s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(8.3321608736e-3f));
+	s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(-1.6666654611e-1f));
+	s = _mm256_fmadd_ps(_mm256_mul_ps(s, z), f, f);
+
+	__m256i qi = _mm256_cvtps_epi32(q);
+	__m256 odd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+	__m256i sign = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30);
+	return _mm256_xor_ps(_mm256_blendv_ps(c, s, odd), _mm256_castsi256_ps(sign));
+}
+
+// the normal numbers of mean 0 and standard deviation 1 of the blocks g to g + 7, not transposed
+__attribute__((target("avx2,fma")))
+static inline void normalStepAVX2(unsigned g, const unsigned ctr[4], __m256 w[4]){
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lane = _mm256_add_epi32(_mm256_set1_epi32(g), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i key1[4] = {lane, zero, lane, zero};
+	__m256i key2[4] = {zero, lane, zero, lane};
+	__m256i x1[4], x2[4];
+	threefry4x32AVX2(x1, ctr, key1);
+	threefry4x32AVX2(x2, ctr, key2);
+
+	__m256i anyZero = zero;
+	for(int j = 0; j < 4; j++){
+		anyZero = _mm256_or_si256(anyZero, _mm256_cmpeq_epi32(x2[j], zero));
+	}
+	__m256 shift = _mm256_and_ps(_mm256_castsi256_ps(anyZero), _mm256_set1_ps(0.0001f));
+
+	for(int j = 0; j < 4; j++){
+		__m256 u2 = _mm256_add_ps(unitAVX2(x2[j]), shift);
+		__m256 r = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_set1_ps(-2.0f), logAVX2(u2)));
+		w[j] = _mm256_mul_ps(cos2PiAVX2(unitAVX2(x1[j])), r);
+	}
+	return;
+}
+
+__attribute__((target("avx2,fma")))
+static size_t normalAVX2(floatType* a, size_t first, size_t n, const unsigned ctr[4], floatType E, floatType V){
+	size_t nBody = n & ~(size_t)31;
+
+	for(size_t i = first; i < first + nBody; i += 32){
+		__m256 w[4];
+		normalStepAVX2((unsigned)(i / 4), ctr, w);
+		for(int j = 0; j < 4; j++){
+			w[j] = _mm256_fmadd_ps(w[j], _mm256_set1_ps(V), _mm256_set1_ps(E));
+		}
+		transposeBlocksAVX2(w);
+		for(int k = 0; k < 4; k++){
+			_mm256_storeu_ps(a + i + 8 * k, w[k]);
+		}
+	}
+	return nBody;
+}
+
+__attribute__((target("avx2,fma")))
+static size_t gaussianAVX2(const floatType* mean, floatType* states, size_t first, size_t n, const unsigned ctr[4]){
+	size_t nBody = n & ~(size_t)31;
+
+	for(size_t i = first; i < first + nBody; i += 32){
+		__m256 w[4];
+		normalStepAVX2((unsigned)(i / 4), ctr, w);
+		transposeBlocksAVX2(w);
+		for(int k = 0; k < 4; k++){
+			_mm256_storeu_ps(states + i + 8 * k, _mm256_add_ps(w[k], _mm256_loadu_ps(mean + i + 8 * k)));
+		}
+	}
+	return nBody;
+}
+
+/*
+ * 16 blocks per step, so 64 numbers, the halves are transposed with the AVX2 code
+*/
+#define MIX_AVX512(x, a, b, c, d, r0, r1) \
+	x[a] = _mm512_add_epi32(x[a], x[b]); x[b] = _mm512_xor_si512(_mm512_rol_epi32(x[b], r0), x[a]); \
+	x[c] = _mm512_add_epi32(x[c], x[d]); x[d] = _mm512_xor_si512(_mm512_rol_epi32(x[d], r1), x[c]);
+
+#define ROUNDS_AVX512_0(x, ks, s) \
+	MIX_AVX512(x, 0, 1, 2, 3, 10, 26) MIX_AVX512(x, 0, 3, 2, 1, 11, 21) \
+	MIX_AVX512(x, 0, 1, 2, 3, 13, 27) MIX_AVX512(x, 0, 3, 2, 1, 23, 5) \
+	INJECT_AVX512(x, ks, s)
+#define ROUNDS_AVX512_1(x, ks, s) \
+	MIX_AVX512(x, 0, 1, 2, 3, 6, 20) MIX_AVX512(x, 0, 3, 2, 1, 17, 11) \
+	MIX_AVX512(x, 0, 1, 2, 3, 25, 10) MIX_AVX512(x, 0, 3, 2, 1, 18, 20) \
+	INJECT_AVX512(x, ks, s)
+#define INJECT_AVX512(x, ks, s) \
+	x[0] = _mm512_add_epi32(x[0], ks[(s) % 5]); x[1] = _mm512_add_epi32(x[1], ks[(s + 1) % 5]); \
+	x[2] = _mm512_add_epi32(x[2], ks[(s + 2) % 5]); \
+	x[3] = _mm512_add_epi32(_mm512_add_epi32(x[3], ks[(s + 3) % 5]), _mm512_set1_epi32(s));
+
+// the numbers in [0, 1] of the blocks g to g + 15, lo holds the numbers 0 to 31 and hi the numbers 32 to 63
+__attribute__((target("avx512f"), always_inline))
+static inline void unitStepAVX512(unsigned g, const unsigned ctr[4], __m256 lo[4], __m256 hi[4]){
+	__m512i lane = _mm512_add_epi32(_mm512_set1_epi32(g), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	__m512i x[4];
+	for(int i = 0; i < 4; i++){
+		x[i] = _mm512_add_epi32(_mm512_set1_epi32(ctr[i]), lane);
+	}
+	// the four words of the key are the lane, so ks[4] is the constant
+	__m512i ks[5] = {lane, lane, lane, lane, _mm512_set1_epi32(0x1BD11BDA)};
+	ROUNDS_AVX512_0(x, ks, 1)
+	ROUNDS_AVX512_1(x, ks, 2)
+	ROUNDS_AVX512_0(x, ks, 3)
+	ROUNDS_AVX512_1(x, ks, 4)
+	ROUNDS_AVX512_0(x, ks, 5)
+
+	for(int j = 0; j < 4; j++){
+		__m512 w = _mm512_mul_ps(_mm512_cvtepu32_ps(x[j]), _mm512_set1_ps(unitScale));
+		lo[j] = _mm512_castps512_ps256(w);
+		hi[j] = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(w), 1));
+	}
+	transposeBlocksAVX2(lo);
+	transposeBlocksAVX2(hi);
+	return;
+}
+
+__attribute__((target("avx512f")))
+static size_t uniformAVX512(floatType* a, size_t first, size_t n, const unsigned ctr[4], floatType inf, floatType sup){
+	size_t nBody = n & ~(size_t)63;
+	const __m256 range = _mm256_set1_ps(sup - inf);
+	const __m256 low = _mm256_set1_ps(inf);
+
+	for(size_t i = first; i < first + nBody; i += 64){
+		__m256 lo[4], hi[4];
+		unitStepAVX512((unsigned)(i / 4), ctr, lo, hi);
+		for(int k = 0; k < 4; k++){
+			_mm256_storeu_ps(a + i + 8 * k, _mm256_add_ps(_mm256_mul_ps(lo[k], range), low));
+			_mm256_storeu_ps(a + i + 32 + 8 * k, _mm256_add_ps(_mm256_mul_ps(hi[k], range), low));
+		}
+	}
+	return nBody;
+}
+
+__attribute__((target("avx512f")))
+static size_t bernoulliAVX512(const floatType* p, floatType* states, unsigned char* bits, size_t first, size_t n, const unsigned ctr[4]){
+	size_t nBody = n & ~(size_t)63;
+
+	for(size_t i = first; i < first + nBody; i += 64){
+		__m256 lo[4], hi[4];
+		unitStepAVX512((unsigned)(i / 4), ctr, lo, hi);
+		sampleStepAVX2(p, states, bits, i, lo);
+		sampleStepAVX2(p, states, bits, i + 32, hi);
+	}
+	return nBody;
+}
+
+/*
+ * The numbers are split among the threads in tasks of whole bytes of the bitmask and whole SIMD steps.
+ * Number i depends only on i, so the numbers are the same for any number of threads.
+*/
+static const size_t nValuePerTask = 16384;
+
+void rngUniform(rngStream& stream, floatType* a, size_t n, floatType inf, floatType sup, simdLevel level){
+	unsigned ctr[4] = {stream.counter, stream.counter, stream.seed, stream.seed};
+	long nTask = (long)((n + nValuePerTask - 1) / nValuePerTask);
+	stream.counter++;
+
+	#pragma omp parallel for if(nTask > 1)
+	for(long t = 0; t < nTask; t++){
+		size_t first = t * nValuePerTask;
+		size_t count = (n - first < nValuePerTask) ? n - first : nValuePerTask;
+		size_t done = 0;
+		if(level == SIMD_AVX512){
+			done = uniformAVX512(a, first, count, ctr, inf, sup);
+		}
+		else if(level == SIMD_AVX2){
+			done = uniformAVX2(a, first, count, ctr, inf, sup);
+		}
+		uniformScalar(a, first + done, count - done, ctr, inf, sup);
+	}
+	return;
+}
+
+void rngUniform(rngStream& stream, floatType* a, size_t n, floatType inf, floatType sup){
+	rngUniform(stream, a, n, inf, sup, simdDetect());
+	return;
+}
+
+void rngNormal(rngStream& stream, floatType* a, size_t n, floatType E, floatType V, simdLevel level){
+	unsigned ctr[4] = {stream.counter, stream.counter, stream.seed, stream.seed};
+	long nTask = (long)((n + nValuePerTask - 1) / nValuePerTask);
+	stream.counter++;
+
+	#pragma omp parallel for if(nTask > 1)
+	for(long t = 0; t < nTask; t++){
+		size_t first = t * nValuePerTask;
+		size_t count = (n - first < nValuePerTask) ? n - first : nValuePerTask;
+		size_t done = 0;
+		if(level >= SIMD_AVX2){
+			done = normalAVX2(a, first, count, ctr, E, V);
+		}
+		normalScalar(a, first + done, count - done, ctr, E, V);
+	}
+	return;
+}
+
+void rngNormal(rngStream& stream, floatType* a, size_t n, floatType E, floatType V){
+	rngNormal(stream, a, n, E, V, simdDetect());
+	return;
+}
+
+void rngBernoulli(rngStream& stream, const floatType* p, floatType* states, unsigned char* bits, size_t n, simdLevel level){
+	unsigned ctr[4] = {stream.counter, stream.counter, stream.seed, stream.seed};
+	long nTask = (long)((n + nValuePerTask - 1) / nValuePerTask);
+	stream.counter++;
+
+	#pragma omp parallel for if(nTask > 1)
+	for(long t = 0; t < nTask; t++){
+		size_t first = t * nValuePerTask;
+		size_t count = (n - first < nValuePerTask) ? n - first : nValuePerTask;
+		size_t done = 0;
+		if(level == SIMD_AVX512){
+			done = bernoulliAVX512(p, states, bits, first, count, ctr);
+		}
+		else if(level == SIMD_AVX2){
+			done = bernoulliAVX2(p, states, bits, first, count, ctr);
+		}
+		bernoulliScalar(p, states, bits, first + done, count - done, ctr);
+	}
+	return;
+}
+
+void rngBernoulli(rngStream& stream, const floatType* p, floatType* states, unsigned char* bits, size_t n){
+	rngBernoulli(stream, p, states, bits, n, simdDetect());
+	return;
+}
+
+void rngGaussian(rngStream& stream, const floatType* mean, floatType* states, size_t n, simdLevel level){
+	unsigned ctr[4] = {stream.counter, stream.counter, stream.seed, stream.seed};
+	long nTask = (long)((n + nValuePerTask - 1) / nValuePerTask);
+	stream.counter++;
+
+	#pragma omp parallel for if(nTask > 1)
+	for(long t = 0; t < nTask; t++){
+		size_t first = t * nValuePerTask;
+		size_t count = (n - first < nValuePerTask) ? n - first : nValuePerTask;
+		size_t done = 0;
+		if(level >= SIMD_AVX2){
+			done = gaussianAVX2(mean, states, first, count, ctr);
+		}
+		gaussianScalar(mean, states, first + done, count - done, ctr);
+	}
+	return;
+}
+
+void rngGaussian(rngStream& stream, const floatType* mean, floatType* states, size_t n){
+	rngGaussian(stream, mean, states, n, simdDetect());
+	return;
+}
@@ -0,0 +1,73 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include "simd.h"
+
+/*
+ * The counter-based random numbers of the CPU implementation, the Threefry-4x32 generator of gpu_rbm.cl.
+ * A call draws the n numbers of one counter value of a stream: number 4g + j is word j of the block
+ * threefry4x32(ctr = {counter, counter, seed, seed}, key = {g, g, g, g}), so the numbers do not depend on
+ * the number of threads or the instruction set, and the GPU kernels give the same numbers for the same stream.
+ * Every call advances the counter of the stream by one. A stream belongs to one thread, each model has its own.
+*/
+
+// a stream of random numbers, the seed chooses the stream and the counter the next call
+struct rngStream
+{
+	unsigned seed;
+	unsigned counter;
+};
+
+// the stream of the seed, from its first call
+rngStream rngMake(unsigned seed);
+
+// the stream of a name and the global seed, e.g. the tag of a layer, so the layers of a stack draw different numbers
+rngStream rngMake(const char* name);
+
+/*
+ * The global seed of the streams made from names, 0 unless the environment variable RBM_SEED is set.
+ * Set it before the models are built to repeat or vary a run.
+*/
+unsigned rngSeed();
+void rngSetSeed(unsigned seed);
+
+/*
+ * The 64-bit key of a shuffling order of the name, the first two words of the named stream once a seed is set,
+ * otherwise the clock, so the runs without a seed still visit the data in a new order
+*/
+unsigned long long rngKey(const char* name);
+
+/*
+ * The 4-word block of the generator, threefry4x32_R() of gpu_rbm.cl with the 20 rounds the kernels are run with
+*/
+void threefry4x32(unsigned out[4], const unsigned ctr[4], const unsigned key[4]);
+
+/*
+ * n uniform numbers in [inf, sup]: word / 2^32 * (sup - inf) + inf, as the kernel PRNG_threefry4x32.
+ * The numbers in [0, 1] are the same bits for every instruction set and on the GPU.
+*/
+void rngUniform(rngStream& stream, floatType* a, size_t n, floatType inf, floatType sup);
+void rngUniform(rngStream& stream, floatType* a, size_t n, floatType inf, floatType sup, simdLevel level);
+
+/*
+ * n normal numbers of mean E and standard deviation V by the Box-Muller transform of the kernel PRNGn_threefry4x32:
+ * number 4g + j is cos(2 pi u1) * sqrt(-2 log(u2)) * V + E with u1 of key {g, 0, g, 0} and u2 of key {0, g, 0, g}.
+ * The SIMD versions use polynomials for log and cos, within a few ulp of the scalar version.
+ * The AVX-512 level runs the AVX2 code.
+*/
+void rngNormal(rngStream& stream, floatType* a, size_t n, floatType E, floatType V);
+void rngNormal(rngStream& stream, floatType* a, size_t n, floatType E, floatType V, simdLevel level);
+
+/*
+ * The sampling of the hidden states in one pass, the random numbers stay in registers:
+ * - rngBernoulli: state i is 1 if p[i] > u[i], else 0, where u are the numbers of rngUniform() in [0, 1] of the
+ *   same call, so the states are those of the kernel getStates. The states are written to states as 1.0 or 0.0
+ *   and to bit i % 8 of bits[i / 8] as packBits(), either may be NULL. A last partial byte keeps its other bits.
+ * - rngGaussian: states[i] = mean[i] + z[i], where z are the numbers of rngNormal() of mean 0 and deviation 1.
+*/
+void rngBernoulli(rngStream& stream, const floatType* p, floatType* states, unsigned char* bits, size_t n);
+void rngBernoulli(rngStream& stream, const floatType* p, floatType* states, unsigned char* bits, size_t n, simdLevel level);
+void rngGaussian(rngStream& stream, const floatType* mean, floatType* states, size_t n);
+void rngGaussian(rngStream& stream, const floatType* mean, floatType* states, size_t n, simdLevel level);
+
+#endif
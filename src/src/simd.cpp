@@ -0,0 +1,641 @@
+#include<immintrin.h>
+#include<cstring>
+#include<cmath>
+#include "simd.h"
+
+static simdLevel detectLevel(){
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")){
+		return SIMD_AVX512;
+	}
+	else if(__builtin_cpu_supports("avx2")){
+		return SIMD_AVX2;
+	}
+	return SIMD_SCALAR;
+}
+
+/*
+ * The level is probed once, the initialization of the static is thread-safe, so the
+ * loader, the pipeline and the OpenMP threads may ask at the same time
+*/
+simdLevel simdDetect(){
+	static const simdLevel level = detectLevel();
+	return level;
+}
+
+/*
+ * The scalar conversion, also used for the tail of each vector in the SIMD versions.
+ * The compiler may fuse the multiplication and the addition in the AVX-512 version,
+ * so the results of the versions can differ in the last bit.
+*/
+static void normalizeBytesScalar(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel){
+	for(unsigned v = 0; v < nVec; v++){
+		for(unsigned i = 0; i < nPixel; i++){
+			dst[i] = (floatType)src[i] * scale[i] + offset[i];
+		}
+		dst += nPixel;
+		src += nPixel;
+	}
+	return;
+}
+
+/*
+ * 8 pixels per step: zero-extend 8 bytes to 32-bit integers, convert to float, then scale and shift
+*/
+__attribute__((target("avx2")))
+static void normalizeBytesAVX2(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel){
+	unsigned nBody = nPixel & ~7u;
+
+	for(unsigned v = 0; v < nVec; v++){
+		unsigned i = 0;
+		for(; i < nBody; i += 8){
+			__m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+			__m256 f = _mm256_cvtepi32_ps(x);
+			f = _mm256_add_ps(_mm256_mul_ps(f, _mm256_loadu_ps(scale + i)), _mm256_loadu_ps(offset + i));
+			_mm256_storeu_ps(dst + i, f);
+		}
+		for(; i < nPixel; i++){
+			dst[i] = (floatType)src[i] * scale[i] + offset[i];
+		}
+		dst += nPixel;
+		src += nPixel;
+	}
+	return;
+}
+
+/*
+ * 16 pixels per step
+*/
+__attribute__((target("avx512f")))
+static void normalizeBytesAVX512(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel){
+	unsigned nBody = nPixel & ~15u;
+
+	for(unsigned v = 0; v < nVec; v++){
+		unsigned i = 0;
+		for(; i < nBody; i += 16){
+			__m512i x = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+			__m512 f = _mm512_cvtepi32_ps(x);
+			f = _mm512_add_ps(_mm512_mul_ps(f, _mm512_loadu_ps(scale + i)), _mm512_loadu_ps(offset + i));
+			_mm512_storeu_ps(dst + i, f);
+		}
+		for(; i < nPixel; i++){
+			dst[i] = (floatType)src[i] * scale[i] + offset[i];
+		}
+		dst += nPixel;
+		src += nPixel;
+	}
+	return;
+}
+
+void normalizeBytes(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel, simdLevel level){
+	switch(level){
+	case SIMD_AVX512:
+		normalizeBytesAVX512(dst, src, scale, offset, nVec, nPixel);
+		break;
+	case SIMD_AVX2:
+		normalizeBytesAVX2(dst, src, scale, offset, nVec, nPixel);
+		break;
+	default:
+		normalizeBytesScalar(dst, src, scale, offset, nVec, nPixel);
+		break;
+	}
+	return;
+}
+
+void normalizeBytes(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel){
+	normalizeBytes(dst, src, scale, offset, nVec, nPixel, simdDetect());
+	return;
+}
+
+static void poolBytes2x2Scalar(unsigned char* dst, const unsigned char* src, unsigned width, unsigned height){
+	for(unsigned y = 0; y < height / 2; y++){
+		const unsigned char* p = src + 2 * y * width;
+		for(unsigned x = 0; x < width / 2; x++){
+			unsigned sum = p[2 * x] + p[2 * x + 1] + p[width + 2 * x] + p[width + 2 * x + 1];
+			*(dst++) = (unsigned char)(sum >> 2);
+		}
+	}
+	return;
+}
+
+/*
+ * 16 pooled pixels per step: pmaddubsw with ones adds the horizontal pairs into 16-bit
+ * integers, the two rows are added and shifted, then packed back to bytes.
+ * pavgb is not used as it rounds up, the average of averages differs from the floor.
+*/
+__attribute__((target("avx2")))
+static void poolBytes2x2AVX2(unsigned char* dst, const unsigned char* src, unsigned width, unsigned height){
+	const __m256i ones = _mm256_set1_epi8(1);
+	unsigned nBody = width & ~31u;
+
+	for(unsigned y = 0; y < height / 2; y++){
+		const unsigned char* p = src + 2 * y * width;
+		unsigned x = 0;
+		for(; x < nBody; x += 32){
+			__m256i a = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(p + x)), ones);
+			__m256i b = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(p + width + x)), ones);
+			__m256i sum = _mm256_srli_epi16(_mm256_add_epi16(a, b), 2);
+			__m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+			_mm_storeu_si128((__m128i*)dst, packed);
+			dst += 16;
+		}
+		for(; x + 1 < width; x += 2){
+			unsigned sum = p[x] + p[x + 1] + p[width + x] + p[width + x + 1];
+			*(dst++) = (unsigned char)(sum >> 2);
+		}
+	}
+	return;
+}
+
+void poolBytes2x2(unsigned char* dst, const unsigned char* src, unsigned width, unsigned height, simdLevel level){
+	// AVX-512 has no gain over AVX2 for the short rows of the images
+	if(level >= SIMD_AVX2){
+		poolBytes2x2AVX2(dst, src, width, height);
+	}
+	else{
+		poolBytes2x2Scalar(dst, src, width, height);
+	}
+	return;
+}
+
+void poolBytes2x2(unsigned char* dst, const unsigned char* src, unsigned width, unsigned height){
+	poolBytes2x2(dst, src, width, height, simdDetect());
+	return;
+}
+
+size_t storageSize(storageFormat format, size_t nValue){
+	if(format == STORAGE_BITS){
+		return nValue / 8;
+	}
+	return nValue * ((format == STORAGE_FLOAT32) ? sizeof(floatType) : sizeof(unsigned short));
+}
+
+static inline unsigned floatBits(floatType f){
+	unsigned bits;
+	memcpy(&bits, &f, sizeof(unsigned));
+	return bits;
+}
+
+static inline floatType bitsFloat(unsigned bits){
+	floatType f;
+	memcpy(&f, &bits, sizeof(unsigned));
+	return f;
+}
+
+/*
+ * IEEE half to float, the subnormal halves are normalized
+*/
+static floatType fp16ToFloat(unsigned short h){
+	unsigned sign = (unsigned)(h & 0x8000) << 16;
+	unsigned exponent = (h >> 10) & 0x1f;
+	unsigned mantissa = h & 0x3ff;
+
+	if(exponent == 0x1f){
+		// infinity or NaN
+		return bitsFloat(sign | 0x7f800000 | (mantissa << 13));
+	}
+	if(exponent == 0){
+		if(mantissa == 0){
+			return bitsFloat(sign);
+		}
+		// 2^-14 * mantissa / 1024
+		exponent = 127 - 15 + 1;
+		while(!(mantissa & 0x400)){
+			mantissa <<= 1;
+			exponent--;
+		}
+		return bitsFloat(sign | (exponent << 23) | ((mantissa & 0x3ff) << 13));
+	}
+	return bitsFloat(sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+}
+
+/*
+ * float to IEEE half rounded to the nearest even, as the F16C instructions do
+*/
+static unsigned short floatToFP16(floatType f){
+	unsigned bits = floatBits(f);
+	unsigned sign = (bits >> 16) & 0x8000;
+	unsigned exponent = (bits >> 23) & 0xff;
+	unsigned mantissa = bits & 0x7fffff;
+
+	if(exponent == 0xff){
+		// infinity or a quiet NaN
+		return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 | (mantissa >> 13) : 0));
+	}
+
+	int e = (int)exponent - 127 + 15;
+	if(e >= 0x1f){
+		// overflow to infinity
+		return (unsigned short)(sign | 0x7c00);
+	}
+	if(e <= 0){
+		// a subnormal half or zero, the implicit bit is shifted in
+		if(e < -10){
+			return (unsigned short)sign;
+		}
+		mantissa |= 0x800000;
+		unsigned shift = 14 - e;
+		unsigned half = mantissa >> shift;
+		unsigned rest = mantissa & ((1u << shift) - 1);
+		unsigned midway = 1u << (shift - 1);
+		if(rest > midway || (rest == midway && (half & 1))){
+			half++;
+		}
+		return (unsigned short)(sign | half);
+	}
+
+	// a carry out of the mantissa increments the exponent, which is still correct
+	unsigned half = ((unsigned)e << 10) | (mantissa >> 13);
+	unsigned rest = mantissa & 0x1fff;
+	if(rest > 0x1000 || (rest == 0x1000 && (half & 1))){
+		half++;
+	}
+	return (unsigned short)(sign | half);
+}
+
+static inline floatType bf16ToFloat(unsigned short h){
+	return bitsFloat((unsigned)h << 16);
+}
+
+static inline unsigned short floatToBF16(floatType f){
+	unsigned bits = floatBits(f);
+	if((bits & 0x7fffffff) > 0x7f800000){
+		// keep NaN a quiet NaN
+		return (unsigned short)((bits >> 16) | 0x40);
+	}
+	bits += 0x7fff + ((bits >> 16) & 1);
+	return (unsigned short)(bits >> 16);
+}
+
+static void halfToFloatScalar(floatType* dst, const unsigned short* src, size_t n, storageFormat format){
+	for(size_t i = 0; i < n; i++){
+		dst[i] = (format == STORAGE_BF16) ? bf16ToFloat(src[i]) : fp16ToFloat(src[i]);
+	}
+	return;
+}
+
+static void floatToHalfScalar(unsigned short* dst, const floatType* src, size_t n, storageFormat format){
+	for(size_t i = 0; i < n; i++){
+		dst[i] = (format == STORAGE_BF16) ? floatToBF16(src[i]) : floatToFP16(src[i]);
+	}
+	return;
+}
+
+/*
+ * 8 values per step, the bf16 values are widened and shifted to the upper half of the float.
+ * The AVX2 conversions return the number of values converted, the caller converts the rest with
+ * the scalar code: a tail call from here would skip the vzeroupper and slow down the SSE code after it.
+*/
+__attribute__((target("avx2,f16c")))
+static size_t halfToFloatAVX2(floatType* dst, const unsigned short* src, size_t n, storageFormat format){
+	size_t nBody = n & ~(size_t)7;
+	if(format == STORAGE_BF16){
+		for(size_t i = 0; i < nBody; i += 8){
+			__m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+			_mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+		}
+	}
+	else{
+		for(size_t i = 0; i < nBody; i += 8){
+			_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+		}
+	}
+	return nBody;
+}
+
+/*
+ * The rounding of bf16 adds 0x7fff plus the lowest kept bit, the NaNs are left to the scalar code
+*/
+__attribute__((target("avx2,f16c")))
+static size_t floatToHalfAVX2(unsigned short* dst, const floatType* src, size_t n, storageFormat format){
+	size_t nBody = n & ~(size_t)7;
+	if(format == STORAGE_BF16){
+		const __m256i bias = _mm256_set1_epi32(0x7fff);
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i absMask = _mm256_set1_epi32(0x7fffffff);
+		const __m256i infinity = _mm256_set1_epi32(0x7f800000);
+		for(size_t i = 0; i < nBody; i += 8){
+			__m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+			if(!_mm256_testz_si256(_mm256_cmpgt_epi32(_mm256_and_si256(x, absMask), infinity), _mm256_set1_epi32(-1))){
+				floatToHalfScalar(dst + i, src + i, 8, format);
+				continue;
+			}
+			__m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), one);
+			x = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(bias, lsb)), 16);
+			// pack the 32-bit lanes to 16 bits, the values fit so there is no saturation
+			__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+			_mm_storeu_si128((__m128i*)(dst + i), packed);
+		}
+	}
+	else{
+		for(size_t i = 0; i < nBody; i += 8){
+			__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+			_mm_storeu_si128((__m128i*)(dst + i), h);
+		}
+	}
+	return nBody;
+}
+
+void halfToFloat(floatType* dst, const unsigned short* src, size_t n, storageFormat format, simdLevel level){
+	// the AVX2 code is used on AVX-512 CPUs as well, the conversion is bound by the memory
+	size_t done = 0;
+	if(level >= SIMD_AVX2){
+		done = halfToFloatAVX2(dst, src, n, format);
+	}
+	halfToFloatScalar(dst + done, src + done, n - done, format);
+	return;
+}
+
+void halfToFloat(floatType* dst, const unsigned short* src, size_t n, storageFormat format){
+	halfToFloat(dst, src, n, format, simdDetect());
+	return;
+}
+
+void floatToHalf(unsigned short* dst, const floatType* src, size_t n, storageFormat format, simdLevel level){
+	size_t done = 0;
+	if(level >= SIMD_AVX2){
+		done = floatToHalfAVX2(dst, src, n, format);
+	}
+	floatToHalfScalar(dst + done, src + done, n - done, format);
+	return;
+}
+
+void floatToHalf(unsigned short* dst, const floatType* src, size_t n, storageFormat format){
+	floatToHalf(dst, src, n, format, simdDetect());
+	return;
+}
+
+static void packBitsScalar(unsigned char* dst, const floatType* src, size_t n){
+	for(size_t i = 0; i < n / 8; i++){
+		unsigned char byte = 0;
+		for(unsigned j = 0; j < 8; j++){
+			byte |= (src[8 * i + j] > 0.5f) << j;
+		}
+		dst[i] = byte;
+	}
+	return;
+}
+
+static void unpackBitsScalar(floatType* dst, const unsigned char* src, size_t n){
+	for(size_t i = 0; i < n; i++){
+		dst[i] = (src[i >> 3] >> (i & 7)) & 1;
+	}
+	return;
+}
+
+/*
+ * The sign bits of the comparisons of 8 values are one byte
+*/
+__attribute__((target("avx2")))
+static void packBitsAVX2(unsigned char* dst, const floatType* src, size_t n){
+	const __m256 half = _mm256_set1_ps(0.5f);
+	for(size_t i = 0; i < n / 8; i++){
+		dst[i] = (unsigned char)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(src + 8 * i), half, _CMP_GT_OQ));
+	}
+	return;
+}
+
+/*
+ * A byte is broadcast to 8 lanes and each lane tests its own bit
+*/
+__attribute__((target("avx2")))
+static void unpackBitsAVX2(floatType* dst, const unsigned char* src, size_t n){
+	const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	size_t nByte = n / 8;
+	for(size_t i = 0; i < nByte; i++){
+		__m256i x = _mm256_and_si256(_mm256_set1_epi32(src[i]), bit);
+		__m256 mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(x, bit));
+		_mm256_storeu_ps(dst + 8 * i, _mm256_and_ps(mask, one));
+	}
+	for(size_t i = 8 * nByte; i < n; i++){
+		dst[i] = (src[i >> 3] >> (i & 7)) & 1;
+	}
+	return;
+}
+
+void packBits(unsigned char* dst, const floatType* src, size_t n, simdLevel level){
+	if(level >= SIMD_AVX2){
+		packBitsAVX2(dst, src, n);
+	}
+	else{
+		packBitsScalar(dst, src, n);
+	}
+	return;
+}
+
+void packBits(unsigned char* dst, const floatType* src, size_t n){
+	packBits(dst, src, n, simdDetect());
+	return;
+}
+
+void unpackBits(floatType* dst, const unsigned char* src, size_t n, simdLevel level){
+	if(level >= SIMD_AVX2){
+		unpackBitsAVX2(dst, src, n);
+	}
+	else{
+		unpackBitsScalar(dst, src, n);
+	}
+	return;
+}
+
+void unpackBits(floatType* dst, const unsigned char* src, size_t n){
+	unpackBits(dst, src, n, simdDetect());
+	return;
+}
+
+static void sigmoidExact(floatType* a, size_t n){
+	for(size_t i = 0; i < n; i++){
+		a[i] = 1 / (1 + std::exp(-a[i]));
+	}
+	return;
+}
+
+/*
+ * exp(-x) = 2^k * exp(r) with k = round(-x / ln2) and r = -x - k * ln2 in [-ln2 / 2, ln2 / 2],
+ * ln2 split in two constants so k * ln2 is exact. exp(r) is the polynomial of the Cephes expf().
+ * -x is clamped to [-87, 87], where the sigmoid is 0 or 1 within a float.
+*/
+static const floatType expLimit = 87.0f;
+static const floatType log2e = 1.44269504088896341f;
+static const floatType ln2Hi = 0.693359375f;
+static const floatType ln2Lo = -2.12194440e-4f;
+static const floatType expPoly[6] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+static inline floatType sigmoidPolyScalar(floatType a){
+	floatType x = -a;
+	if(!(x > -expLimit)){
+		x = -expLimit;
+	}
+	if(x > expLimit){
+		x = expLimit;
+	}
+	floatType k = floorf(x * log2e + 0.5f);
+	floatType r = x - k * ln2Hi - k * ln2Lo;
+	floatType p = expPoly[0];
+	for(int i = 1; i < 6; i++){
+		p = p * r + expPoly[i];
+	}
+	floatType e = (p * r * r + r + 1) * bitsFloat((unsigned)((int)k + 127) << 23);
+	return 1 / (1 + e);
+}
+
+/*
+ * The table holds the sigmoid at x = -16 + i / 64 for i = 0..2048 and a copy of the last value,
+ * so the right neighbour of x = 16 is in the table. Outside [-16, 16] the sigmoid is within
+ * 1.2e-7 of the value at the end of the table.
+*/
+static const floatType sigmoidTableRange = 16.0f;
+static const floatType sigmoidTableStep = 64.0f;
+static const unsigned nSigmoidTableSize = 2 * 16 * 64 + 2;
+
+struct sigmoidTable
+{
+	floatType value[nSigmoidTableSize];
+
+	sigmoidTable(){
+		for(unsigned i = 0; i < nSigmoidTableSize - 1; i++){
+			value[i] = (floatType)(1 / (1 + exp(-(i / (double)sigmoidTableStep - sigmoidTableRange))));
+		}
+		value[nSigmoidTableSize - 1] = value[nSigmoidTableSize - 2];
+	}
+};
+
+static const sigmoidTable sigmoidTab;
+
+static inline floatType sigmoidTableScalar(floatType a){
+	floatType x = a;
+	if(!(x > -sigmoidTableRange)){
+		x = -sigmoidTableRange;
+	}
+	if(x > sigmoidTableRange){
+		x = sigmoidTableRange;
+	}
+	floatType t = (x + sigmoidTableRange) * sigmoidTableStep;
+	int i = (int)t;
+	floatType f = t - i;
+	return sigmoidTab.value[i] + f * (sigmoidTab.value[i + 1] - sigmoidTab.value[i]);
+}
+
+static void sigmoidScalar(floatType* a, size_t n, sigmoidMode mode){
+	if(mode == SIGMOID_POLY){
+		for(size_t i = 0; i < n; i++){
+			a[i] = sigmoidPolyScalar(a[i]);
+		}
+	}
+	else{
+		for(size_t i = 0; i < n; i++){
+			a[i] = sigmoidTableScalar(a[i]);
+		}
+	}
+	return;
+}
+
+/*
+ * 8 values per step, the AVX2 CPUs all have FMA as well; 2^k is built in the exponent bits.
+ * max() and min() return the limit for NaN, so the gathers of the table stay in range.
+*/
+__attribute__((target("avx2,fma")))
+static void sigmoidAVX2(floatType* a, size_t n, sigmoidMode mode){
+	size_t nBody = n & ~(size_t)7;
+	size_t i = 0;
+
+	if(mode == SIGMOID_POLY){
+		const __m256 one = _mm256_set1_ps(1.0f);
+		for(; i < nBody; i += 8){
+			__m256 x = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(a + i));
+			x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-expLimit)), _mm256_set1_ps(expLimit));
+			__m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			__m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(ln2Hi), x);
+			r = _mm256_fnmadd_ps(k, _mm256_set1_ps(ln2Lo), r);
+			__m256 p = _mm256_set1_ps(expPoly[0]);
+			for(int j = 1; j < 6; j++){
+				p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(expPoly[j]));
+			}
+			p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, one));
+			__m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23);
+			__m256 e = _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+			_mm256_storeu_ps(a + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+		}
+	}
+	else{
+		for(; i < nBody; i += 8){
+			__m256 x = _mm256_max_ps(_mm256_loadu_ps(a + i), _mm256_set1_ps(-sigmoidTableRange));
+			x = _mm256_min_ps(x, _mm256_set1_ps(sigmoidTableRange));
+			__m256 t = _mm256_mul_ps(_mm256_add_ps(x, _mm256_set1_ps(sigmoidTableRange)), _mm256_set1_ps(sigmoidTableStep));
+			__m256i index = _mm256_cvttps_epi32(t);
+			__m256 f = _mm256_sub_ps(t, _mm256_cvtepi32_ps(index));
+			__m256 v0 = _mm256_i32gather_ps(sigmoidTab.value, index, 4);
+			__m256 v1 = _mm256_i32gather_ps(sigmoidTab.value + 1, index, 4);
+			_mm256_storeu_ps(a + i, _mm256_fmadd_ps(f, _mm256_sub_ps(v1, v0), v0));
+		}
+	}
+	sigmoidScalar(a + i, n - i, mode);
+	return;
+}
+
+/*
+ * 16 values per step, 2^k is applied by scalef()
+*/
+__attribute__((target("avx512f")))
+static void sigmoidAVX512(floatType* a, size_t n, sigmoidMode mode){
+	size_t nBody = n & ~(size_t)15;
+	size_t i = 0;
+
+	if(mode == SIGMOID_POLY){
+		const __m512 one = _mm512_set1_ps(1.0f);
+		for(; i < nBody; i += 16){
+			__m512 x = _mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(a + i));
+			x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-expLimit)), _mm512_set1_ps(expLimit));
+			__m512 k = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			__m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(ln2Hi), x);
+			r = _mm512_fnmadd_ps(k, _mm512_set1_ps(ln2Lo), r);
+			__m512 p = _mm512_set1_ps(expPoly[0]);
+			for(int j = 1; j < 6; j++){
+				p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(expPoly[j]));
+			}
+			p = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, _mm512_add_ps(r, one));
+			__m512 e = _mm512_scalef_ps(p, k);
+			_mm512_storeu_ps(a + i, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+		}
+	}
+	else{
+		for(; i < nBody; i += 16){
+			__m512 x = _mm512_max_ps(_mm512_loadu_ps(a + i), _mm512_set1_ps(-sigmoidTableRange));
+			x = _mm512_min_ps(x, _mm512_set1_ps(sigmoidTableRange));
+			__m512 t = _mm512_mul_ps(_mm512_add_ps(x, _mm512_set1_ps(sigmoidTableRange)), _mm512_set1_ps(sigmoidTableStep));
+			__m512i index = _mm512_cvttps_epi32(t);
+			__m512 f = _mm512_sub_ps(t, _mm512_cvtepi32_ps(index));
+			__m512 v0 = _mm512_i32gather_ps(index, sigmoidTab.value, 4);
+			__m512 v1 = _mm512_i32gather_ps(index, sigmoidTab.value + 1, 4);
+			_mm512_storeu_ps(a + i, _mm512_fmadd_ps(f, _mm512_sub_ps(v1, v0), v0));
+		}
+	}
+	sigmoidScalar(a + i, n - i, mode);
+	return;
+}
+
+/*
+ * Without SIMD the polynomial is slower than exp() of the C library, which is as accurate,
+ * so the scalar polynomial only computes the tails of the SIMD versions.
+*/
+void sigmoid(floatType* a, size_t n, sigmoidMode mode, simdLevel level){
+	if(mode == SIGMOID_EXACT || (mode == SIGMOID_POLY && level == SIMD_SCALAR)){
+		sigmoidExact(a, n);
+	}
+	else if(level == SIMD_AVX512){
+		sigmoidAVX512(a, n, mode);
+	}
+	else if(level == SIMD_AVX2){
+		sigmoidAVX2(a, n, mode);
+	}
+	else{
+		sigmoidScalar(a, n, mode);
+	}
+	return;
+}
+
+void sigmoid(floatType* a, size_t n, sigmoidMode mode){
+	sigmoid(a, n, mode, simdDetect());
+	return;
+}
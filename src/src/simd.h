@@ -0,0 +1,99 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <cstddef>
+
+/*
+ * Vectorized CPU kernels for the data pipeline.
+ * Each kernel checks the CPU at run time and uses the widest instruction set available
+ * (AVX-512, AVX2), falling back to the scalar version on older CPUs.
+ * This header does not depend on ACML or OpenCL, so the kernels can be benchmarked alone.
+*/
+
+// float points precision, the same as in utils.h
+typedef float floatType;
+
+// the instruction sets the kernels can be dispatched to
+enum simdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_AVX2 = 1,
+	SIMD_AVX512 = 2
+};
+
+// return the widest instruction set supported by the CPU
+simdLevel simdDetect();
+
+/*
+ * Convert nVec byte vectors of nPixel pixels to float-point vectors:
+ * dst[v * nPixel + i] = src[v * nPixel + i] * scale[i] + offset[i]
+ * With scale[i] = 1 / (255 * stdvar[i]) and offset[i] = -mean[i] / stdvar[i] this is the
+ * normalization (x / 255 - mean) / stdvar of the data provider.
+*/
+void normalizeBytes(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel);
+
+// the same conversion with a given instruction set, used by the benchmark
+void normalizeBytes(floatType* dst, const unsigned char* src, const floatType* scale, const floatType* offset, unsigned nVec, unsigned nPixel, simdLevel level);
+
+/*
+ * 2x2 average pooling of a width x height byte image, the result is (width / 2) x (height / 2):
+ * dst[y * width / 2 + x] = (src[2y][2x] + src[2y][2x + 1] + src[2y + 1][2x] + src[2y + 1][2x + 1]) >> 2
+ * The sums are exact, so every instruction set gives the same bytes.
+*/
+void poolBytes2x2(unsigned char* dst, const unsigned char* src, unsigned width, unsigned height);
+
+// the same pooling with a given instruction set, used by the benchmark
+void poolBytes2x2(unsigned char* dst, const unsigned char* src, unsigned width, unsigned height, simdLevel level);
+
+// the formats of the float-point values in the files
+enum storageFormat
+{
+	STORAGE_FLOAT32 = 0,	// 32-bit IEEE float
+	STORAGE_FP16 = 1,		// 16-bit IEEE half, 11 significant bits
+	STORAGE_BF16 = 2,		// the upper 16 bits of a float, 8 significant bits and the range of a float
+	STORAGE_BITS = 3		// one bit per value for the sampled binary states, the vectors are multiples of 8 long
+};
+
+// the bytes of nValue values in the format, nValue is a multiple of 8 for STORAGE_BITS
+size_t storageSize(storageFormat format, size_t nValue);
+
+/*
+ * Convert n 16-bit values of the format to float-point, the conversion is exact.
+ * The AVX2 version uses the F16C instructions, which every AVX2 CPU has.
+*/
+void halfToFloat(floatType* dst, const unsigned short* src, size_t n, storageFormat format);
+void halfToFloat(floatType* dst, const unsigned short* src, size_t n, storageFormat format, simdLevel level);
+
+/*
+ * Convert n float-point values to 16-bit values of the format, rounded to the nearest even.
+ * Every instruction set gives the same bits.
+*/
+void floatToHalf(unsigned short* dst, const floatType* src, size_t n, storageFormat format);
+void floatToHalf(unsigned short* dst, const floatType* src, size_t n, storageFormat format, simdLevel level);
+
+
+/*
+ * Pack n binary values into n / 8 bytes, bit j of dst[i] is 1 if src[8i + j] > 0.5.
+ * n is a multiple of 8.
+*/
+void packBits(unsigned char* dst, const floatType* src, size_t n);
+void packBits(unsigned char* dst, const floatType* src, size_t n, simdLevel level);
+
+// expand n bits packed by packBits() to the float-point values 0 and 1
+void unpackBits(floatType* dst, const unsigned char* src, size_t n);
+void unpackBits(floatType* dst, const unsigned char* src, size_t n, simdLevel level);
+
+// the accuracy of the sigmoid, chosen per model; the errors are absolute, the sigmoid is in [0, 1]
+enum sigmoidMode
+{
+	SIGMOID_EXACT = 0,	// exp() of the C library, not vectorized
+	SIGMOID_POLY = 1,	// exp by range reduction and a degree-6 polynomial, max error 8.9e-8 as exp()
+	SIGMOID_TABLE = 2	// linear interpolation between 64 values per unit on [-16, 16], max error 3.1e-6,
+						// faster than SIGMOID_POLY only without SIMD
+};
+
+// a[i] = 1 / (1 + exp(-a[i])) for n values
+void sigmoid(floatType* a, size_t n, sigmoidMode mode);
+void sigmoid(floatType* a, size_t n, sigmoidMode mode, simdLevel level);
+
+#endif
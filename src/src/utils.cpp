@@ -1,7 +1,9 @@
 #include "utils.h"
+#ifdef _AMD_GPU_
 #include "kat.h"
+#endif
 #include<cstring>
-#include<ctime>
+#include<cmath>
 
 /*
  * Clear the buffer a, which contains n float point entries.
@@ -12,11 +14,16 @@ void reset(floatType* a, unsigned int n){
 	return;
 }
 
-void gpu_reset(CL_ENV gpu_env, cl_kernel ker_reset, cl_mem a, unsigned n, cl_event* event){
-	clSetKernelArg(ker_reset, 0, sizeof(cl_mem), (void*)&a);
-	clSetKernelArg(ker_reset, 1, sizeof(cl_uint), (void*)&n);
-	size_t globalws[1] = {n};
-	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_reset, 1, NULL, globalws, NULL, 0, NULL, NULL);
+/*
+ * The helpers below draw from one stream of the global seed, each call takes the next counter value,
+ * so concurrent calls draw different numbers
+*/
+static unsigned nRandomCall = 0;
+
+static rngStream nextStream(){
+	rngStream stream = rngMake("utils");
+	stream.counter = __sync_fetch_and_add(&nRandomCall, 1);
+	return stream;
 }
 
 /*
@@ -25,23 +32,157 @@ void gpu_reset(CL_ENV gpu_env, cl_kernel ker_reset, cl_mem a, unsigned n, cl_eve
  * of elements in the a[.] is denoted by n.
 */ 
 void randomInit(floatType* a, unsigned int n, floatType inf, floatType sup){
-	srand(time(NULL));
+	rngStream stream = nextStream();
+	rngUniform(stream, a, n, inf, sup);
+	return;
+}
 
-	for(int i = 0; i < n; i++)
-		a[i] = (rand() / (floatType)RAND_MAX) * (sup - inf) + inf;
+/*
+ * Set elements in the input vector with random numbers of a normal distribution
+ * N ( miu=E, std=V ). The input argument a[] contains the results after calling 
+ * this function. The number of elements in the a[.] is denoted by n.
+*/ 
+void gaussInit(floatType* a, unsigned int n, floatType E, floatType V){
+	rngStream stream = nextStream();
+	rngNormal(stream, a, n, E, V);
 	return;
 }
 
-void gpu_randomInit(CL_ENV gpu_env, cl_kernel ker_rand, cl_mem a, unsigned int n, floatType inf, floatType sup, cl_event* event){
+floatType gaussRand(floatType E, floatType V){
+	floatType X;
+	rngStream stream = nextStream();
+	rngNormal(stream, &X, 1, E, V);
+	return X;
+}
 
-	gpu_random(gpu_env, ker_rand, a, n, inf, sup, NULL); // ker_rand looks better
+/*
+ * This function resets prob and adds bias to prob: bias is a layerSize-dim vector 
+ * and prob is an nVectorPerBatch x layerSize matrix. The addition simply replicate
+ * the bias nVectorPerBatch times to form the prob matrix.
+*/
+void addBias(floatType* prob, floatType* bias, unsigned int layerSize, unsigned int nVectorPerBatch){
+	for(int i = 0; i < layerSize; i++){
+		floatType t = bias[i];
+		for(int j = 0; j < nVectorPerBatch; j++){
+			prob[j * layerSize + i] = t;
+		}
+	}
+	return;
 }
 
-void gpu_random(CL_ENV gpu_env, cl_kernel ker_rand, cl_mem a, unsigned int n, floatType inf, floatType sup, cl_event* event){
-	static unsigned c = 0;
+/*
+ * prob is an nVectorPerBatch x layerSize matrix and sum is a layerSize-dim vector.
+ * This function sums each row of prob and stores it in sum
+*/
+
+void sumBatch(floatType* prob, floatType* sum, unsigned int layerSize, unsigned nVectorPerBatch){
+	// the vectors are read one after another, the sums are added in the same order
+	reset(sum, layerSize);
+	for(int j = 0; j < nVectorPerBatch; j++){
+		for(int i = 0; i < layerSize; i++){
+			sum[i] += prob[j * layerSize + i];
+		}
+	}
+	return;
+}
+
+/*
+ * This function returns the Euclidean distance between vector/matrix a and b.
+ * Both a and b have a length of n. 
+*/
+
+floatType EuDist(floatType* a, floatType* b, unsigned int n){
+	floatType result = 0.0;
+	for(int i = 0; i < n; i++){
+		result += (a[i] - b[i]) * (a[i] - b[i]);
+	}
+	return result;
+}
+
+/*
+ * The same distance between x * scale + offset and b, where x and b are nVectorPerBatch x layerSize
+ * matrices and scale and offset are layerSize-dim vectors. x is the input of a folded layer.
+*/
+floatType foldedEuDist(floatType* x, floatType* b, floatType* scale, floatType* offset, unsigned int layerSize, unsigned int nVectorPerBatch){
+	floatType result = 0.0;
+	for(int j = 0; j < nVectorPerBatch; j++){
+		for(int i = 0; i < layerSize; i++){
+			floatType d = x[j * layerSize + i] * scale[i] + offset[i] - b[j * layerSize + i];
+			result += d * d;
+		}
+	}
+	return result;
+}
+
+/*
+ * log out data as a csv file
+*/
+void logData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum){
+	ofstream fout;
+	fout.open(filename.c_str(), ios_base::trunc);
+	for(int i = 0; i < Length; i++){
+		fout << data[i * nImageNum];
+		if((i + 1) % stride == 0)
+			fout << endl;
+		else
+			fout << ',';
+	}
+	fout.close();
+	return;
+}
+
+/*
+ * log out data as binary file
+*/
+
+void logBinaryData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum){
+	ofstream fout;
+	fout.open(filename.c_str(), ios_base::trunc | ios_base::binary);
+	fout.write((char*)data, Length * nImageNum);
+	fout.close();
+	return;
+}
+
+/*
+ * load kernel source from an OpenCL source file for runtime compiling
+*/
+void loadKernelSource(string filename, char* source){
+	ifstream fin;
+	string srt;
+	fin.open(filename.c_str(), ios_base::in);
+	char t[500];
+	while(fin.getline(t, 500)){
+		srt.append(t);
+		srt.push_back('\n');
+	}
+	for(int i = 0; i < srt.length(); i++)
+		source[i] = srt[i];
+	source[srt.length()] = 0;
+	return;
+}
+
+/*
+ * The GPU implementation, see gpu_rbm.cl for the kernels.
+*/
+#ifdef _AMD_GPU_
+
+void gpu_reset(CL_ENV gpu_env, cl_kernel ker_reset, cl_mem a, unsigned n, cl_event* event){
+	clSetKernelArg(ker_reset, 0, sizeof(cl_mem), (void*)&a);
+	clSetKernelArg(ker_reset, 1, sizeof(cl_uint), (void*)&n);
+	size_t globalws[1] = {n};
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_reset, 1, NULL, globalws, NULL, 0, NULL, NULL);
+}
+
+void gpu_randomInit(CL_ENV gpu_env, cl_kernel ker_rand, cl_mem a, unsigned int n, floatType inf, floatType sup, rngStream& stream, cl_event* event){
+
+	gpu_random(gpu_env, ker_rand, a, n, inf, sup, stream, NULL); // ker_rand looks better
+}
+
+void gpu_random(CL_ENV gpu_env, cl_kernel ker_rand, cl_mem a, unsigned int n, floatType inf, floatType sup, rngStream& stream, cl_event* event){
 	unsigned nrounds = 20;
 	array4x32	rndctr4;
-	rndctr4.v[0] = rndctr4.v[1] = rndctr4.v[2] = rndctr4.v[3] = c++;
+	rndctr4.v[0] = rndctr4.v[1] = stream.counter++;
+	rndctr4.v[2] = rndctr4.v[3] = stream.seed;
 	cl_uint size = n / 4;
 
 	clSetKernelArg(ker_rand, 0, sizeof(cl_mem), 	(void*)&a);
@@ -54,52 +195,12 @@ void gpu_random(CL_ENV gpu_env, cl_kernel ker_rand, cl_mem a, unsigned int n, fl
 	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_rand, 1, NULL, globalws, NULL, 0, NULL, NULL);
 }
 
+void gpu_gaussInit(CL_ENV gpu_env, cl_kernel ker_randn, cl_mem a, unsigned int n, floatType E, floatType V, rngStream& stream, cl_event* event){
 
-/*
- * Set elements in the input vector with random numbers of a normal distribution
- * N ( miu=E, std=V ). The input argument a[] contains the results after calling 
- * this function. The number of elements in the a[.] is denoted by n.
-*/ 
-void gaussInit(floatType* a, unsigned int n, floatType E, floatType V){
-	srand(time(NULL));
-	
-	for(int i = 0; i < n; i++)
-		a[i] = gaussRand(E, V);
-	return;
-}
-
-
-floatType gaussRand(floatType E, floatType V){
-    static double V1, V2, S;
-    static int phase = 0;
-    floatType X;
-     
-    if ( phase == 0 ) {
-
-        do {
-            double U1 = (double)rand() / RAND_MAX;
-            double U2 = (double)rand() / RAND_MAX;
-             
-            V1 = 2 * U1 - 1;
-            V2 = 2 * U2 - 1;
-            S = V1 * V1 + V2 * V2;
-        } while(S >= 1 || S == 0);
-         
-        X = V1 * sqrt(-2 * log(S) / S);
-    } else
-        X = V2 * sqrt(-2 * log(S) / S);
-         
-    phase = 1 - phase;
- 
-    return X * V + E;
-}
-
-void gpu_gaussInit(CL_ENV gpu_env, cl_kernel ker_randn, cl_mem a, unsigned int n, floatType E, floatType V, cl_event* event){
-
-	static unsigned c = 0;
 	unsigned nrounds = 20;
 	array4x32	rndctr4;
-	rndctr4.v[0] = rndctr4.v[1] = rndctr4.v[2] = rndctr4.v[3] = c++;
+	rndctr4.v[0] = rndctr4.v[1] = stream.counter++;
+	rndctr4.v[2] = rndctr4.v[3] = stream.seed;
 	cl_uint size = n / 4;
 
 	clSetKernelArg(ker_randn, 0, sizeof(cl_mem), 	(void*)&a);
@@ -128,41 +229,74 @@ void gpu_squareError(CL_ENV gpu_env, cl_kernel ker_quad, cl_mem a, cl_mem b, cl_
 	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_quad, 1, NULL, globalws, NULL, 0, NULL, NULL);
 }
 
+void gpu_sigmoid(CL_ENV gpu_env, cl_kernel ker_sigmoid, cl_mem a, unsigned int n, cl_event* event){
+	clSetKernelArg(ker_sigmoid, 0, sizeof(cl_mem), (void*)&a);
+	clSetKernelArg(ker_sigmoid, 1, sizeof(unsigned int), (void*)&n);
+	size_t globalws[1] = {n};
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_sigmoid, 1, NULL, globalws, NULL, 0, NULL, event);
+}
+
+void gpu_floatToHalf(CL_ENV gpu_env, cl_kernel ker_half, cl_mem dst, cl_mem src, storageFormat format, unsigned int n, cl_event* event){
+	unsigned int bf16 = (format == STORAGE_BF16) ? 1 : 0;
+	clSetKernelArg(ker_half, 0, sizeof(cl_mem), (void*)&dst);
+	clSetKernelArg(ker_half, 1, sizeof(cl_mem), (void*)&src);
+	clSetKernelArg(ker_half, 2, sizeof(unsigned int), (void*)&bf16);
+	clSetKernelArg(ker_half, 3, sizeof(unsigned int), (void*)&n);
+	size_t globalws[1] = {n};
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_half, 1, NULL, globalws, NULL, 0, NULL, event);
+}
 
+void gpu_packBits(CL_ENV gpu_env, cl_kernel ker_pack, cl_mem dst, cl_mem src, unsigned int n, cl_event* event){
+	unsigned int nByte = n / 8;
+	clSetKernelArg(ker_pack, 0, sizeof(cl_mem), (void*)&dst);
+	clSetKernelArg(ker_pack, 1, sizeof(cl_mem), (void*)&src);
+	clSetKernelArg(ker_pack, 2, sizeof(unsigned int), (void*)&nByte);
+	size_t globalws[1] = {nByte};
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_pack, 1, NULL, globalws, NULL, 0, NULL, event);
+}
 
 /*
- * Return the results of sigmoid function with the values in the input vector a[.].
- * The input argument a[.] contains the input values before the calculation and the 
- * results after calling this function. The argument n is the number of elements in
- * the input argument a[.].
+ * Normalize the bytes src[srcOffset .. srcOffset + n) into dst with the per-pixel
+ * coefficients dst = src * scale + offset, the vectors are nPixel bytes long.
 */
-void sigmoid(floatType* a, unsigned int n){
-	for(int i = 0; i < n; i++){
-		a[i] = 1 / (1 + exp(-a[i]));
-	}
-	return;
+void gpu_normalizeBytes(CL_ENV gpu_env, cl_kernel ker_norm, cl_mem dst, cl_mem src, unsigned int srcOffset, cl_mem scale, cl_mem offset, unsigned int nPixel, unsigned int n, cl_event* event){
+	clSetKernelArg(ker_norm, 0, sizeof(cl_mem), (void*)&dst);
+	clSetKernelArg(ker_norm, 1, sizeof(cl_mem), (void*)&src);
+	clSetKernelArg(ker_norm, 2, sizeof(unsigned int), (void*)&srcOffset);
+	clSetKernelArg(ker_norm, 3, sizeof(cl_mem), (void*)&scale);
+	clSetKernelArg(ker_norm, 4, sizeof(cl_mem), (void*)&offset);
+	clSetKernelArg(ker_norm, 5, sizeof(unsigned int), (void*)&nPixel);
+	clSetKernelArg(ker_norm, 6, sizeof(unsigned int), (void*)&n);
+	size_t globalws[1] = {n};
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_norm, 1, NULL, globalws, NULL, 0, NULL, event);
 }
 
-void gpu_sigmoid(CL_ENV gpu_env, cl_kernel ker_sigmoid, cl_mem a, unsigned int n, cl_event* event){
-	clSetKernelArg(ker_sigmoid, 0, sizeof(cl_mem), (void*)&a);
-	clSetKernelArg(ker_sigmoid, 1, sizeof(unsigned int), (void*)&n);
+/*
+ * Gather the vectors index[0], index[1], ... of src into dst, n is the number of entries of dst
+*/
+void gpu_gatherVectors(CL_ENV gpu_env, cl_kernel ker_gather, cl_mem dst, cl_mem src, cl_mem index, unsigned int nPixel, unsigned int n, cl_event* event){
+	clSetKernelArg(ker_gather, 0, sizeof(cl_mem), (void*)&dst);
+	clSetKernelArg(ker_gather, 1, sizeof(cl_mem), (void*)&src);
+	clSetKernelArg(ker_gather, 2, sizeof(cl_mem), (void*)&index);
+	clSetKernelArg(ker_gather, 3, sizeof(unsigned int), (void*)&nPixel);
+	clSetKernelArg(ker_gather, 4, sizeof(unsigned int), (void*)&n);
 	size_t globalws[1] = {n};
-	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_sigmoid, 1, NULL, globalws, NULL, 0, NULL, event);
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_gather, 1, NULL, globalws, NULL, 0, NULL, event);
 }
 
 /*
- * This function resets prob and adds bias to prob: bias is a layerSize-dim vector 
- * and prob is an nVectorPerBatch x layerSize matrix. The addition simply replicate
- * the bias nVectorPerBatch times to form the prob matrix.
+ * The gathering of byte vectors followed by the normalization, see gpu_normalizeBytes()
 */
-void addBias(floatType* prob, floatType* bias, unsigned int layerSize, unsigned int nVectorPerBatch){
-	for(int i = 0; i < layerSize; i++){
-		floatType t = bias[i];
-		for(int j = 0; j < nVectorPerBatch; j++){
-			prob[j * layerSize + i] = t;
-		}
-	}
-	return;
+void gpu_gatherNormalizeBytes(CL_ENV gpu_env, cl_kernel ker_gather, cl_mem dst, cl_mem src, cl_mem index, cl_mem scale, cl_mem offset, unsigned int nPixel, unsigned int n, cl_event* event){
+	clSetKernelArg(ker_gather, 0, sizeof(cl_mem), (void*)&dst);
+	clSetKernelArg(ker_gather, 1, sizeof(cl_mem), (void*)&src);
+	clSetKernelArg(ker_gather, 2, sizeof(cl_mem), (void*)&index);
+	clSetKernelArg(ker_gather, 3, sizeof(cl_mem), (void*)&scale);
+	clSetKernelArg(ker_gather, 4, sizeof(cl_mem), (void*)&offset);
+	clSetKernelArg(ker_gather, 5, sizeof(unsigned int), (void*)&nPixel);
+	clSetKernelArg(ker_gather, 6, sizeof(unsigned int), (void*)&n);
+	size_t globalws[1] = {n};
+	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_gather, 1, NULL, globalws, NULL, 0, NULL, event);
 }
 
 void gpu_addBias(CL_ENV gpu_env, cl_kernel ker_bias, cl_mem prob, cl_mem bias, unsigned int layerSize, unsigned int nVectorPerBatch, cl_event* event){
@@ -174,22 +308,6 @@ void gpu_addBias(CL_ENV gpu_env, cl_kernel ker_bias, cl_mem prob, cl_mem bias, u
 	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, ker_bias, 1, NULL, globalws, NULL, 0, NULL, event);
 }
 
-/*
- * prob is an nVectorPerBatch x layerSize matrix and sum is a layerSize-dim vector.
- * This function sums each row of prob and stores it in sum
-*/
-
-void sumBatch(floatType* prob, floatType* sum, unsigned int layerSize, unsigned nVectorPerBatch){
-	for(int i = 0; i < layerSize; i++){
-		floatType t = 0.0;
-		for(int j = 0; j < nVectorPerBatch; j++){
-			t += prob[j * layerSize + i];
-		}
-		sum[i] = t;
-	}
-	return;
-}
-
 void gpu_sumBatch(CL_ENV gpu_env, cl_kernel ker_sumbatch, cl_mem prob, cl_mem bias, unsigned int layerSize, unsigned int nVectorPerBatch, cl_event* event){
 	clSetKernelArg(ker_sumbatch, 0, sizeof(cl_mem), (void*)&prob);
 	clSetKernelArg(ker_sumbatch, 1, sizeof(cl_mem), (void*)&bias);
@@ -309,50 +427,6 @@ void gpu_update(CL_ENV gpu_env, cl_kernel kern, cl_mem weight, cl_mem delta_weig
 	gpu_env.status = clEnqueueNDRangeKernel(gpu_env.queue, kern, 1, NULL, globalws, NULL, 0, NULL, event);
 }
 
-
-/*
- * This function returns the Euclidean distance between vector/matrix a and b.
- * Both a and b have a length of n. 
-*/
-
-floatType EuDist(floatType* a, floatType* b, unsigned int n){
-	floatType result = 0.0;
-	for(int i = 0; i < n; i++){
-		result += (a[i] - b[i]) * (a[i] - b[i]);
-	}
-	return result;
-}
-
-
-/*
- * log out data as a csv file
-*/
-void logData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum){
-	ofstream fout;
-	fout.open(filename.c_str(), ios_base::trunc);
-	for(int i = 0; i < Length; i++){
-		fout << data[i * nImageNum];
-		if((i + 1) % stride == 0)
-			fout << endl;
-		else
-			fout << ',';
-	}
-	fout.close();
-	return;
-}
-
-/*
- * log out data as binary file
-*/
-
-void logBinaryData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum){
-	ofstream fout;
-	fout.open(filename.c_str(), ios_base::trunc | ios_base::binary);
-	fout.write((char*)data, Length * nImageNum);
-	fout.close();
-	return;
-}
-
 /*
  * Initialize the OpenCL GPU environment contained by a CL_ENV object cl_env.
  * cl_env is a newly defined CL_ENV object without initialization and this function
@@ -434,20 +508,4 @@ void gpu_init(CL_ENV& cl_env, unsigned int deviceIndex){
 
 }
 
-/*
- * load kernel source from an OpenCL source file for runtime compiling
-*/
-void loadKernelSource(string filename, char* source){
-	ifstream fin;
-	string srt;
-	fin.open(filename.c_str(), ios_base::in);
-	char t[500];
-	while(fin.getline(t, 500)){
-		srt.append(t);
-		srt.push_back('\n');
-	}
-	for(int i = 0; i < srt.length(); i++)
-		source[i] = srt[i];
-	source[srt.length()] = 0;
-	return;
-}
+#endif
@@ -1,14 +1,9 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
-#define _AMD_CPU_
+// choose platform to compile, the CPU implementation alone is built with -DCPU_ONLY
+#ifndef CPU_ONLY
 #define _AMD_GPU_
-
-// choose platform to compile
-#ifdef _AMD_CPU_
-
-#include<acml.h>
-
 #endif
 
 #ifdef _AMD_GPU_
@@ -22,12 +17,39 @@
 #include<fstream>
 #include<cstdlib>
 #include<vector>
+#include "simd.h"
+#include "gemm.h"
+#include "rng.h"
 
 using namespace std;
 
 // float points precision
 typedef float floatType;
 
+void reset(floatType* a, unsigned int n);
+
+void randomInit(floatType* a, unsigned int n, floatType inf, floatType sup);
+
+void gaussInit(floatType* a, unsigned int n, floatType E, floatType V);
+
+floatType gaussRand(floatType E, floatType V);
+
+void addBias(floatType* prob, floatType* bias, unsigned int layerSize, unsigned int nVectorPerBatch);
+
+void sumBatch(floatType* prob, floatType* sum, unsigned int layerSize, unsigned nVectorPerBatch);
+
+floatType EuDist(floatType* a, floatType* b, unsigned int n);
+
+floatType foldedEuDist(floatType* x, floatType* b, floatType* scale, floatType* offset, unsigned int layerSize, unsigned int nVectorPerBatch);
+
+void logData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum);
+
+void logBinaryData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum);
+
+void loadKernelSource(string filename, char* source);
+
+#ifdef _AMD_GPU_
+
 class CL_ENV
 {
 public:
@@ -42,32 +64,31 @@ public:
 	clAmdBlasOrder order;
 };
 
-void reset(floatType* a, unsigned int n);
-
 void gpu_reset(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, unsigned n, cl_event* event);
 
-void randomInit(floatType* a, unsigned int n, floatType inf, floatType sup);
+// the GPU versions of rngUniform() and rngNormal(), the same numbers for the first n - n % 4 entries
+void gpu_randomInit(CL_ENV gpu_env, cl_kernel kern, cl_mem a, unsigned int n, floatType inf, floatType sup, rngStream& stream, cl_event* event);
 
-void gpu_randomInit(CL_ENV gpu_env, cl_kernel kern, cl_mem a, unsigned int n, floatType inf, floatType sup, cl_event* event);
+void gpu_gaussInit(CL_ENV gpu_env, cl_kernel kern, cl_mem a, unsigned int n, floatType E, floatType V, rngStream& stream, cl_event* event);
 
-void gaussInit(floatType* a, unsigned int n, floatType E, floatType V);
+void gpu_random(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, unsigned int n, floatType inf, floatType sup, rngStream& stream, cl_event* event);
 
-void gpu_gaussInit(CL_ENV gpu_env, cl_kernel kern, cl_mem a, unsigned int n, floatType E, floatType V, cl_event* event);
+void gpu_sigmoid(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, unsigned int n, cl_event* event);
 
-floatType gaussRand(floatType E, floatType V);
+// convert n values of src to 16-bit values of the format in dst, see floatToHalf()
+void gpu_floatToHalf(CL_ENV gpu_env, cl_kernel kern, cl_mem dst, cl_mem src, storageFormat format, unsigned int n, cl_event* event);
 
-void gpu_random(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, unsigned int n, floatType inf, floatType sup, cl_event* event);
+// pack n binary values of src into n / 8 bytes of dst, see packBits()
+void gpu_packBits(CL_ENV gpu_env, cl_kernel kern, cl_mem dst, cl_mem src, unsigned int n, cl_event* event);
 
-void sigmoid(floatType* a, unsigned int n);
+void gpu_normalizeBytes(CL_ENV gpu_env, cl_kernel kern, cl_mem dst, cl_mem src, unsigned int srcOffset, cl_mem scale, cl_mem offset, unsigned int nPixel, unsigned int n, cl_event* event);
 
-void gpu_sigmoid(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, unsigned int n, cl_event* event);
+void gpu_gatherVectors(CL_ENV gpu_env, cl_kernel kern, cl_mem dst, cl_mem src, cl_mem index, unsigned int nPixel, unsigned int n, cl_event* event);
 
-void addBias(floatType* prob, floatType* bias, unsigned int layerSize, unsigned int nVectorPerBatch);
+void gpu_gatherNormalizeBytes(CL_ENV gpu_env, cl_kernel kern, cl_mem dst, cl_mem src, cl_mem index, cl_mem scale, cl_mem offset, unsigned int nPixel, unsigned int n, cl_event* event);
 
 void gpu_addBias(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem prob, cl_mem bias, unsigned int layerSize, unsigned int nVectorPerBatch, cl_event* event);
 
-void sumBatch(floatType* prob, floatType* sum, unsigned int layerSize, unsigned nVectorPerBatch);
-
 void gpu_sumBatch(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem prob, cl_mem bias, unsigned int layerSize, unsigned int nVectorPerBatch, cl_event* event);
 
 void gpu_add(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, cl_mem b, unsigned int n, cl_event* event);
@@ -82,12 +103,6 @@ void gpu_deriv(CL_ENV gpu_env, cl_kernel kern, cl_mem err, cl_mem act, unsigned
 
 void gpu_update(CL_ENV gpu_env, cl_kernel kern, cl_mem weight, cl_mem delta_weight, cl_mem bias, cl_mem delta_bias, floatType eps_w, floatType eps_b, unsigned int nBottomLayerSize, unsigned int nUpperLayerSize, cl_event* event);
 
-floatType EuDist(floatType* a, floatType* b, unsigned int n);
-
-void logData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum);
-
-void logBinaryData(string filename, floatType* data, unsigned int Length, unsigned int stride, unsigned int nImageNum);
-
 void gpu_init(CL_ENV& cl_env, unsigned int deviceIndex);
 
 void gpu_updateWeights(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem weights, cl_mem delta_weights, cl_mem posProds, cl_mem negProds, floatType momentum, floatType eps_w, floatType weightCost, unsigned int nVisLayerSize, unsigned int nHidLayerSize, unsigned int nVectorPerBatch, cl_event* event);
@@ -96,6 +111,6 @@ void gpu_updateBias(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem bias, cl_mem de
 
 void gpu_squareError(CL_ENV gpu_env, cl_kernel biasKernel, cl_mem a, cl_mem b, cl_mem c, unsigned int n);
 
-void loadKernelSource(string filename, char* source);
+#endif
 
 #endif